@@ -1,6 +1,7 @@
 from itertools import product, combinations
 from collections import defaultdict
 import socket
+import struct
 import matplotlib.pyplot as plt
 import numpy as np
 import quaternion
@@ -12,6 +13,13 @@ data_fields = {'quat_w', 'quat_x', 'quat_y', 'quat_z', 'accel_x', 'accel_y', 'ac
                'gyro_x', 'gyro_y', 'gyro_z', 'compass_x', 'compass_y', 'compass_z'}
 
 
+# Frames from the snowtrack firmware and snowtrack_proto
+RESP_STATUS = 0
+RESP_QUATS = 2
+TYPE_STREAM_START = 0x0B
+Q14_ONE = 16384
+
+
 def wrap_angle(ang):
     ang = (ang + 180) % 360 - 180
     return ang
@@ -56,6 +64,7 @@ class quaternion_plotter():
         self.read_freq = 1e3
         self.plot_freq = 30
         self.maxpoints = 10*self.read_freq
+        self.rx = bytearray()
         self.out_file = open(f'runs/run_{time.time_ns() // 1_000_000}.csv', 'w')
 
         self.t_start = datetime.datetime.now()
@@ -77,24 +86,35 @@ class quaternion_plotter():
         # self.mags = [self.mag]
 
 
-    def update_data(self, line: bytes):
-        if line:
-            dp = line.decode().split('\n')[0]
-            quat = dp.split(' ')
-            quat_w = float(quat[0])
-            quat_x = float(quat[1])
-            quat_y = float(quat[2])
-            quat_z = float(quat[3])
+    def update_data(self, chunk: bytes):
+        # Returns True if the chunk completed any quaternions
+        self.rx += chunk
+        got = False
+        while len(self.rx) >= 2:
+            if self.rx[0] == RESP_STATUS:
+                del self.rx[:2]
+                continue
+            if self.rx[0] != RESP_QUATS:
+                # Out of step, skip to the next byte
+                del self.rx[:1]
+                continue
+            end = 2 + 8*self.rx[1]
+            if len(self.rx) < end:
+                break
+
+            millis = time.time_ns() // 1_000_000
+            for quat in struct.iter_unpack('<4h', self.rx[2:end]):
+                quat_w, quat_x, quat_y, quat_z = (c / Q14_ONE for c in quat)
+                out_string = f'{millis},{quat_w},{quat_x},{quat_y},{quat_z},42,-71,0,0\n'
+                self.out_file.write(out_string)
+                print(out_string)
             self.data['quat_w'] = quat_w
             self.data['quat_x'] = quat_x
             self.data['quat_y'] = quat_y
             self.data['quat_z'] = quat_z
-
-            millis = time.time_ns() // 1_000_000
-
-            out_string = f'{millis},{quat_w},{quat_x},{quat_y},{quat_z},42,-71,0,0\n'
-            self.out_file.write(out_string)
-            print(out_string)
+            del self.rx[:end]
+            got = True
+        return got
 
         # if line:
         #     remaining_keys = data_fields.copy()
@@ -156,13 +176,13 @@ class quaternion_plotter():
 
         with socket.socket(socket.AF_BLUETOOTH, socket.SOCK_STREAM, socket.BTPROTO_RFCOMM) as s:
             s.connect(('5C:01:3B:61:FD:A2', 1))
+            s.send(bytes([TYPE_STREAM_START]))
             while self.running:
                 dt = datetime.datetime.now() - self.t
                 if dt.total_seconds() >= 1./self.read_freq:
                     try:
-                        line = s.recv(100)
-                        if line:
-                            self.update_data(line)
+                        chunk = s.recv(1024)
+                        if chunk and self.update_data(chunk):
                             self.process_data()
                             self.update_timeseries()
                     except:
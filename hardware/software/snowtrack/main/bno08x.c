@@ -1,10 +1,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/i2c_master.h"
 // #include "driver/i2c.h"
 #include "driver/gpio.h"
@@ -12,6 +15,20 @@
 #include "esp_intr_alloc.h"
 #include "esp_log.h"
 #include "bno08x.h"
+#if CONFIG_BNO08X_TRANSPORT_SPI
+#include "driver/spi_master.h"
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+#include "shtp_spi.h"
+#endif
+#if CONFIG_BNO08X_TRACE
+#include <stdio.h>
+#include "esp_spiffs.h"
+#include "shtp_trace.h"
+#endif
+#if CONFIG_BNO08X_FRS_CACHE
+#include "frs_cache.h"
+#endif
 
 #include "sh2.h"
 #include "sh2_SensorValue.h"
@@ -29,6 +46,8 @@
 #define INT_PIN GPIO_NUM_32
 #define RST_PIN GPIO_NUM_33
 #define RST_BITMASK (1ULL << GPIO_NUM_33)
+#define SCL_PIN GPIO_NUM_22
+#define SDA_PIN GPIO_NUM_21
 
 #define I2C_TIMEOUT_MS 1000
 
@@ -39,23 +58,160 @@
 #define DEG_TO_RAD 0.017453292519943295769236907684886
 #define RAD_TO_DEG 57.295779513082320876798154814105
 
-#define SQ(x) (x * x)
 
 #define min(a, b) a < b ? a : b
 
-typedef struct {
-    double yaw;
-    double pitch;
-    double roll;
-} euler_t;
+// Longest the hub takes from reset to its advertisement, with fast boot
+#define BNO_BOOT_WAIT_US 300000
+// Longest H_INTN stays asserted after a soft reset is written
+#define BNO_SOFT_RESET_US 10000
+
+// Timeouts in a row before a timeout on a free bus stops being retried
+#define I2C_RECOVER_TIMEOUTS 3
+// Minimum time between hub resets, so a dead hub isn't reset on every poll
+#define I2C_RECOVER_HUB_HOLDOFF_US 2000000
 
 static const char *TAG = "BNO08X";
 
 static bool _reset_occurred = false;
-static sh2_SensorValue_t *_sensor_value = NULL;
+#if CONFIG_BNO08X_FAST_BOOT
+static bool _hub_booted = false;  // Out of RSTN with H_INTN asserted, not opened yet
+#endif
+static bno_boot_profile_t _boot = {0};
+static TaskHandle_t _imu_task = NULL;
+#if CONFIG_BNO08X_INT_DRIVEN
+// Task that reads the bus when the I/O task is in use, NULL until it starts
+static TaskHandle_t _io_task = NULL;
+// Task in hintn_wait(), woken by H_INTN as well as the bus reader
+static volatile TaskHandle_t _hintn_waiter = NULL;
+#endif
+// Host time of the last H_INTN edge. 32 bits so the ISR's store can't be
+// read half-written; consumers want 32-bit HAL timestamps anyway.
+static volatile uint32_t _hintn_time_us = 0;
+#if CONFIG_BNO08X_TRANSPORT_I2C
+// Size of the first read of each transfer, tracks the last transfer seen
+static uint16_t _first_read_len = 4;
+#endif
+static bno_read_stats_t _read_stats = {0};
+// 10 kHz is the rate the BNO08x clock stretching is known to survive
+static const uint32_t i2c_rates[BNO_I2C_RATES] = {10000, 25000, 50000, 100000, 200000, 400000};
+static uint8_t _rate_idx = 0;
+static bno_i2c_rate_stats_t _rate_stats = {0};
+static bno_recovery_stats_t _recovery_stats = {0};
+static uint8_t _timeout_run = 0;
+static int64_t _hub_reset_time_us = 0;
+static bno_perf_stats_t _perf_stats = {0};
+static shtp_ChanMetrics_t _metrics_prev[SHTP_MAX_CHANS];
+static int64_t _metrics_prev_us = 0;
+// Running total of time blocked on I2C, sampled around each sh2_service()
+static uint64_t _bus_wait_us = 0;
+#if CONFIG_BNO08X_I2C_ASYNC
+static SemaphoreHandle_t _i2c_done = NULL;
+static volatile i2c_master_event_t _i2c_event;
+// Speculative read of the next transfer, queued while sh2 decodes the last
+static uint8_t _prefetch_buf[I2C_MAX_BUF_LEN];
+static uint16_t _prefetch_len = 0;  // Bytes read or being read, 0 if none
+static bool _prefetch_busy = false; // Still on the bus
+static bool _i2c_abandoned = false; // Timed out waiting, may still finish
+static uint32_t _prefetch_t_us;
+#endif
+// Decoded reports waiting for bno_getSensorEvent(), oldest at _event_head.
+// Only touched on the IMU task. Sized for a full sh2 batch, or with hub
+// batching for a payload packed with 14-byte rotation vectors.
+#if CONFIG_BNO08X_BATCH_INTERVAL_MS > 0
+#define BNO_EVENT_FIFO_LEN (SH2_HAL_MAX_PAYLOAD_IN / 14)
+#else
+#define BNO_EVENT_FIFO_LEN SH2_MAX_BATCH_EVENTS
+#endif
+static sh2_SensorValue_t _events[BNO_EVENT_FIFO_LEN];
+static uint16_t _event_head = 0;
+static uint16_t _event_count = 0;
+#if CONFIG_BNO08X_GIRV
+#if (CONFIG_BNO08X_GIRV_RING_SLOTS & (CONFIG_BNO08X_GIRV_RING_SLOTS - 1)) != 0
+#error "CONFIG_BNO08X_GIRV_RING_SLOTS must be a power of 2"
+#endif
+// Gyro integrated rotation vectors, written by the IMU task as they're
+// decoded and taken by one reader task. Free-running indices.
+static bno_girv_sample_t _girv_ring[CONFIG_BNO08X_GIRV_RING_SLOTS];
+static atomic_uint _girv_head;
+static atomic_uint _girv_tail;
+static TaskHandle_t _girv_reader = NULL;
+#endif
+// How long the hub may hold reports in its FIFO, see bno_set_batching()
+static uint32_t _batch_interval_us = CONFIG_BNO08X_BATCH_INTERVAL_MS * 1000;
+#if CONFIG_BNO08X_TRANSPORT_I2C
 static sh2_Hal_t _HAL;
+#endif
 static sh2_ProductIds_t prodIds;
 QueueHandle_t result_queue = NULL;
+
+// sh2 operations other tasks have asked the IMU task to run
+#define BNO_OP_MAILBOX_LEN 4
+
+typedef struct {
+    bno_op_start_t *start;
+    void *arg;
+    bno_op_done_t *done;
+    void *cookie;
+    bool local;     // Only reads driver state, start's return is the final status
+} bno_op_t;
+
+static QueueHandle_t _op_mailbox = NULL;
+
+// Sensor streams the hub should be sending. Other tasks add and change
+// entries, the IMU task pushes them to the hub and dispatches the reports.
+typedef struct {
+    sh2_SensorId_t sensor_id;     // 0 if the slot is free
+    uint32_t interval_us;         // 0 once unsubscribed, until the hub is told
+    bno_consumer_t *consumer;
+    void *cookie;
+    bool pending;                 // Config not sent to the hub yet
+    bool have_latest;
+    sh2_SensorValue_t latest;
+} bno_subscription_t;
+
+static bno_subscription_t _subs[BNO_MAX_SUBSCRIPTIONS];
+static portMUX_TYPE _subs_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool _subs_pending = false;
+
+// Hub power state asked for by bno_standby() and bno_resume(), and the one
+// the IMU task last put the hub in
+typedef enum {
+    BNO_POWER_ON = 0,
+    BNO_POWER_STANDBY,
+} bno_power_t;
+
+static volatile bno_power_t _power_req = BNO_POWER_ON;
+static bno_power_t _power = BNO_POWER_ON;
+static int64_t _resume_start_us = 0;  // Waiting for the first accurate report since
+
+// Rotation vector convergence since the hub last started
+static bno_cal_stats_t _cal_stats = {0};
+static int64_t _cal_start_us = 0;
+#if CONFIG_BNO08X_SAVE_DCD_ON_STANDBY
+static volatile bool _save_dcd = false;  // Save DCD before the next standby
+#endif
+
+#if CONFIG_BNO08X_FRS_CACHE
+// FRS records cached along with the metadata of every subscribed sensor
+static const uint16_t _cached_frs[] = {
+    SYSTEM_ORIENTATION,
+#if CONFIG_BNO08X_GIRV
+    GYRO_INTEGRATED_RV_CONFIG,
+#endif
+};
+#define BNO_CACHED_FRS (sizeof(_cached_frs) / sizeof(_cached_frs[0]))
+
+// Background fill of the cache: entries are checked in turn, subscription
+// slots first, and a missing one is read from the hub while reports flow
+static bool _cache_ready = false;
+static uint8_t _cache_next = 0;
+static bool _cache_busy = false;
+static sh2_SensorId_t _cache_sensor_id;
+static sh2_SensorMetadata_t _cache_meta;
+static uint32_t _cache_frs[FRS_CACHE_MAX_WORDS];
+static uint16_t _cache_frs_words;
+#endif
 bool recorder_state = false;
 
 gpio_config_t rst_config = {
@@ -69,17 +225,35 @@ gpio_config_t rst_config = {
 
 static esp_err_t bno_reset();
 static bool bno_enableReport(sh2_SensorId_t sensorId, uint32_t interval_us);
+static void bno_resubscribe_all(void);
+static void bno_apply_subscriptions(void);
+static void rv_consumer(const sh2_SensorValue_t *value, void *cookie);
 
 static void hal_callback(void *cookie, sh2_AsyncEvent_t *pEvent);
-static void sensorHandler(void *cookie, sh2_SensorEvent_t *event);
+static void sensorHandler(void *cookie, const sh2_SensorEventRef_t *events, uint16_t count);
+#if CONFIG_BNO08X_TRANSPORT_I2C
 static uint32_t hal_getTimeUs(sh2_Hal_t *self);
+#endif
 static i2c_master_bus_handle_t bus_handle = NULL;
 static i2c_master_dev_handle_t dev_handle = NULL;
-
+#if CONFIG_BNO08X_TRANSPORT_SPI
+static spi_device_handle_t spi_dev = NULL;
+static bool _spi_cs_active = false;
+// Clocked out on MOSI when SHTP has nothing to send
+static DMA_ATTR uint8_t _spi_zeros[SH2_HAL_MAX_TRANSFER_IN];
+static shtp_spi_t _spi_hal;
+#endif
+#if CONFIG_BNO08X_TRACE
+static shtp_trace_t _trace;
+static FILE *_trace_file = NULL;
+#endif
+
+#if CONFIG_BNO08X_TRANSPORT_I2C
 static int i2chal_open(sh2_Hal_t *self);
 static void i2chal_close(sh2_Hal_t *self);
 static int i2chal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us);
 static int i2chal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len);
+#endif
 
 // I hate espressif
 // static esp_err_t i2c_master_init_legacy(void) 
@@ -96,6 +270,48 @@ static int i2chal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len);
 //     return i2c_master_read_from_device(0, slv_address, data, data_len * sizeof(uint8_t), pdMS_TO_TICKS(1000999999999990));
 // }
 
+#if CONFIG_BNO08X_I2C_ASYNC
+// Runs in the I2C ISR when a queued transaction completes
+static bool IRAM_ATTR i2c_done_callback(i2c_master_dev_handle_t dev, const i2c_master_event_data_t *evt, void *arg)
+{
+    BaseType_t higher_prio_woken = pdFALSE;
+
+    _i2c_event = evt->event;
+    xSemaphoreGiveFromISR(_i2c_done, &higher_prio_woken);
+    return higher_prio_woken == pdTRUE;
+}
+#endif
+
+static esp_err_t i2c_add_device(void)
+{
+    esp_err_t ret;
+    i2c_device_config_t dev_cfg = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = BNO_ADDR,
+        // BNO086 needs to be clock stretched and ESP32 doesn't support it, so
+        // start at 10kHz. The adaptive mode moves this up while reads stay clean.
+        .scl_speed_hz = i2c_rates[_rate_idx],
+    };
+
+    if ((ret = i2c_master_bus_add_device(bus_handle, &dev_cfg, &dev_handle)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't add I2C device: (%s)", esp_err_to_name(ret));
+        dev_handle = NULL;
+        return ret;
+    }
+
+#if CONFIG_BNO08X_I2C_ASYNC
+    // With a callback registered, transmit/receive queue and return at once
+    i2c_master_event_callbacks_t cbs = {
+        .on_trans_done = i2c_done_callback,
+    };
+    if ((ret = i2c_master_register_event_callbacks(dev_handle, &cbs, NULL)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't register I2C callbacks: (%s)", esp_err_to_name(ret));
+    }
+#endif
+
+    return ret;
+}
+
 static esp_err_t i2c_master_init(void)
 {
     esp_err_t ret;
@@ -104,9 +320,12 @@ static esp_err_t i2c_master_init(void)
         i2c_master_bus_config_t i2c_mst_config = {
             .clk_source = I2C_CLK_SRC_DEFAULT,
             .i2c_port = I2C_NUM_0,
-            .scl_io_num = GPIO_NUM_22,
-            .sda_io_num = GPIO_NUM_21,
+            .scl_io_num = SCL_PIN,
+            .sda_io_num = SDA_PIN,
             .glitch_ignore_cnt = 7,
+#if CONFIG_BNO08X_I2C_ASYNC
+            .trans_queue_depth = 2,
+#endif
             .flags.enable_internal_pullup = true
         };
 
@@ -134,428 +353,2120 @@ static esp_err_t i2c_master_init(void)
         }   
     }
     
-    if (dev_handle == NULL) {
-        i2c_device_config_t dev_cfg = {
-            .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-            .device_address = BNO_ADDR,
-            .scl_speed_hz = 10000, // BNO086 needs to be clock stretched and ESP32 doesn't support it so reduce the clock speed to 10kHz
-        };
-        
-        if ((ret = i2c_master_bus_add_device(bus_handle, &dev_cfg, &dev_handle)) != ESP_OK) {
-            ESP_LOGE(TAG, "Couldn't add I2C device: (%s)", esp_err_to_name(ret));
-            return ret;
-        }
+    if (dev_handle == NULL && (ret = i2c_add_device()) != ESP_OK) {
+        return ret;
     }
 
+#if !CONFIG_BNO08X_FAST_BOOT
     vTaskDelay(pdMS_TO_TICKS(10));
+#endif
     ESP_LOGI(TAG, "I2C initialized");
     return ESP_OK;
 }
 
-esp_err_t i2c_write(uint8_t slv_address, const uint8_t *data, uint8_t data_len)
+#if CONFIG_BNO08X_I2C_ADAPTIVE
+#define I2C_RATE_WINDOW       200  // Transactions between rate decisions
+#define I2C_RATE_BURST        3    // Back-to-back errors that force a fallback at once
+#define I2C_RATE_MAX_HOLDOFF  64   // Longest wait, in windows, before re-probing a failed rate
+
+// Number of rates at or below the configured ceiling
+static uint8_t _rate_count = 0;
+static uint16_t _window_tx = 0;
+static uint16_t _window_err = 0;
+static uint8_t _burst = 0;
+// Clean windows still to run before probing each rate again, and how long
+// that wait is next time the rate fails. Doubles on every failure so a
+// marginal rate isn't retried constantly.
+static uint16_t _holdoff[BNO_I2C_RATES] = {0};
+static uint16_t _penalty[BNO_I2C_RATES] = {0};
+
+static void i2c_rate_set(uint8_t idx)
 {
-    return i2c_master_transmit(dev_handle, data, data_len, 1000);
+    uint32_t old_hz = i2c_rates[_rate_idx];
+
+    // Only the device changes speed, the bus and any transfer state stay put
+    if (dev_handle != NULL) {
+        i2c_master_bus_rm_device(dev_handle);
+        dev_handle = NULL;
+    }
+    _rate_idx = idx;
+    _rate_stats.changes++;
+    i2c_add_device();
+
+    ESP_LOGI(TAG, "I2C clock %" PRIu32 " -> %" PRIu32 " Hz", old_hz, i2c_rates[idx]);
 }
 
-esp_err_t i2c_read(uint8_t slv_address, uint8_t *data, uint8_t data_len)
+static void i2c_rate_fall(void)
 {
-    return i2c_master_receive(dev_handle, data, data_len, 1000);
+    _window_tx = 0;
+    _window_err = 0;
+    _burst = 0;
+
+    if (_rate_idx == 0) {
+        // Already at the floor, nothing slower to try
+        return;
+    }
+
+    _rate_stats.rate[_rate_idx].fallbacks++;
+    _penalty[_rate_idx] = _penalty[_rate_idx] ? _penalty[_rate_idx] * 2 : 1;
+    if (_penalty[_rate_idx] > I2C_RATE_MAX_HOLDOFF) {
+        _penalty[_rate_idx] = I2C_RATE_MAX_HOLDOFF;
+    }
+    _holdoff[_rate_idx] = _penalty[_rate_idx];
+
+    i2c_rate_set(_rate_idx - 1);
 }
 
-void hintn_callback(void* arg)
+static void i2c_rate_update(bool error)
 {
-    ESP_LOGI(TAG, "hintn_callback");
-}
+    if (error) {
+        _window_err++;
+        if (++_burst >= I2C_RATE_BURST) {
+            i2c_rate_fall();
+            return;
+        }
+    } else {
+        _burst = 0;
+    }
+
+    if (_window_tx < I2C_RATE_WINDOW) {
+        return;
+    }
+
+    if ((uint32_t)_window_err * 1000 > (uint32_t)CONFIG_BNO08X_I2C_ERROR_BUDGET * _window_tx) {
+        i2c_rate_fall();
+        return;
+    }
 
-void quaternionToEuler(double qr, double qi, double qj, double qk, euler_t* ypr, bool degrees) {
-    // ESP_LOGI(SPP_TAG, "Before sqrt %fw, %fi, %fj, %fk", qr, qi, qj, qk);
-    double sqr = SQ(qr);
-    double sqi = SQ(qi);
-    double sqj = SQ(qj);
-    double sqk = SQ(qk);
-    // ESP_LOGI(SPP_TAG, "After sqrt %fw, %fi, %fj, %fk", sqr, sqi, sqj, sqk);
-    // ESP_LOGI(SPP_TAG, "Yaw First part: %f, second part: %f", 2.0 * (qi * qj + qk * qr), (sqi - sqj - sqk + sqr));
-    ypr->yaw = atan2(2.0 * (qi * qj + qk * qr), (sqi - sqj - sqk + sqr));
-    ypr->pitch = asin(-2.0 * (qi * qk - qj * qr) / (sqi + sqj + sqk + sqr));
-    ypr->roll = atan2(2.0 * (qj * qk + qi * qr), (-sqi - sqj + sqk + sqr));
-    // ESP_LOGI(SPP_TAG, "Rad: yaw = %f, pitch = %f, roll = %f", ypr->yaw, ypr->pitch, ypr->roll);
-    if (degrees) {
-      ypr->yaw *= RAD_TO_DEG;
-      ypr->pitch *= RAD_TO_DEG;
-      ypr->roll *= RAD_TO_DEG;
+    // Clean window, this rate is earning back its standing
+    _window_tx = 0;
+    _window_err = 0;
+    _penalty[_rate_idx] /= 2;
+
+    uint8_t next = _rate_idx + 1;
+    if (next >= _rate_count) {
+        return;
     }
+    if (_holdoff[next] > 0) {
+        _holdoff[next]--;
+        return;
+    }
+    i2c_rate_set(next);
 }
+#endif
+
+// Account one I2C transaction against the current clock rate
+static void i2c_rate_record(esp_err_t ret)
+{
+    bno_i2c_rate_t *rate = &_rate_stats.rate[_rate_idx];
 
-void quaternionToEulerRV(sh2_RotationVectorWAcc_t* rotational_vector, euler_t* ypr, bool degrees) {
-    quaternionToEuler(rotational_vector->real, rotational_vector->i, rotational_vector->j, rotational_vector->k, ypr, degrees);
+    rate->transactions++;
+    if (ret == ESP_ERR_INVALID_RESPONSE) {
+        rate->nacks++;
+    } else if (ret != ESP_OK) {
+        rate->timeouts++;
+    }
+
+#if CONFIG_BNO08X_I2C_ADAPTIVE
+    _window_tx++;
+    i2c_rate_update(ret != ESP_OK);
+#endif
 }
 
-esp_err_t bno_init()
+#if CONFIG_BNO08X_TRANSPORT_I2C
+// A read that completed but carried garbage, typically a clock stretch the
+// controller didn't honour. Already counted as a transaction.
+static void i2c_rate_corrupt(void)
 {
-    // int i2c_master_port = I2C_MASTER_NUM;
+    _rate_stats.rate[_rate_idx].corrupt++;
 
-    // i2c_config_t conf = {
-    //     .mode = I2C_MODE_MASTER,
-    //     .sda_io_num = 21,
-    //     .scl_io_num = 22,
-    //     .sda_pullup_en = 0,
-    //     .scl_pullup_en = 0,
-    //     .master.clk_speed = I2C_MASTER_FREQ_HZ,
-    // };
+#if CONFIG_BNO08X_I2C_ADAPTIVE
+    i2c_rate_update(true);
+#endif
+}
+#endif
 
-    // i2c_param_config(i2c_master_port, &conf);
+// SDA held low between transactions means a device is mid-byte and won't
+// let go until it's clocked out
+static bool i2c_sda_stuck(void)
+{
+    return gpio_get_level(SDA_PIN) == 0;
+}
 
-    // i2c_driver_install(i2c_master_port, conf.mode, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
+// Decide how to recover from a failed transaction and do it. level is the
+// step already taken for this transaction. Returns true if the transaction
+// should be issued again.
+static bool i2c_recover(esp_err_t cause, bno_recover_level_t *level)
+{
+    bool stuck = i2c_sda_stuck();
+    bno_recover_level_t next;
 
-    esp_err_t ret = gpio_config(&rst_config);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Couldn't configure RST GPIO! (%s)", esp_err_to_name(ret));
+    if (cause == ESP_ERR_TIMEOUT) {
+        _timeout_run++;
     }
 
-    result_queue = xQueueCreate(5, sizeof(quat_t));
+    bool abandoned = false;
+#if CONFIG_BNO08X_I2C_ASYNC
+    // A transaction given up on can still fill its buffer and give
+    // _i2c_done later, which a plain retry would take for its own
+    abandoned = _i2c_abandoned;
+#endif
+
+    if (stuck || abandoned || cause == ESP_ERR_INVALID_STATE) {
+        // Controller or bus wedged, a plain retry won't get through
+        next = BNO_RECOVER_BUS_RESET;
+    } else if (cause == ESP_ERR_TIMEOUT) {
+        next = (_timeout_run < I2C_RECOVER_TIMEOUTS) ? BNO_RECOVER_RETRY : BNO_RECOVER_BUS_RESET;
+    } else {
+        // NACKs and the like, the hub is busy. shtp will poll again.
+        return false;
+    }
 
-    if ((ret = bno_reset()) != ESP_OK) {
-        ESP_LOGE(TAG, "Couldn't reset IMU, continuing (%s)", esp_err_to_name(ret));
+    if (next <= *level) {
+        next = *level + 1;
+    }
+    if (next == BNO_RECOVER_HUB_RESET &&
+        esp_timer_get_time() - _hub_reset_time_us < I2C_RECOVER_HUB_HOLDOFF_US) {
+        next = BNO_RECOVER_HUB_RESET + 1;
     }
 
-    if ((ret = i2c_master_init()) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to init I2C (%s)", esp_err_to_name(ret));
-        return ret;
+    _recovery_stats.last_cause = cause;
+    if (stuck) {
+        _recovery_stats.stuck_sda++;
     }
 
-    _HAL.open = i2chal_open;
-    _HAL.close = i2chal_close;
-    _HAL.read = i2chal_read;
-    _HAL.write = i2chal_write;
-    _HAL.getTimeUs = hal_getTimeUs;
+    if (next > BNO_RECOVER_HUB_RESET) {
+        _recovery_stats.failures++;
+        ESP_LOGE(TAG, "I2C recovery exhausted (%s%s)", esp_err_to_name(cause), stuck ? ", SDA stuck" : "");
+        return false;
+    }
 
-    // Open SH2, if it fails then sh2 may already be open, so try closing then re-open
-    int status = sh2_open(&_HAL, hal_callback, NULL);
-    if (status != SH2_OK) {
-        ESP_LOGW(TAG, "Couldn't open sh2");
-        sh2_reinitialize();
-        // ESP_LOGI(TAG, "SH2 may already open, closing and reopening... (%d)", status);
-        // status = sh2_open(&_HAL, hal_callback, NULL);
-        // if (status != SH2_OK) {
-        //     ESP_LOGE(TAG, "Couldn't open sh2 (%d)", status);
-        //     return ESP_FAIL;
-        // }
+    *level = next;
+    _recovery_stats.last_level = next;
+
+    if (next == BNO_RECOVER_RETRY) {
+        _recovery_stats.retries++;
+        return true;
     }
 
-    memset(&prodIds, 0, sizeof(prodIds));
-    status = sh2_getProdIds(&prodIds);
-    if (status != SH2_OK) {
-        ESP_LOGE(TAG, "Couldn't get product ids (%d)", status);
-        // return ESP_FAIL;
+    int64_t start = esp_timer_get_time();
+    bool retry = true;
+
+    if (next == BNO_RECOVER_BUS_RESET) {
+        _recovery_stats.bus_resets++;
+        // The driver clocks SDA free if it's held. Rebuild the bus if not.
+        if (i2c_master_bus_reset(bus_handle) != ESP_OK || i2c_sda_stuck()) {
+            i2c_master_init();
+        }
+#if CONFIG_BNO08X_I2C_ASYNC
+        _i2c_abandoned = false;
+#endif
+    } else {
+        _recovery_stats.hub_resets++;
+#if CONFIG_BNO08X_I2C_ASYNC
+        _prefetch_len = 0;
+        _i2c_abandoned = false;
+#endif
+        bno_reset();
+        i2c_master_init();
+        _hub_reset_time_us = esp_timer_get_time();
+        // The hub starts over with an advertisement, sh2 picks it up on the
+        // next read. Whatever this transaction carried is gone.
+        retry = false;
     }
-    ESP_LOGI(TAG, "Part number: %lu", prodIds.entry[0].swPartNumber);
+    _timeout_run = 0;
 
-    sh2_setSensorCallback(sensorHandler, NULL);
-    
-    ESP_LOGI(TAG, "BNO Initialized");
-    sh2_SensorId_t reportType = SH2_ROTATION_VECTOR;
-    bno_enableReport(reportType, 30769); // ~32.5Hz update rate
-    ESP_LOGI(TAG, "Reports enabled");
+    uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+    _recovery_stats.last_us = took;
+    if (took > _recovery_stats.max_us) {
+        _recovery_stats.max_us = took;
+    }
+    ESP_LOGW(TAG, "I2C %s after %s%s took %" PRIu32 " us",
+             (next == BNO_RECOVER_BUS_RESET) ? "bus reset" : "hub reset",
+             esp_err_to_name(cause), stuck ? " (SDA stuck)" : "", took);
 
-    return ESP_OK;
+    return retry;
 }
 
-bool bno_getSensorEvent(sh2_SensorValue_t *value) 
+#if CONFIG_BNO08X_I2C_ASYNC
+// Wait for the transaction on the bus to finish and translate its outcome
+static esp_err_t i2c_async_wait(void)
 {
-    _sensor_value = value;
-
-    value->timestamp = 0;
-
-    sh2_service();
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret;
 
-    if (value->timestamp == 0 && value->sensorId != SH2_GYRO_INTEGRATED_RV) {
-        // no new events
-        return false;
+    if (xSemaphoreTake(_i2c_done, pdMS_TO_TICKS(I2C_TIMEOUT_MS)) != pdTRUE) {
+        _i2c_abandoned = true;
+        ret = ESP_ERR_TIMEOUT;
+    } else if (_i2c_event == I2C_EVENT_DONE) {
+        ret = ESP_OK;
+    } else if (_i2c_event == I2C_EVENT_NACK) {
+        ret = ESP_ERR_INVALID_RESPONSE;
+    } else {
+        ret = ESP_ERR_TIMEOUT;
     }
+    _bus_wait_us += esp_timer_get_time() - start;
 
-    return true;
+    return ret;
 }
 
-bool bno_enableReport(sh2_SensorId_t sensorId, uint32_t interval_us) 
+// Drop a completion left over from a transaction given up on, so the wait
+// for the next one can't return early
+static void i2c_async_arm(void)
 {
-    static sh2_SensorConfig_t config;
-
-    // These sensor options are disabled or not used in most cases
-    config.changeSensitivityEnabled = false;
-    config.wakeupEnabled = false;
-    config.changeSensitivityRelative = false;
-    config.alwaysOnEnabled = false;
-    config.changeSensitivity = 0;
-    config.batchInterval_us = 0;
-    config.sensorSpecific = 0;
-
-    config.reportInterval_us = interval_us;
-    
-    int status = sh2_setSensorConfig(sensorId, &config);
+    xSemaphoreTake(_i2c_done, 0);
+}
 
-    if (status != SH2_OK) {
-        ESP_LOGE(TAG, "Couldn't set sensor config (%d)", status);
-        return false;
+// Only one transaction is on the bus at a time, so anything else that wants
+// it lets a queued prefetch finish first. Its data stays for i2chal_read.
+static void i2c_prefetch_finish(void)
+{
+    if (!_prefetch_busy) {
+        return;
     }
+    _prefetch_busy = false;
 
-    return true;
+    esp_err_t ret = i2c_async_wait();
+    i2c_rate_record(ret);
+    if (ret != ESP_OK) {
+        // The blocking path reads it again, and recovers if it has to
+        _prefetch_len = 0;
+    }
 }
+#endif
 
-esp_err_t bno_start_recording() 
+static esp_err_t i2c_bus_transmit(const uint8_t *data, uint8_t data_len)
 {
-    recorder_state = true;
-    return ESP_OK;
+#if CONFIG_BNO08X_I2C_ASYNC
+    i2c_prefetch_finish();
+    i2c_async_arm();
+    esp_err_t ret = i2c_master_transmit(dev_handle, data, data_len, I2C_TIMEOUT_MS);
+    return (ret == ESP_OK) ? i2c_async_wait() : ret;
+#else
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = i2c_master_transmit(dev_handle, data, data_len, I2C_TIMEOUT_MS);
+    _bus_wait_us += esp_timer_get_time() - start;
+    return ret;
+#endif
 }
 
-esp_err_t bno_reset() 
+static esp_err_t i2c_bus_receive(uint8_t *data, uint8_t data_len)
 {
-    esp_err_t ret = gpio_set_level(RST_PIN, 0);
-    vTaskDelay(pdMS_TO_TICKS(1));
-    ret = gpio_set_level(RST_PIN, 1);
-    vTaskDelay(pdMS_TO_TICKS(100));
+#if CONFIG_BNO08X_I2C_ASYNC
+    i2c_prefetch_finish();
+    i2c_async_arm();
+    esp_err_t ret = i2c_master_receive(dev_handle, data, data_len, I2C_TIMEOUT_MS);
+    return (ret == ESP_OK) ? i2c_async_wait() : ret;
+#else
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = i2c_master_receive(dev_handle, data, data_len, I2C_TIMEOUT_MS);
+    _bus_wait_us += esp_timer_get_time() - start;
     return ret;
+#endif
 }
 
-QueueHandle_t bno_get_result_queue() {
-    return result_queue;
-}
-
-void bno_task(void *pvParameters)
+esp_err_t i2c_write(uint8_t slv_address, const uint8_t *data, uint8_t data_len)
 {
-    esp_log_level_set(TAG, ESP_LOG_DEBUG);
-    ESP_ERROR_CHECK(bno_init());
-
-    sh2_SensorValue_t value;
-    euler_t ypr;
-    uint64_t eit = 0, it = 2;
     esp_err_t ret;
-    quat_t quat_result;
-    
-    while (1) {
-        if (bno_getSensorEvent(&value)) {
-            if (it % 900 == 0) {
-                UBaseType_t stack_size = uxTaskGetStackHighWaterMark(NULL);
-                ESP_LOGD(TAG, "Stack size: %lu", stack_size * sizeof(configSTACK_DEPTH_TYPE));
-            }
-
-            // Get latest IMU result
-            switch (value.sensorId) {
-                case SH2_ROTATION_VECTOR:
-                {
-                    quaternionToEulerRV(&value.un.rotationVector, &ypr, true);
-
-                    sh2_RotationVectorWAcc_t *rotvec = &value.un.rotationVector;
-                    quat_result.w = rotvec->real;
-                    quat_result.x = rotvec->i;
-                    quat_result.y = rotvec->j;
-                    quat_result.z = rotvec->k;
-                    BaseType_t rtos_ret;
-                    
-                    // Queue quaternion
-                    if ((rtos_ret = xQueueSend(result_queue, &quat_result, 0)) == errQUEUE_FULL) {
-                        // If queue is full, then pop the last measurement
-                        quat_t temp;
-                        xQueueReceive(result_queue, &temp, 0);
-                        xQueueSend(result_queue, &quat_result, 0);
-                    } else if (rtos_ret != pdTRUE) {
-                        ESP_LOGE(TAG, "Couldn't queue quat result");
-                    }
-                    
-                    if (it++ % 300 == 0) {
-                            ESP_LOGI(TAG, "yaw = %.1f, pitch = %.1f, roll = %.1f", ypr.yaw, ypr.pitch, ypr.roll);
-                    }       
-                } 
-                    break;
-                default:
-                    ESP_LOGW(TAG, "Other sensor event: %u", value.sensorId);
-            }
-            eit = 1;
-            if (it++ % 800 == 0) {
-                i2c_master_init();
-                it++;
-            }    
-        } else if (eit++ >= 1000) { 
-            // ESP_LOGW(TAG, "No sensor events, restarting");
-            // if ((ret = bno_reset()) != ESP_OK) {
-            //     ESP_LOGE(TAG, "Couldn't reset bno (%s)", esp_err_to_name(ret));
-            // } else {
-            //     if ((ret = bno_init()) != ESP_OK) {
-            //         ESP_LOGE(TAG, "Couldn't re-initialize bno (%s)", esp_err_to_name(ret));
-            //     } else {
-            //         eit = 0;
-            //     }
-            // }
-        }
-    
-        if (recorder_state) {
+    bno_recover_level_t level = BNO_RECOVER_NONE;
 
+    while ((ret = i2c_bus_transmit(data, data_len)) != ESP_OK) {
+        i2c_rate_record(ret);
+        if (!i2c_recover(ret, &level)) {
+            return ret;
         }
     }
+    i2c_rate_record(ret);
+    _timeout_run = 0;
 
-    vTaskDelete(NULL);
+    return ret;
 }
 
-esp_err_t bno_tareXY() 
+esp_err_t i2c_read(uint8_t slv_address, uint8_t *data, uint8_t data_len)
 {
-    uint8_t ret = sh2_setTareNow(SH2_TARE_X | SH2_TARE_Y, SH2_TARE_BASIS_ROTATION_VECTOR);
-    if (ret != SH2_OK) {
-        ESP_LOGE(TAG, "Failed to set tare: %d", ret);
-        return ESP_FAIL;
+    esp_err_t ret;
+    bno_recover_level_t level = BNO_RECOVER_NONE;
+
+    while ((ret = i2c_bus_receive(data, data_len)) != ESP_OK) {
+        i2c_rate_record(ret);
+        if (!i2c_recover(ret, &level)) {
+            return ret;
+        }
     }
-    return ESP_OK;
+    i2c_rate_record(ret);
+    _timeout_run = 0;
+
+    return ret;
 }
 
-static uint32_t hal_getTimeUs(sh2_Hal_t *self) {
-    return esp_timer_get_time();
+#if CONFIG_BNO08X_INT_DRIVEN
+// H_INTN falling edge: the hub has a transfer ready. Capture the host time as
+// close to the interrupt as possible and wake whichever task reads the bus,
+// and any task waiting in hintn_wait().
+static void IRAM_ATTR hintn_callback(void* arg)
+{
+    BaseType_t higher_prio_woken = pdFALSE;
+    TaskHandle_t reader = (_io_task != NULL) ? _io_task : _imu_task;
+    TaskHandle_t waiter = _hintn_waiter;
+
+    _hintn_time_us = (uint32_t)esp_timer_get_time();
+    if (reader != NULL) {
+        vTaskNotifyGiveFromISR(reader, &higher_prio_woken);
+    }
+    if (waiter != NULL && waiter != reader) {
+        vTaskNotifyGiveFromISR(waiter, &higher_prio_woken);
+    }
+    portYIELD_FROM_ISR(higher_prio_woken);
 }
 
-static void hal_callback(void *cookie, sh2_AsyncEvent_t *pEvent) 
+static esp_err_t hintn_init(void)
 {
-    // If we see a reset, set a flag so that sensors will be reconfigured.
-    if (pEvent->eventId == SH2_RESET) {
-        ESP_LOGW(TAG, "SH2 reset occured");
-        _reset_occurred = true;
+    gpio_config_t int_config = {
+        .pin_bit_mask = (1ULL << INT_PIN),
+        .intr_type = GPIO_INTR_NEGEDGE,
+        .mode = GPIO_MODE_INPUT,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .pull_up_en = GPIO_PULLUP_ENABLE
+    };
+
+    esp_err_t ret = gpio_config(&int_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't configure INT GPIO (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // ESP_ERR_INVALID_STATE means another driver already installed the service
+    ret = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Couldn't install GPIO ISR service (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    if ((ret = gpio_isr_handler_add(INT_PIN, hintn_callback, NULL)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't add H_INTN handler (%s)", esp_err_to_name(ret));
+        return ret;
     }
+
+    return ESP_OK;
 }
+#endif
 
-static void sensorHandler(void *cookie, sh2_SensorEvent_t *event) 
+static inline bool hintn_asserted(void)
 {
-    int rc;
+    // H_INTN is active low
+    return gpio_get_level(INT_PIN) == 0;
+}
 
-    rc = sh2_decodeSensorEvent(_sensor_value, event);
-    if (rc != SH2_OK) {
-        ESP_LOGE(TAG, "Error decoding sensor event (%d)", rc);
-        _sensor_value->timestamp = 0;
+// Block until the hub signals data or the timeout expires. Returns immediately
+// if H_INTN is still asserted from a transfer we haven't read yet.
+static void bno_waitForData(void)
+{
+#if CONFIG_BNO08X_I2C_ASYNC
+    if (_prefetch_len != 0) {
+        // Already read, or on its way
+        return;
+    }
+#endif
+#if CONFIG_BNO08X_INT_DRIVEN
+    if (hintn_asserted()) {
         return;
     }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_BNO08X_INT_TIMEOUT_MS));
+#endif
 }
 
-static int i2chal_open(sh2_Hal_t *self) {
-    ESP_LOGD(TAG, "Opening SH2 I2C HAL");
-    uint8_t softreset_pkt[] = {5, 0, 1, 0, 1};
-
-    bool success = false;
-    esp_err_t ret;
-    for (uint8_t attempts = 0; attempts < 5; attempts++) {
-        if ((ret = i2c_write(BNO_ADDR, softreset_pkt, sizeof(softreset_pkt) / sizeof(uint8_t))) == ESP_OK) {
-            success = true;
+#if CONFIG_BNO08X_INT_DRIVEN
+// Wait up to timeout_us for H_INTN to be asserted, false if it wasn't
+static bool hintn_wait(uint32_t timeout_us)
+{
+    int64_t deadline = esp_timer_get_time() + timeout_us;
+    bool asserted;
+
+    // With the I/O task running the ISR would only wake it
+    _hintn_waiter = xTaskGetCurrentTaskHandle();
+    while (!(asserted = hintn_asserted())) {
+        int64_t now = esp_timer_get_time();
+        if (now >= deadline) {
             break;
-        } else {
-            ESP_LOGW(TAG, "Couldn't write soft reset (%s)", esp_err_to_name(ret));
         }
-        vTaskDelay(30 / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((deadline - now) / 1000) + 1);
     }
+    _hintn_waiter = NULL;
 
-    if (!success)
-        return -1;
+    return asserted;
+}
+#endif
 
-    vTaskDelay(300 / portTICK_PERIOD_MS);
-    return 0;
+#if CONFIG_BNO08X_TRANSPORT_SPI
+// ESP32 side of the SHTP SPI HAL (shtp_spi.c). CS is driven by hand so a
+// transfer can span several polling transactions: the header decides how
+// long the rest of it is.
+static bool spiport_waitInt(void *ctx, uint32_t timeout_us)
+{
+    return hintn_wait(timeout_us);
 }
 
-static void i2chal_close(sh2_Hal_t *self) {
-    ESP_LOGI(TAG, "SH2 HAL Closed CB");
+static uint32_t spiport_intTimeUs(void *ctx)
+{
+    return _hintn_time_us;
 }
 
-static int i2chal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us) {
-    uint8_t header[4];
-    esp_err_t ret; 
-    uint32_t retries = 0;
+static void spiport_setWake(void *ctx, bool asserted)
+{
+    gpio_set_level(CONFIG_BNO08X_SPI_WAKE_GPIO, asserted ? 0 : 1);
+}
 
-    while ((ret = i2c_read(BNO_ADDR, header, 4)) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to read SH2 header (%s)", esp_err_to_name(ret));
+static void spiport_setReset(void *ctx, bool asserted)
+{
+    gpio_set_level(RST_PIN, asserted ? 0 : 1);
+}
 
-        if (ret == ESP_ERR_INVALID_STATE) {
-            ESP_LOGI(TAG, "Re-initializing I2C... (%s)", esp_err_to_name(ret));
-            gpio_set_level(GPIO_NUM_22, 1);
-            gpio_set_level(GPIO_NUM_21, 1);
-            ret = i2c_master_init();
-            if (ret != ESP_OK) {
-                ESP_LOGE(TAG, "Couldn't reset I2C (%s)", esp_err_to_name(ret));
-                return 0;
-            } else {
-                if (retries > 5) {
-                    ESP_LOGE(TAG, "Couldn't read header after retrying");
-                    return 0;
-                }
-
-                ++retries;
-                continue;
-            }
+static int spiport_transfer(void *ctx, const uint8_t *tx, uint8_t *rx, unsigned len, bool keepCs)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (len > 0) {
+        if (!_spi_cs_active) {
+            spi_device_acquire_bus(spi_dev, portMAX_DELAY);
+            gpio_set_level(CONFIG_BNO08X_SPI_CS_GPIO, 0);
+            _spi_cs_active = true;
         }
 
-        return 0;
+        spi_transaction_t t = {
+            .length = len * 8,
+            .tx_buffer = (tx != NULL) ? tx : _spi_zeros,
+            .rx_buffer = rx,
+        };
+        if ((ret = spi_device_polling_transmit(spi_dev, &t)) != ESP_OK) {
+            ESP_LOGE(TAG, "SPI transfer failed (%s)", esp_err_to_name(ret));
+        }
     }
 
-    // Determine amount to read
-    uint16_t packet_size = (uint16_t)header[0] | (uint16_t)header[1] << 8;
-    // Unset the "continue" bit
-    packet_size &= ~0x8000;
+    if (!keepCs && _spi_cs_active) {
+        gpio_set_level(CONFIG_BNO08X_SPI_CS_GPIO, 1);
+        spi_device_release_bus(spi_dev);
+        _spi_cs_active = false;
+    }
+
+    return (ret == ESP_OK) ? 0 : -1;
+}
+
+static uint32_t spiport_getTimeUs(void *ctx)
+{
+    return esp_timer_get_time();
+}
+
+static void spiport_delayUs(void *ctx, uint32_t us)
+{
+    if (us >= 1000) {
+        vTaskDelay(pdMS_TO_TICKS(us / 1000) + 1);
+    } else {
+        esp_rom_delay_us(us);
+    }
+}
+
+static const shtp_spi_port_t _spi_port = {
+    .waitInt = spiport_waitInt,
+    .intTimeUs = spiport_intTimeUs,
+    .setWake = spiport_setWake,
+    .setReset = spiport_setReset,
+    .transfer = spiport_transfer,
+    .getTimeUs = spiport_getTimeUs,
+    .delayUs = spiport_delayUs,
+    .ctx = NULL,
+};
+
+static esp_err_t spi_master_init(void)
+{
+    esp_err_t ret;
+
+    gpio_config_t out_config = {
+        .pin_bit_mask = (1ULL << CONFIG_BNO08X_SPI_CS_GPIO) | (1ULL << CONFIG_BNO08X_SPI_WAKE_GPIO),
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .pull_up_en = GPIO_PULLUP_DISABLE
+    };
+    if ((ret = gpio_config(&out_config)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't configure CS/WAKE GPIO (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+    gpio_set_level(CONFIG_BNO08X_SPI_CS_GPIO, 1);
+    gpio_set_level(CONFIG_BNO08X_SPI_WAKE_GPIO, 1);
+
+    spi_bus_config_t bus_config = {
+        .mosi_io_num = CONFIG_BNO08X_SPI_MOSI_GPIO,
+        .miso_io_num = CONFIG_BNO08X_SPI_MISO_GPIO,
+        .sclk_io_num = CONFIG_BNO08X_SPI_SCLK_GPIO,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = SH2_HAL_MAX_TRANSFER_IN,
+    };
+    if ((ret = spi_bus_initialize(SPI3_HOST, &bus_config, SPI_DMA_CH_AUTO)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't initialize SPI bus (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    spi_device_interface_config_t dev_config = {
+        .clock_speed_hz = CONFIG_BNO08X_SPI_CLOCK_HZ,
+        .mode = 3, // CPOL = 1, CPHA = 1
+        .spics_io_num = -1, // Driven by spiport_transfer()
+        .queue_size = 1,
+    };
+    if ((ret = spi_bus_add_device(SPI3_HOST, &dev_config, &spi_dev)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't add SPI device (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "SPI initialized");
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_BNO08X_TRACE
+static void trace_sink(void *cookie, const uint8_t *data, unsigned len)
+{
+    FILE *f = (FILE *)cookie;
+
+    if (fwrite(data, 1, len, f) != len) {
+        ESP_LOGW(TAG, "Couldn't write SHTP trace");
+    }
+    fflush(f);
+}
+
+// Mount storage and start a new trace. The trace from the previous boot is
+// kept alongside, so the run that ended in a crash survives the reboot.
+static esp_err_t trace_init(void)
+{
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = "/spiffs",
+        .partition_label = "storage",
+        .max_files = 2,
+        .format_if_mount_failed = true
+    };
+
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Couldn't mount SPIFFS for trace (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    remove(CONFIG_BNO08X_TRACE_PATH ".1");
+    rename(CONFIG_BNO08X_TRACE_PATH, CONFIG_BNO08X_TRACE_PATH ".1");
+
+    if ((_trace_file = fopen(CONFIG_BNO08X_TRACE_PATH, "wb")) == NULL) {
+        ESP_LOGE(TAG, "Couldn't open %s", CONFIG_BNO08X_TRACE_PATH);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Tracing SHTP to %s", CONFIG_BNO08X_TRACE_PATH);
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_BNO08X_IO_TASK
+// The I/O task reads while the IMU task writes, so every call into the HAL
+// below goes through one lock
+static sh2_Hal_t _locked_hal;
+static sh2_Hal_t *_inner_hal = NULL;
+static SemaphoreHandle_t _hal_lock = NULL;
+
+static int lockedhal_open(sh2_Hal_t *self)
+{
+    xSemaphoreTake(_hal_lock, portMAX_DELAY);
+    int rc = _inner_hal->open(_inner_hal);
+    xSemaphoreGive(_hal_lock);
+    return rc;
+}
+
+static void lockedhal_close(sh2_Hal_t *self)
+{
+    xSemaphoreTake(_hal_lock, portMAX_DELAY);
+    _inner_hal->close(_inner_hal);
+    xSemaphoreGive(_hal_lock);
+}
+
+static int lockedhal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us)
+{
+    xSemaphoreTake(_hal_lock, portMAX_DELAY);
+    int rc = _inner_hal->read(_inner_hal, pBuffer, len, t_us);
+    xSemaphoreGive(_hal_lock);
+    return rc;
+}
+
+static int lockedhal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len)
+{
+    xSemaphoreTake(_hal_lock, portMAX_DELAY);
+    int rc = _inner_hal->write(_inner_hal, pBuffer, len);
+    xSemaphoreGive(_hal_lock);
+    return rc;
+}
+
+static uint32_t lockedhal_getTimeUs(sh2_Hal_t *self)
+{
+    return _inner_hal->getTimeUs(_inner_hal);
+}
+
+static sh2_Hal_t *lockedhal_wrap(sh2_Hal_t *inner)
+{
+    if (_hal_lock == NULL && (_hal_lock = xSemaphoreCreateMutex()) == NULL) {
+        return NULL;
+    }
+
+    _inner_hal = inner;
+    _locked_hal.open = lockedhal_open;
+    _locked_hal.close = lockedhal_close;
+    _locked_hal.read = lockedhal_read;
+    _locked_hal.write = lockedhal_write;
+    _locked_hal.getTimeUs = lockedhal_getTimeUs;
+
+    return &_locked_hal;
+}
+
+// Producer for the SHTP receive ring: read every transfer the hub has as
+// soon as H_INTN falls and wake the IMU task for each one
+static void bno_io_task(void *pvParameters)
+{
+    while (1) {
+        bno_waitForData();
+
+        int rc;
+        while ((rc = sh2_pump()) > 0) {
+            xTaskNotifyGive(_imu_task);
+        }
+
+        if (rc == SH2_ERR_OP_IN_PROGRESS) {
+            // Ring full, the IMU task is behind. The hub keeps H_INTN
+            // asserted and holds the data until there's room.
+            vTaskDelay(1);
+        }
+    }
+}
+#endif
+
+// Record when a boot phase finished, the first time only
+static void boot_mark(bno_boot_phase_t phase)
+{
+    if (_boot.at_us[phase] == 0) {
+        _boot.at_us[phase] = esp_timer_get_time();
+    }
+}
+
+static void boot_log(void)
+{
+    static const char *names[BNO_BOOT_PHASES] = {
+        "task start", "reset", "bus", "sh2 open", "product ids", "subscribed", "first sample",
+    };
+    uint32_t prev = 0;
+
+    for (int i = 0; i < BNO_BOOT_PHASES; i++) {
+        if (_boot.at_us[i] == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Boot: %-12s +%6" PRIu32 " us (at %" PRIu32 " ms)",
+                 names[i], _boot.at_us[i] - prev, _boot.at_us[i] / 1000);
+        prev = _boot.at_us[i];
+    }
+}
+
+void bno_get_boot_profile(bno_boot_profile_t *profile)
+{
+    *profile = _boot;
+}
+
+// The hub has just started, with only its saved DCD and tare to go on
+static void cal_restart(void)
+{
+    _cal_start_us = esp_timer_get_time();
+    _cal_stats.medium_us = 0;
+    _cal_stats.high_us = 0;
+}
+
+// Time how long the rotation vector takes to reach medium and high accuracy
+static void cal_track(const sh2_SensorValue_t *value)
+{
+    uint32_t since = esp_timer_get_time() - _cal_start_us;
+
+    _cal_stats.accuracy_rad = value->un.rotationVector.accuracy;
+    if (value->status >= 2 && _cal_stats.medium_us == 0) {
+        _cal_stats.medium_us = since;
+        ESP_LOGI(TAG, "Rotation vector at medium accuracy %" PRIu32 " ms after start (%.3f rad)",
+                 since / 1000, _cal_stats.accuracy_rad);
+    }
+    if (value->status >= 3 && _cal_stats.high_us == 0) {
+        _cal_stats.high_us = since;
+        ESP_LOGI(TAG, "Rotation vector at high accuracy %" PRIu32 " ms after start (%.3f rad)",
+                 since / 1000, _cal_stats.accuracy_rad);
+    }
+}
+
+void bno_get_cal_stats(bno_cal_stats_t *stats)
+{
+    *stats = _cal_stats;
+}
+
+esp_err_t bno_init()
+{
+    // int i2c_master_port = I2C_MASTER_NUM;
+
+    // i2c_config_t conf = {
+    //     .mode = I2C_MODE_MASTER,
+    //     .sda_io_num = 21,
+    //     .scl_io_num = 22,
+    //     .sda_pullup_en = 0,
+    //     .scl_pullup_en = 0,
+    //     .master.clk_speed = I2C_MASTER_FREQ_HZ,
+    // };
+
+    // i2c_param_config(i2c_master_port, &conf);
+
+    // i2c_driver_install(i2c_master_port, conf.mode, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
+
+    esp_err_t ret = gpio_config(&rst_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't configure RST GPIO! (%s)", esp_err_to_name(ret));
+    }
+
+    if (result_queue == NULL) {
+        result_queue = xQueueCreate(BNO_RESULT_QUEUE_LEN, sizeof(bno_quat_q14_t));
+    }
+    if (_op_mailbox == NULL) {
+        _op_mailbox = xQueueCreate(BNO_OP_MAILBOX_LEN, sizeof(bno_op_t));
+    }
+
+#if CONFIG_BNO08X_INT_DRIVEN
+    if ((ret = hintn_init()) != ESP_OK) {
+        return ret;
+    }
+#endif
+
+#if CONFIG_BNO08X_TRANSPORT_SPI
+    // The SPI HAL pulses reset itself when sh2 opens it
+    if ((ret = spi_master_init()) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to init SPI (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    boot_mark(BNO_BOOT_BUS);
+
+    sh2_Hal_t *pHal = shtp_spi_init(&_spi_hal, &_spi_port);
+#else
+    if ((ret = bno_reset()) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't reset IMU, continuing (%s)", esp_err_to_name(ret));
+    }
+    boot_mark(BNO_BOOT_RESET);
+
+#if CONFIG_BNO08X_I2C_ASYNC
+    if (_i2c_done == NULL && (_i2c_done = xSemaphoreCreateBinary()) == NULL) {
+        ESP_LOGE(TAG, "Couldn't create I2C semaphore");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+#if CONFIG_BNO08X_I2C_ADAPTIVE
+    while (_rate_count < BNO_I2C_RATES && i2c_rates[_rate_count] <= CONFIG_BNO08X_I2C_MAX_HZ) {
+        _rate_count++;
+    }
+#endif
+
+    if ((ret = i2c_master_init()) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to init I2C (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    boot_mark(BNO_BOOT_BUS);
+
+    _HAL.open = i2chal_open;
+    _HAL.close = i2chal_close;
+    _HAL.read = i2chal_read;
+    _HAL.write = i2chal_write;
+    _HAL.getTimeUs = hal_getTimeUs;
+
+    sh2_Hal_t *pHal = &_HAL;
+#endif
+
+#if CONFIG_BNO08X_TRACE
+    if (trace_init() == ESP_OK) {
+        pHal = shtp_trace_wrap(&_trace, pHal, trace_sink, _trace_file, CONFIG_BNO08X_TRACE_MAX_BYTES);
+    }
+#endif
+
+#if CONFIG_BNO08X_IO_TASK
+    if ((pHal = lockedhal_wrap(pHal)) == NULL) {
+        ESP_LOGE(TAG, "Couldn't create HAL lock");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    // Open SH2, if it fails then sh2 may already be open, so try closing then re-open
+    int status = sh2_open(pHal, hal_callback, NULL);
+    if (status != SH2_OK) {
+        ESP_LOGW(TAG, "Couldn't open sh2");
+        sh2_reinitialize();
+        // ESP_LOGI(TAG, "SH2 may already open, closing and reopening... (%d)", status);
+        // status = sh2_open(&_HAL, hal_callback, NULL);
+        // if (status != SH2_OK) {
+        //     ESP_LOGE(TAG, "Couldn't open sh2 (%d)", status);
+        //     return ESP_FAIL;
+        // }
+    }
+    boot_mark(BNO_BOOT_OPEN);
+    cal_restart();
+
+    memset(&prodIds, 0, sizeof(prodIds));
+    status = sh2_getProdIds(&prodIds);
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Couldn't get product ids (%d)", status);
+        // return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Part number: %lu", prodIds.entry[0].swPartNumber);
+    boot_mark(BNO_BOOT_PROD_IDS);
+#if CONFIG_BNO08X_FRS_CACHE
+    // Keyed by the hub firmware, so don't trust it without product ids
+    _cache_ready = (status == SH2_OK && frs_cache_open(&prodIds.entry[0]) == ESP_OK);
+    _cache_next = 0;
+#endif
+
+    // Each payload's reports are decoded straight out of the receive buffer
+    sh2_setSensorBatchCallback(sensorHandler, NULL);
+    
+    ESP_LOGI(TAG, "BNO Initialized");
+    _reset_occurred = false;
+    bno_subscribe(SH2_ROTATION_VECTOR, CONFIG_BNO08X_RV_INTERVAL_US, rv_consumer, NULL);
+    bno_subscribe(SH2_LINEAR_ACCELERATION, CONFIG_BNO08X_LINEAR_ACCEL_INTERVAL_US, NULL, NULL);
+    bno_subscribe(SH2_GYROSCOPE_CALIBRATED, CONFIG_BNO08X_GYRO_INTERVAL_US, NULL, NULL);
+    bno_subscribe(SH2_GRAVITY, CONFIG_BNO08X_GRAVITY_INTERVAL_US, NULL, NULL);
+    bno_subscribe(SH2_ACCELEROMETER, CONFIG_BNO08X_ACCEL_INTERVAL_US, NULL, NULL);
+#if CONFIG_BNO08X_GIRV
+    bno_subscribe(SH2_GYRO_INTEGRATED_RV, CONFIG_BNO08X_GIRV_INTERVAL_US, NULL, NULL);
+#endif
+    // A re-init follows a hub reset, so send every stream that's still wanted
+    bno_resubscribe_all();
+    bno_apply_subscriptions();
+    ESP_LOGI(TAG, "Reports enabled");
+    boot_mark(BNO_BOOT_SUBSCRIBED);
+
+#if CONFIG_BNO08X_IO_TASK
+    // From here on the I/O task reads and sh2_service() only decodes
+    if ((status = sh2_setRxRing(true)) != SH2_OK) {
+        ESP_LOGE(TAG, "Couldn't enable SHTP receive ring (%d)", status);
+        return ESP_FAIL;
+    }
+    if (xTaskCreatePinnedToCore(bno_io_task, "bno_io", 3072, NULL, uxTaskPriorityGet(NULL) + 1,
+                                &_io_task, CONFIG_BNO08X_IO_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Couldn't start BNO I/O task");
+        sh2_setRxRing(false);
+        return ESP_FAIL;
+    }
+#endif
+
+    return ESP_OK;
+}
+
+bool bno_getSensorEvent(sh2_SensorValue_t *value) 
+{
+    // Drain what the last payload left before reading another
+    if (_event_count == 0) {
+        sh2_service();
+        if (_event_count == 0) {
+            // no new events
+            return false;
+        }
+    }
+
+    *value = _events[_event_head];
+    _event_head = (_event_head + 1) % BNO_EVENT_FIFO_LEN;
+    _event_count--;
+
+    return true;
+}
+
+bool bno_enableReport(sh2_SensorId_t sensorId, uint32_t interval_us) 
+{
+    static sh2_SensorConfig_t config;
+
+    // These sensor options are disabled or not used in most cases
+    config.changeSensitivityEnabled = false;
+    config.wakeupEnabled = false;
+    config.changeSensitivityRelative = false;
+    config.alwaysOnEnabled = false;
+    config.changeSensitivity = 0;
+    config.batchInterval_us = _batch_interval_us;
+    config.sensorSpecific = 0;
+
+    config.reportInterval_us = interval_us;
+    
+    int status = sh2_setSensorConfig(sensorId, &config);
+
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Couldn't set sensor config (%d)", status);
+        return false;
+    }
+
+    return true;
+}
+
+esp_err_t bno_subscribe(sh2_SensorId_t sensor_id, uint32_t interval_us, bno_consumer_t *consumer, void *cookie)
+{
+    bno_subscription_t *free_slot = NULL;
+    bno_subscription_t *sub = NULL;
+
+    if (sensor_id == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&_subs_mux);
+    for (int i = 0; i < BNO_MAX_SUBSCRIPTIONS; i++) {
+        if (_subs[i].sensor_id == sensor_id) {
+            sub = &_subs[i];
+            break;
+        }
+        if (_subs[i].sensor_id == 0 && free_slot == NULL) {
+            free_slot = &_subs[i];
+        }
+    }
+    if (sub == NULL && interval_us != 0 && free_slot != NULL) {
+        sub = free_slot;
+        sub->sensor_id = sensor_id;
+        sub->have_latest = false;
+    }
+    if (sub != NULL) {
+        sub->interval_us = interval_us;
+        sub->consumer = consumer;
+        sub->cookie = cookie;
+        sub->pending = true;
+        _subs_pending = true;
+    }
+    taskEXIT_CRITICAL(&_subs_mux);
+
+    if (sub == NULL) {
+        if (interval_us == 0) {
+            // Nothing to unsubscribe from
+            return ESP_OK;
+        }
+        ESP_LOGE(TAG, "Couldn't subscribe to sensor %u, all %d slots in use", sensor_id, BNO_MAX_SUBSCRIPTIONS);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (_imu_task != NULL && xTaskGetCurrentTaskHandle() != _imu_task) {
+        // Don't leave it waiting for the next sensor interrupt
+        xTaskNotifyGive(_imu_task);
+    }
+    return ESP_OK;
+}
+
+bool bno_get_latest(sh2_SensorId_t sensor_id, sh2_SensorValue_t *value)
+{
+    bool found = false;
+
+    taskENTER_CRITICAL(&_subs_mux);
+    for (int i = 0; i < BNO_MAX_SUBSCRIPTIONS; i++) {
+        if (_subs[i].sensor_id == sensor_id && _subs[i].have_latest) {
+            *value = _subs[i].latest;
+            found = true;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&_subs_mux);
+
+    return found;
+}
+
+// Send every subscription to the hub again, after a reset or a change to the
+// batch interval
+static void bno_resubscribe_all(void)
+{
+    taskENTER_CRITICAL(&_subs_mux);
+    for (int i = 0; i < BNO_MAX_SUBSCRIPTIONS; i++) {
+        if (_subs[i].sensor_id != 0) {
+            _subs[i].pending = true;
+            _subs_pending = true;
+        }
+    }
+    taskEXIT_CRITICAL(&_subs_mux);
+}
+
+// Push changed subscriptions to the hub, IMU task only. Each config completes
+// once it's queued for transmit, so all of them go out back to back. A config
+// that doesn't fit in the transmit queue is retried on the next pass.
+static void bno_apply_subscriptions(void)
+{
+    if (!_subs_pending || _power == BNO_POWER_STANDBY || sh2_opStatus() == SH2_ERR_OP_IN_PROGRESS) {
+        return;
+    }
+    _subs_pending = false;
+
+    for (int i = 0; i < BNO_MAX_SUBSCRIPTIONS; i++) {
+        bno_subscription_t *sub = &_subs[i];
+
+        taskENTER_CRITICAL(&_subs_mux);
+        bool pending = sub->pending;
+        sh2_SensorId_t sensor_id = sub->sensor_id;
+        uint32_t interval_us = sub->interval_us;
+        sub->pending = false;
+        taskEXIT_CRITICAL(&_subs_mux);
+
+        if (!pending) {
+            continue;
+        }
+
+        if (!bno_enableReport(sensor_id, interval_us)) {
+            taskENTER_CRITICAL(&_subs_mux);
+            sub->pending = true;
+            _subs_pending = true;
+            taskEXIT_CRITICAL(&_subs_mux);
+            continue;
+        }
+#if CONFIG_BNO08X_FRS_CACHE
+        // Check the cache has its metadata
+        _cache_next = 0;
+#endif
+
+        taskENTER_CRITICAL(&_subs_mux);
+        if (!sub->pending && sub->interval_us == 0) {
+            // The hub has stopped the stream, free the slot
+            sub->sensor_id = 0;
+            sub->consumer = NULL;
+            sub->have_latest = false;
+        }
+        taskEXIT_CRITICAL(&_subs_mux);
+    }
+}
+
+// Hand a report to its sensor's consumer, IMU task only
+static void bno_dispatch(const sh2_SensorValue_t *value)
+{
+    bno_consumer_t *consumer = NULL;
+    void *cookie = NULL;
+    bool found = false;
+
+    taskENTER_CRITICAL(&_subs_mux);
+    for (int i = 0; i < BNO_MAX_SUBSCRIPTIONS; i++) {
+        if (_subs[i].sensor_id == value->sensorId) {
+            _subs[i].latest = *value;
+            _subs[i].have_latest = true;
+            consumer = _subs[i].consumer;
+            cookie = _subs[i].cookie;
+            found = true;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&_subs_mux);
+
+    if (!found) {
+        ESP_LOGW(TAG, "Unsubscribed sensor event: %u", value->sensorId);
+    } else if (consumer != NULL) {
+        consumer(value, cookie);
+    }
+}
+
+esp_err_t bno_start_recording() 
+{
+    recorder_state = true;
+    return ESP_OK;
+}
+
+esp_err_t bno_reset() 
+{
+    esp_err_t ret = gpio_set_level(RST_PIN, 0);
+    vTaskDelay(pdMS_TO_TICKS(1));
+    ret = gpio_set_level(RST_PIN, 1);
+#if CONFIG_BNO08X_FAST_BOOT
+    // H_INTN falls as soon as the hub has booted and queued its advertisement
+    _hub_booted = hintn_wait(BNO_BOOT_WAIT_US);
+    if (!_hub_booted) {
+        ESP_LOGW(TAG, "No H_INTN from the hub %d ms after reset", BNO_BOOT_WAIT_US / 1000);
+    }
+#else
+    vTaskDelay(pdMS_TO_TICKS(100));
+#endif
+    return ret;
+}
+
+esp_err_t bno_get_euler(euler_convention_t conv, euler_angles_t *ypr)
+{
+    sh2_SensorValue_t value;
+
+    if (!bno_get_latest(SH2_ROTATION_VECTOR, &value)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const sh2_RotationVectorWAcc_t *rv = &value.un.rotationVector;
+    q_to_euler(rv->real, rv->i, rv->j, rv->k, conv, ypr);
+    return ESP_OK;
+}
+
+QueueHandle_t bno_get_result_queue() {
+    return result_queue;
+}
+
+void bno_get_read_stats(bno_read_stats_t *stats)
+{
+    *stats = _read_stats;
+}
+
+void bno_get_perf_stats(bno_perf_stats_t *stats)
+{
+    *stats = _perf_stats;
+}
+
+// Account an sh2_service() call that delivered a report
+static void perf_record(int64_t start_us, uint64_t wait_start_us, const sh2_SensorValue_t *value)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t service = (uint32_t)(now - start_us);
+    // Report timestamps are in the HAL's 32-bit microsecond timebase
+    uint32_t latency = (uint32_t)now - (uint32_t)value->timestamp;
+
+    _perf_stats.reports++;
+    _perf_stats.service_us += service;
+    _perf_stats.bus_wait_us += _bus_wait_us - wait_start_us;
+    if (service > _perf_stats.service_max_us) {
+        _perf_stats.service_max_us = service;
+    }
+    _perf_stats.latency_us += latency;
+    if (latency > _perf_stats.latency_max_us) {
+        _perf_stats.latency_max_us = latency;
+    }
+}
+
+void bno_get_recovery_stats(bno_recovery_stats_t *stats)
+{
+    *stats = _recovery_stats;
+}
+
+void bno_get_i2c_rate_stats(bno_i2c_rate_stats_t *stats)
+{
+    *stats = _rate_stats;
+    stats->current_hz = i2c_rates[_rate_idx];
+    for (int i = 0; i < BNO_I2C_RATES; i++) {
+        stats->rate[i].hz = i2c_rates[i];
+    }
+}
+
+static esp_err_t bno_queue_op(const bno_op_t *op)
+{
+    if (_op_mailbox == NULL || _imu_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xQueueSend(_op_mailbox, op, pdMS_TO_TICKS(100)) != pdTRUE) {
+        ESP_LOGE(TAG, "Couldn't queue sh2 op because the mailbox is full");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Don't leave it waiting for the next sensor interrupt
+    xTaskNotifyGive(_imu_task);
+
+    return ESP_OK;
+}
+
+esp_err_t bno_submit_op(bno_op_start_t *start, void *arg, bno_op_done_t *done, void *cookie)
+{
+    bno_op_t op = {
+        .start = start,
+        .arg = arg,
+        .done = done,
+        .cookie = cookie,
+    };
+
+    return bno_queue_op(&op);
+}
+
+#if CONFIG_BNO08X_FRS_CACHE
+static void cache_fill_done(void *cookie, int status)
+{
+    _cache_busy = false;
+    if (status != SH2_OK) {
+        ESP_LOGW(TAG, "Couldn't read FRS for the cache (%d)", status);
+        return;
+    }
+
+    uint16_t record = (uint16_t)(uintptr_t)cookie;
+    if (record == 0) {
+        frs_cache_put_metadata(_cache_sensor_id, &_cache_meta);
+        ESP_LOGI(TAG, "Cached sensor %u metadata: Q%u, period %" PRIu32 "-%" PRIu32 " us",
+                 _cache_sensor_id, _cache_meta.qPoint1, _cache_meta.minPeriod_uS, _cache_meta.maxPeriod_uS);
+    } else {
+        frs_cache_put_frs(record, _cache_frs, _cache_frs_words);
+        ESP_LOGI(TAG, "Cached FRS record 0x%04X (%u words)", record, _cache_frs_words);
+    }
+}
+
+// Read the next entry missing from the cache, if sh2 is otherwise idle. On a
+// hub whose firmware was seen before everything is found in NVS.
+static void bno_fill_cache(void)
+{
+    if (!_cache_ready || _cache_busy || _subs_pending || _power == BNO_POWER_STANDBY ||
+        sh2_opStatus() == SH2_ERR_OP_IN_PROGRESS || uxQueueMessagesWaiting(_op_mailbox) > 0) {
+        return;
+    }
+
+    while (_cache_next < BNO_MAX_SUBSCRIPTIONS + BNO_CACHED_FRS) {
+        unsigned n = _cache_next++;
+        int status;
+
+        if (n < BNO_MAX_SUBSCRIPTIONS) {
+            _cache_sensor_id = _subs[n].sensor_id;
+            if (_cache_sensor_id == 0 ||
+                frs_cache_get_metadata(_cache_sensor_id, &_cache_meta) == ESP_OK) {
+                continue;
+            }
+            sh2_async(cache_fill_done, (void *)0);
+            status = sh2_getMetadata(_cache_sensor_id, &_cache_meta);
+            if (status == SH2_ERR_BAD_PARAM) {
+                // No metadata record for this sensor (gyro integrated RV,
+                // ARVR...), nothing to cache
+                continue;
+            }
+        } else {
+            uint16_t record = _cached_frs[n - BNO_MAX_SUBSCRIPTIONS];
+            _cache_frs_words = FRS_CACHE_MAX_WORDS;
+            if (frs_cache_get_frs(record, _cache_frs, &_cache_frs_words) == ESP_OK) {
+                continue;
+            }
+            _cache_frs_words = FRS_CACHE_MAX_WORDS;
+            sh2_async(cache_fill_done, (void *)(uintptr_t)record);
+            status = sh2_getFrs(record, _cache_frs, &_cache_frs_words);
+        }
+
+        // Never started, so sh2 won't call back. Left out until the next scan.
+        _cache_busy = (status == SH2_OK);
+        return;
+    }
+}
+#endif
+
+#if CONFIG_BNO08X_SAVE_DCD_ON_STANDBY
+static void dcd_saved(void *cookie, int status)
+{
+    if (status == SH2_OK) {
+        _cal_stats.dcd_saves++;
+        ESP_LOGI(TAG, "Saved dynamic calibration");
+    } else {
+        ESP_LOGW(TAG, "Couldn't save dynamic calibration (%d)", status);
+    }
+}
+#endif
+
+// Put the hub to sleep or wake it as asked. Sleep and on aren't sh2
+// operations: they're queued for transmit and the hub doesn't answer.
+static void bno_apply_power(void)
+{
+    bno_power_t req = _power_req;
+
+    if (req == _power || sh2_opStatus() == SH2_ERR_OP_IN_PROGRESS) {
+        return;
+    }
+
+#if CONFIG_BNO08X_SAVE_DCD_ON_STANDBY
+    if (req == BNO_POWER_STANDBY && _save_dcd) {
+        // Clean shutdown: keep what dynamic calibration learned this run.
+        // Sleep on the first pass after the hub has answered.
+        _save_dcd = false;
+        sh2_async(dcd_saved, NULL);
+        if (sh2_saveDcdNow() == SH2_OK) {
+            return;
+        }
+    }
+#endif
+
+    int status = (req == BNO_POWER_STANDBY) ? sh2_devSleep() : sh2_devOn();
+    if (status != SH2_OK) {
+        // Tried again on the next pass
+        ESP_LOGE(TAG, "Couldn't %s the hub (%d)", (req == BNO_POWER_STANDBY) ? "put to sleep" : "wake", status);
+        return;
+    }
+
+    _power = req;
+    if (req == BNO_POWER_ON) {
+        _resume_start_us = esp_timer_get_time();
+        ESP_LOGI(TAG, "Hub resumed");
+    } else {
+        _resume_start_us = 0;
+        ESP_LOGI(TAG, "Hub in standby");
+    }
+}
+
+// Start the next op in the mailbox once the previous one has finished. It
+// completes from sh2_service() while reports keep flowing.
+static void bno_run_ops(void)
+{
+    bno_op_t op;
+
+    if (sh2_opStatus() == SH2_ERR_OP_IN_PROGRESS) {
+        return;
+    }
+    if (xQueueReceive(_op_mailbox, &op, 0) != pdTRUE) {
+        return;
+    }
+
+    if (op.local) {
+        // Nothing goes to the hub, so there's no op for sh2 to finish
+        int status = op.start(op.arg);
+        if (op.done != NULL) {
+            op.done(op.cookie, status);
+        }
+        return;
+    }
+
+    sh2_async(op.done, op.cookie);
+    int status = op.start(op.arg);
+    if (status != SH2_OK && op.done != NULL) {
+        // Never started, so sh2 won't call back
+        op.done(op.cookie, status);
+    }
+}
+
+// Rotation vectors: queued as Q14 quaternions for the SPP server
+static void rv_consumer(const sh2_SensorValue_t *value, void *cookie)
+{
+    static uint32_t count = 0;
+    bno_quat_q14_t quat_result;
+
+    cal_track(value);
+
+    const sh2_QuatQ14_t *q14 = &value->un.rotationVector.q14;
+    quat_result.w = q14->real;
+    quat_result.x = q14->i;
+    quat_result.y = q14->j;
+    quat_result.z = q14->k;
+    BaseType_t rtos_ret;
+
+    // Queue quaternion
+    if ((rtos_ret = xQueueSend(result_queue, &quat_result, 0)) == errQUEUE_FULL) {
+        // If queue is full, then pop the last measurement
+        bno_quat_q14_t temp;
+        xQueueReceive(result_queue, &temp, 0);
+        xQueueSend(result_queue, &quat_result, 0);
+    } else if (rtos_ret != pdTRUE) {
+        ESP_LOGE(TAG, "Couldn't queue quat result");
+    }
+
+    if (count++ % 300 == 0) {
+        // Only worked out for the samples that are logged
+        const sh2_RotationVectorWAcc_t *rv = &value->un.rotationVector;
+        euler_angles_t ypr;
+        q_to_euler(rv->real, rv->i, rv->j, rv->k, EULER_ZYX, &ypr);
+        ESP_LOGI(TAG, "yaw = %.1f, pitch = %.1f, roll = %.1f",
+                 ypr.yaw * RAD_TO_DEG, ypr.pitch * RAD_TO_DEG, ypr.roll * RAD_TO_DEG);
+#if CONFIG_BNO08X_TRANSPORT_I2C
+        ESP_LOGD(TAG, "I2C wire/payload bytes: %" PRIu32 "/%" PRIu32 " (%" PRIu32 " transactions, %" PRIu32 " transfers) at %" PRIu32 " Hz",
+            _read_stats.wire_bytes, _read_stats.payload_bytes, _read_stats.transactions, _read_stats.transfers,
+            i2c_rates[_rate_idx]);
+#endif
+        ESP_LOGD(TAG, "Per report: %" PRIu32 " us in sh2_service (%" PRIu32 " us on the bus), latency %" PRIu32 " us mean, %" PRIu32 " us max",
+            (uint32_t)(_perf_stats.service_us / _perf_stats.reports),
+            (uint32_t)(_perf_stats.bus_wait_us / _perf_stats.reports),
+            (uint32_t)(_perf_stats.latency_us / _perf_stats.reports), _perf_stats.latency_max_us);
+        sh2_ClockModel_t clock;
+        if (sh2_getClockModel(SH2_ROTATION_VECTOR, &clock) == SH2_OK) {
+            ESP_LOGD(TAG, "Hub sample clock: period %" PRIu32 " ns, drift %" PRId32 " ppm, residual max %" PRIu32 " us, %" PRIu32 " resyncs",
+                clock.period_ns, clock.drift_ppm, clock.residualMax_us, clock.resyncs);
+        }
+    }
+}
+
+void bno_task(void *pvParameters)
+{
+    esp_log_level_set(TAG, ESP_LOG_DEBUG);
+
+    boot_mark(BNO_BOOT_TASK_START);
+
+    // Must be set before the ISR is armed in bno_init()
+    _imu_task = xTaskGetCurrentTaskHandle();
+    ESP_ERROR_CHECK(bno_init());
+
+    sh2_SensorValue_t value;
+    uint64_t eit = 0, it = 2;
+    esp_err_t ret;
+    
+    while (1) {
+        bno_run_ops();
+        bno_apply_power();
+        bno_apply_subscriptions();
+#if CONFIG_BNO08X_FRS_CACHE
+        bno_fill_cache();
+#endif
+
+        int64_t service_start = esp_timer_get_time();
+        uint64_t wait_start = _bus_wait_us;
+
+        if (bno_getSensorEvent(&value)) {
+            perf_record(service_start, wait_start, &value);
+            if (_boot.at_us[BNO_BOOT_FIRST_SAMPLE] == 0) {
+                boot_mark(BNO_BOOT_FIRST_SAMPLE);
+                boot_log();
+            }
+            if (_resume_start_us != 0 && value.status >= 2) {
+                // Medium accuracy or better: fusion picked up where it left off
+                _perf_stats.resume_us = esp_timer_get_time() - _resume_start_us;
+                _resume_start_us = 0;
+                ESP_LOGI(TAG, "First accurate report %" PRIu32 " us after resume", _perf_stats.resume_us);
+            }
+
+            if (it++ % 900 == 0) {
+                UBaseType_t stack_size = uxTaskGetStackHighWaterMark(NULL);
+                ESP_LOGD(TAG, "Stack size: %lu", stack_size * sizeof(configSTACK_DEPTH_TYPE));
+            }
+
+            bno_dispatch(&value);
+            eit = 1;
+        } else if (_power == BNO_POWER_STANDBY && _power_req == BNO_POWER_STANDBY &&
+                   !_subs_pending && !hintn_asserted() &&
+                   sh2_opStatus() != SH2_ERR_OP_IN_PROGRESS) {
+            // Nothing to do until the hub or another task wants something.
+            // An op in flight keeps the loop in sh2_service() so it can time out.
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        } else {
+#if CONFIG_BNO08X_IO_TASK
+            // One notification per transfer the I/O task queued. Only take
+            // one so a transfer without a report doesn't hide the next.
+            ulTaskNotifyTake(pdFALSE, pdMS_TO_TICKS(CONFIG_BNO08X_INT_TIMEOUT_MS));
+#else
+            bno_waitForData();
+#endif
+
+            if (eit++ >= 1000) { 
+                // ESP_LOGW(TAG, "No sensor events, restarting");
+                // if ((ret = bno_reset()) != ESP_OK) {
+                //     ESP_LOGE(TAG, "Couldn't reset bno (%s)", esp_err_to_name(ret));
+                // } else {
+                //     if ((ret = bno_init()) != ESP_OK) {
+                //         ESP_LOGE(TAG, "Couldn't re-initialize bno (%s)", esp_err_to_name(ret));
+                //     } else {
+                //         eit = 0;
+                //     }
+                // }
+            }
+        }
+    
+        if (_reset_occurred) {
+            // The hub came back from a reset without our sensor configs, and
+            // awake
+            _reset_occurred = false;
+            _power = BNO_POWER_ON;
+            cal_restart();
+            bno_resubscribe_all();
+        }
+
+        if (recorder_state) {
+
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+typedef struct {
+    SemaphoreHandle_t done;
+    int status;
+} bno_op_wait_t;
+
+static void op_wait_done(void *cookie, int status)
+{
+    bno_op_wait_t *wait = (bno_op_wait_t *)cookie;
+
+    wait->status = status;
+    xSemaphoreGive(wait->done);
+}
+
+// Run start on the IMU task and wait for its final status
+static esp_err_t bno_run_sync(bno_op_start_t *start, void *arg, bool local, int *status)
+{
+    if (xTaskGetCurrentTaskHandle() == _imu_task) {
+        // Already the task that owns sh2
+        *status = start(arg);
+        return ESP_OK;
+    }
+
+    bno_op_wait_t wait = {
+        .done = xSemaphoreCreateBinary(),
+    };
+    if (wait.done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    bno_op_t op = {
+        .start = start,
+        .arg = arg,
+        .done = op_wait_done,
+        .cookie = &wait,
+        .local = local,
+    };
+    esp_err_t ret = bno_queue_op(&op);
+    if (ret != ESP_OK) {
+        vSemaphoreDelete(wait.done);
+        return ret;
+    }
+
+    // The IMU task calls back on completion, failure to start or hub reset,
+    // and sh2 times out a lost response after SH2_OP_TIMEOUT_US. The wait
+    // can't be cut short: the callback writes to this frame.
+    xSemaphoreTake(wait.done, portMAX_DELAY);
+    vSemaphoreDelete(wait.done);
+    *status = wait.status;
+
+    return ESP_OK;
+}
+
+// Run an sh2 operation on the IMU task and wait for its final status
+static esp_err_t bno_run_op_sync(bno_op_start_t *start, void *arg, int *status)
+{
+    return bno_run_sync(start, arg, false, status);
+}
 
-    /*
-    Serial.print("Read SHTP header. ");
-    Serial.print("Packet size: ");
-    Serial.print(packet_size);
-    Serial.print(" & buffer size: ");
-    Serial.println(len);
-    */
+// Snapshot of the driver counters, taken on the IMU task while it isn't
+// in the middle of a transfer
+static int metrics_start(void *arg)
+{
+    bno_metrics_t *metrics = (bno_metrics_t *)arg;
+    int64_t now = esp_timer_get_time();
 
-    size_t i2c_buffer_max = I2C_MAX_BUF_LEN;
+    int status = sh2_getMetrics(&metrics->hub);
+    if (status != SH2_OK) {
+        return status;
+    }
+
+    metrics->interval_us = (_metrics_prev_us != 0) ? (uint32_t)(now - _metrics_prev_us) : 0;
+    for (int i = 0; i < SHTP_MAX_CHANS; i++) {
+        const shtp_ChanMetrics_t *chan = &metrics->hub.shtp.chan[i];
+
+        if (metrics->interval_us != 0) {
+            metrics->rx_rate[i].bytes_ps = (uint32_t)((uint64_t)(chan->rxBytes - _metrics_prev[i].rxBytes) *
+                                                      1000000 / metrics->interval_us);
+            metrics->rx_rate[i].payloads_ps = (uint32_t)((uint64_t)(chan->rxPayloads - _metrics_prev[i].rxPayloads) *
+                                                         1000000 / metrics->interval_us);
+        } else {
+            metrics->rx_rate[i].bytes_ps = 0;
+            metrics->rx_rate[i].payloads_ps = 0;
+        }
+        _metrics_prev[i] = *chan;
+    }
+    _metrics_prev_us = now;
+
+    return SH2_OK;
+}
+
+esp_err_t bno_get_metrics(bno_metrics_t *metrics)
+{
+    int status;
+    esp_err_t ret = bno_run_sync(metrics_start, metrics, true, &status);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return (status == SH2_OK) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+static int tare_xy_start(void *arg)
+{
+    return sh2_setTareNow(SH2_TARE_X | SH2_TARE_Y, SH2_TARE_BASIS_ROTATION_VECTOR);
+}
+
+#if CONFIG_BNO08X_PERSIST_TARE
+static int persist_tare_start(void *arg)
+{
+    return sh2_persistTare();
+}
+#endif
+
+esp_err_t bno_tareXY() 
+{
+    int status;
+    esp_err_t ret = bno_run_op_sync(tare_xy_start, NULL, &status);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Failed to set tare: %d", status);
+        return ESP_FAIL;
+    }
+
+#if CONFIG_BNO08X_PERSIST_TARE
+    // The hub applies a persisted tare itself from the next boot on
+    if ((ret = bno_run_op_sync(persist_tare_start, NULL, &status)) != ESP_OK) {
+        return ret;
+    }
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Failed to persist tare: %d", status);
+        return ESP_FAIL;
+    }
+    _cal_stats.tare_persists++;
+#endif
+    return ESP_OK;
+}
+
+static int save_dcd_start(void *arg)
+{
+    return sh2_saveDcdNow();
+}
+
+esp_err_t bno_save_calibration()
+{
+    int status;
+    esp_err_t ret = bno_run_op_sync(save_dcd_start, NULL, &status);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Failed to save dynamic calibration: %d", status);
+        return ESP_FAIL;
+    }
+    _cal_stats.dcd_saves++;
+    return ESP_OK;
+}
+
+static int flush_start(void *arg)
+{
+    return sh2_flush(SH2_ROTATION_VECTOR);
+}
+
+esp_err_t bno_flush()
+{
+    int status;
+    esp_err_t ret = bno_run_op_sync(flush_start, NULL, &status);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Failed to flush hub FIFO: %d", status);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t bno_set_batching(uint32_t batch_interval_us)
+{
+    // Also used when the hub comes back from a reset
+    _batch_interval_us = batch_interval_us;
+    bno_resubscribe_all();
+
+    if (_imu_task != NULL && xTaskGetCurrentTaskHandle() != _imu_task) {
+        xTaskNotifyGive(_imu_task);
+    }
+    ESP_LOGI(TAG, "Hub batch interval %" PRIu32 " us", batch_interval_us);
+    return ESP_OK;
+}
+
+static void bno_request_power(bno_power_t power)
+{
+    _power_req = power;
+    if (_imu_task != NULL && xTaskGetCurrentTaskHandle() != _imu_task) {
+        xTaskNotifyGive(_imu_task);
+    }
+}
+
+esp_err_t bno_standby()
+{
+    if (_imu_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if CONFIG_BNO08X_SAVE_DCD_ON_STANDBY
+    if (_power_req != BNO_POWER_STANDBY) {
+        _save_dcd = true;
+    }
+#endif
+    bno_request_power(BNO_POWER_STANDBY);
+    return ESP_OK;
+}
+
+esp_err_t bno_resume()
+{
+    if (_imu_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bno_request_power(BNO_POWER_ON);
+    return ESP_OK;
+}
+
+typedef struct {
+    sh2_SensorId_t sensor_id;
+    sh2_SensorMetadata_t *meta;
+} bno_metadata_req_t;
+
+static int metadata_start(void *arg)
+{
+    bno_metadata_req_t *req = (bno_metadata_req_t *)arg;
+
+    return sh2_getMetadata(req->sensor_id, req->meta);
+}
+
+esp_err_t bno_get_metadata(sh2_SensorId_t sensor_id, sh2_SensorMetadata_t *meta)
+{
+    bno_metadata_req_t req = {
+        .sensor_id = sensor_id,
+        .meta = meta,
+    };
+    int status;
+
+#if CONFIG_BNO08X_FRS_CACHE
+    if (frs_cache_get_metadata(sensor_id, meta) == ESP_OK) {
+        return ESP_OK;
+    }
+#endif
+
+    esp_err_t ret = bno_run_op_sync(metadata_start, &req, &status);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Couldn't read sensor %u metadata: %d", sensor_id, status);
+        return ESP_FAIL;
+    }
+#if CONFIG_BNO08X_FRS_CACHE
+    frs_cache_put_metadata(sensor_id, meta);
+#endif
+    return ESP_OK;
+}
+
+typedef struct {
+    uint16_t record_id;
+    uint32_t *data;
+    uint16_t *words;
+} bno_frs_req_t;
+
+static int frs_start(void *arg)
+{
+    bno_frs_req_t *req = (bno_frs_req_t *)arg;
+
+    return sh2_getFrs(req->record_id, req->data, req->words);
+}
+
+esp_err_t bno_get_frs(uint16_t record_id, uint32_t *data, uint16_t *words)
+{
+    bno_frs_req_t req = {
+        .record_id = record_id,
+        .data = data,
+        .words = words,
+    };
+    int status;
+
+#if CONFIG_BNO08X_FRS_CACHE
+    uint16_t cached = *words;
+    if (frs_cache_get_frs(record_id, data, &cached) == ESP_OK) {
+        *words = cached;
+        return ESP_OK;
+    }
+#endif
+
+    esp_err_t ret = bno_run_op_sync(frs_start, &req, &status);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (status != SH2_OK) {
+        ESP_LOGE(TAG, "Couldn't read FRS record 0x%04X: %d", record_id, status);
+        return ESP_FAIL;
+    }
+#if CONFIG_BNO08X_FRS_CACHE
+    frs_cache_put_frs(record_id, data, *words);
+#endif
+    return ESP_OK;
+}
+
+#if CONFIG_BNO08X_TRANSPORT_I2C
+static uint32_t hal_getTimeUs(sh2_Hal_t *self) {
+    return esp_timer_get_time();
+}
+#endif
+
+static void hal_callback(void *cookie, sh2_AsyncEvent_t *pEvent) 
+{
+    // If we see a reset, set a flag so that sensors will be reconfigured.
+    if (pEvent->eventId == SH2_RESET) {
+        ESP_LOGW(TAG, "SH2 reset occured");
+        _reset_occurred = true;
+    }
+}
+
+#if CONFIG_BNO08X_GIRV
+// Decode gyro integrated RVs straight into their ring. A full ring keeps the
+// samples the reader hasn't taken yet and drops the new ones.
+static void girv_push(const sh2_SensorEventRef_t *events, uint16_t count)
+{
+    unsigned head = atomic_load_explicit(&_girv_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&_girv_tail, memory_order_acquire);
+    sh2_SensorValue_t value;
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (head - tail >= CONFIG_BNO08X_GIRV_RING_SLOTS) {
+            _perf_stats.girv_dropped += count - i;
+            break;
+        }
+        if (sh2_decodeSensorEventRef(&value, &events[i]) != SH2_OK) {
+            continue;
+        }
+        bno_girv_sample_t *sample = &_girv_ring[head & (CONFIG_BNO08X_GIRV_RING_SLOTS - 1)];
+        sample->timestamp_us = value.timestamp;
+        sample->rv = value.un.gyroIntegratedRV;
+        head++;
+        _perf_stats.girv_reports++;
+    }
+    atomic_store_explicit(&_girv_head, head, memory_order_release);
+
+    TaskHandle_t reader = _girv_reader;
+    if (reader != NULL) {
+        xTaskNotifyGive(reader);
+    }
+}
+#endif
+
+uint16_t bno_girv_read(bno_girv_sample_t *samples, uint16_t max)
+{
+    uint16_t n = 0;
+
+#if CONFIG_BNO08X_GIRV
+    unsigned tail = atomic_load_explicit(&_girv_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&_girv_head, memory_order_acquire);
+
+    while (n < max && tail != head) {
+        samples[n++] = _girv_ring[tail & (CONFIG_BNO08X_GIRV_RING_SLOTS - 1)];
+        tail++;
+    }
+    atomic_store_explicit(&_girv_tail, tail, memory_order_release);
+#endif
+
+    return n;
+}
 
-    if (packet_size > len) {
-        // packet wouldn't fit in our buffer
+void bno_girv_set_reader(TaskHandle_t task)
+{
+#if CONFIG_BNO08X_GIRV
+    _girv_reader = task;
+#endif
+}
+
+static void sensorHandler(void *cookie, const sh2_SensorEventRef_t *events, uint16_t count) 
+{
+#if CONFIG_BNO08X_GIRV
+    // Gyro integrated RVs come on their own channel, one payload per batch,
+    // and skip the event FIFO so the other streams can't push them out
+    if (count > 0 && events[0].reportId == SH2_GYRO_INTEGRATED_RV) {
+        girv_push(events, count);
+        return;
+    }
+#endif
+
+    while (count > 0) {
+        // Decode into the free run up to the end of the FIFO
+        uint16_t tail = (_event_head + _event_count) % BNO_EVENT_FIFO_LEN;
+        uint16_t n = BNO_EVENT_FIFO_LEN - tail;
+        if (n > count) {
+            n = count;
+        }
+
+        int decoded = sh2_decodeSensorBatch(&_events[tail], events, n);
+        if (decoded < n) {
+            ESP_LOGE(TAG, "Couldn't decode %d of %u sensor events", n - decoded, n);
+        }
+        events += n;
+        count -= n;
+
+        // A full FIFO keeps the newest reports
+        _event_count += decoded;
+        if (_event_count > BNO_EVENT_FIFO_LEN) {
+            uint16_t lost = _event_count - BNO_EVENT_FIFO_LEN;
+            _event_head = (_event_head + lost) % BNO_EVENT_FIFO_LEN;
+            _event_count = BNO_EVENT_FIFO_LEN;
+            _perf_stats.events_dropped += lost;
+        }
+    }
+}
+
+#if CONFIG_BNO08X_TRANSPORT_I2C
+static int i2chal_open(sh2_Hal_t *self) {
+    ESP_LOGD(TAG, "Opening SH2 I2C HAL");
+    uint8_t softreset_pkt[] = {5, 0, 1, 0, 1};
+
+#if CONFIG_BNO08X_FAST_BOOT
+    if (_hub_booted) {
+        // Just out of RSTN with its advertisement waiting. A soft reset would
+        // only make it boot again.
+        _hub_booted = false;
         return 0;
     }
-    // the number of non-header bytes to read
-    uint16_t cargo_remaining = packet_size;
-    uint8_t i2c_buffer[i2c_buffer_max];
-    uint16_t read_size;
-    uint16_t cargo_read_amount = 0;
-    bool first_read = true;
-    
-    while (cargo_remaining > 0) {
-        if (first_read) {
-            read_size = min(i2c_buffer_max, (size_t)cargo_remaining);
+#endif
+
+    bool success = false;
+    esp_err_t ret;
+    for (uint8_t attempts = 0; attempts < 5; attempts++) {
+        if ((ret = i2c_write(BNO_ADDR, softreset_pkt, sizeof(softreset_pkt) / sizeof(uint8_t))) == ESP_OK) {
+            success = true;
+            break;
         } else {
-            read_size = min(i2c_buffer_max, (size_t)cargo_remaining + 4);
+            ESP_LOGW(TAG, "Couldn't write soft reset (%s)", esp_err_to_name(ret));
         }
+        vTaskDelay(30 / portTICK_PERIOD_MS);
+    }
+
+    if (!success)
+        return -1;
+
+#if CONFIG_BNO08X_FAST_BOOT
+    // H_INTN is released while the hub reboots, then falls with the
+    // advertisement
+    int64_t released = esp_timer_get_time() + BNO_SOFT_RESET_US;
+    while (hintn_asserted() && esp_timer_get_time() < released) {
+        vTaskDelay(1);
+    }
+    if (!hintn_wait(BNO_BOOT_WAIT_US)) {
+        ESP_LOGW(TAG, "No H_INTN from the hub after soft reset");
+    }
+#else
+    vTaskDelay(300 / portTICK_PERIOD_MS);
+#endif
+    return 0;
+}
+
+static void i2chal_close(sh2_Hal_t *self) {
+    ESP_LOGI(TAG, "SH2 HAL Closed CB");
+}
+
+#if CONFIG_BNO08X_I2C_ASYNC
+// Queue a speculative read of the next transfer if the hub already has one,
+// so the bus brings it in while sh2 decodes the one just returned
+static void i2c_prefetch_start(void)
+{
+    if (_prefetch_len != 0 || !hintn_asserted()) {
+        return;
+    }
+
+    _prefetch_len = _first_read_len;
+    _prefetch_t_us = _hintn_time_us;
+    i2c_async_arm();
+    if (i2c_master_receive(dev_handle, _prefetch_buf, _prefetch_len, I2C_TIMEOUT_MS) != ESP_OK) {
+        _prefetch_len = 0;
+        return;
+    }
+    _prefetch_busy = true;
+}
+#endif
+
+// First read of a transfer: the header and as much cargo as the last transfer
+// carried. Returns the bytes read, 0 if there was nothing to read.
+static uint16_t i2chal_read_first(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us)
+{
+    esp_err_t ret;
+
+#if CONFIG_BNO08X_I2C_ASYNC
+    i2c_prefetch_finish();
+    if (_prefetch_len != 0) {
+        // Read while sh2 was busy with the previous transfer
+        uint16_t got = min(_prefetch_len, (uint16_t)len);
+        memcpy(pBuffer, _prefetch_buf, got);
+        *t_us = _prefetch_t_us;
+        _prefetch_len = 0;
+        _perf_stats.prefetch_hits++;
+        return got;
+    }
+#endif
+
+#if CONFIG_BNO08X_INT_DRIVEN
+    // Nothing to read until the hub asserts H_INTN
+    if (!hintn_asserted()) {
+        return 0;
+    }
+    // Host reference time for this transfer is when the interrupt fired
+    *t_us = _hintn_time_us;
+#else
+    *t_us = hal_getTimeUs(self);
+#endif
+
+    // Speculatively read the header and as much cargo as the last transfer
+    // carried in a single transaction, straight into the caller's buffer. The
+    // hub repeats the header at the start of every read, so anything we don't
+    // get here arrives as a continuation below.
+    uint16_t read_size = min((unsigned)_first_read_len, len);
+    if (read_size < 4) {
+        return 0;
+    }
+
+    // i2c_read() has already been through recovery if this fails
+    if ((ret = i2c_read(BNO_ADDR, pBuffer, read_size)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read SH2 header (%s)", esp_err_to_name(ret));
+        return 0;
+    }
+
+    return read_size;
+}
+
+static int i2chal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us) {
+    esp_err_t ret; 
+
+    uint16_t read_size = i2chal_read_first(self, pBuffer, len, t_us);
+    if (read_size == 0) {
+        return 0;
+    }
+    _read_stats.transactions++;
+    _read_stats.wire_bytes += read_size;
+    _read_stats.header_bytes += 4;
+
+    // Determine amount to read
+    uint16_t packet_size = (uint16_t)pBuffer[0] | (uint16_t)pBuffer[1] << 8;
+    // Unset the "continue" bit
+    packet_size &= ~0x8000;
+
+    if (packet_size > len || (packet_size != 0 && packet_size < 4)) {
+        // packet wouldn't fit in our buffer, or the header is junk
+        i2c_rate_corrupt();
+        return 0;
+    }
+
+    if (packet_size == 0) {
+        // Nothing pending, keep the next speculative read as short as possible
+        _first_read_len = 4;
+        return 0;
+    }
+
+    // Size the next speculative read for a transfer like this one
+    _first_read_len = min(packet_size, I2C_MAX_BUF_LEN);
+
+    if (packet_size <= read_size) {
+        _read_stats.overread_bytes += read_size - packet_size;
+    } else {
+        _read_stats.split_transfers++;
+    }
+
+    // Every continuation read starts with a fresh 4-byte header. Read it into
+    // the 4 bytes just before the next cargo offset, after saving the cargo
+    // already there, so the cargo lands in place with no bounce buffer.
+    uint16_t offset = read_size;
+    uint8_t saved[4];
 
-        // Serial.print("Reading from I2C: "); Serial.println(read_size);
-        // Serial.print("Remaining to read: "); Serial.println(cargo_remaining);
+    while (offset < packet_size) {
+        read_size = min((uint16_t)(packet_size - offset + 4), I2C_MAX_BUF_LEN);
+        uint8_t *dst = pBuffer + offset - 4;
 
-        // Try to read header. If I2C is an a invalid state then try to restart it and continue
-        if ((ret = i2c_read(BNO_ADDR, i2c_buffer, read_size)) != ESP_OK) {
+        memcpy(saved, dst, 4);
+        ret = i2c_read(BNO_ADDR, dst, read_size);
+        bool cont = (dst[1] & 0x80) != 0;
+        memcpy(dst, saved, 4);
+
+        if (ret != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read SH2 packet (%s)", esp_err_to_name(ret));
             return 0;
         }
-
-        if (first_read) {
-            // The first time we're saving the "original" header, so include it in the
-            // cargo count
-            cargo_read_amount = read_size;
-            memcpy(pBuffer, i2c_buffer, cargo_read_amount);
-            first_read = false;
-        } else {
-            // this is not the first read, so copy from 4 bytes after the beginning of
-            // the i2c buffer to skip the header included with every new i2c read and
-            // don't include the header in the amount of cargo read
-            cargo_read_amount = read_size - 4;
-            memcpy(pBuffer, i2c_buffer + 4, cargo_read_amount);
+        if (!cont) {
+            // A continuation always has the continue bit set
+            ESP_LOGW(TAG, "Lost SH2 continuation");
+            i2c_rate_corrupt();
+            return 0;
         }
-        // advance our pointer by the amount of cargo read
-        pBuffer += cargo_read_amount;
-        // mark the cargo as received
-        cargo_remaining -= cargo_read_amount;
-    }
+        _read_stats.transactions++;
+        _read_stats.wire_bytes += read_size;
+        _read_stats.header_bytes += 4;
 
-    /*
-    for (int i=0; i<packet_size; i++) {
-    Serial.print(pBufferOrig[i], HEX);
-    Serial.print(", ");
-    if (i % 16 == 15) Serial.println();
+        offset += read_size - 4;
     }
-    Serial.println();
-    */
+
+    _read_stats.transfers++;
+    _read_stats.payload_bytes += packet_size;
+
+#if CONFIG_BNO08X_I2C_ASYNC
+    i2c_prefetch_start();
+#endif
 
     return packet_size;
 }
@@ -574,11 +2485,14 @@ static int i2chal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len) {
     esp_err_t ret;
     if ((ret = i2c_write(BNO_ADDR, pBuffer, write_size)) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to write i2c: (%s)", esp_err_to_name(ret));
-        return 0;
+        // Recovery has already run in i2c_write(). 0 would mean "busy" and
+        // keep this cargo at the head of the transmit queue for good.
+        return SH2_ERR_IO;
     }
   
     return write_size;
 }
+#endif
 
 /*
 3/16/2025 8:04PM
@@ -3,6 +3,7 @@
 
 #include "esp_err.h"
 #include "sh2_SensorValue.h"
+#include "euler.h"
 
 typedef struct {
     float w;
@@ -11,6 +12,156 @@ typedef struct {
     float z;
 } quat_t;
 
+// Quaternion as the hub sends it, each component Q14. Half the size of a
+// quat_t, and what the result queue carries.
+typedef struct {
+    int16_t w;
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} bno_quat_q14_t;
+
+#define BNO_Q14_ONE 16384
+
+// Depth of the result queue, in bno_quat_q14_t
+#define BNO_RESULT_QUEUE_LEN 16
+
+static inline void bno_quat_from_q14(const bno_quat_q14_t *q14, quat_t *quat)
+{
+    const float scale = 1.0f / BNO_Q14_ONE;
+
+    quat->w = q14->w * scale;
+    quat->x = q14->x * scale;
+    quat->y = q14->y * scale;
+    quat->z = q14->z * scale;
+}
+
+// I2C read path accounting. wire_bytes counts every byte clocked off the bus,
+// payload_bytes only the SHTP transfers handed to the driver.
+typedef struct {
+    uint32_t transfers;       // SHTP transfers delivered
+    uint32_t transactions;    // I2C read transactions issued
+    uint32_t wire_bytes;      // Bytes read from the bus
+    uint32_t payload_bytes;   // Bytes delivered (transfer length incl. header)
+    uint32_t header_bytes;    // SHTP headers read, repeats included
+    uint32_t overread_bytes;  // Speculative bytes read past the end of a transfer
+    uint32_t split_transfers; // Transfers that needed a continuation read
+} bno_read_stats_t;
+
+// I2C clock rates tried by the adaptive mode, slowest first
+#define BNO_I2C_RATES 6
+
+typedef struct {
+    uint32_t hz;
+    uint32_t transactions;  // I2C transactions issued at this rate
+    uint32_t nacks;
+    uint32_t timeouts;      // Timeouts and bus faults
+    uint32_t corrupt;       // Reads that completed with a nonsensical SHTP header
+    uint32_t fallbacks;     // Times errors forced the clock down from this rate
+} bno_i2c_rate_t;
+
+typedef struct {
+    uint32_t current_hz;
+    uint32_t changes;       // Clock changes since boot
+    bno_i2c_rate_t rate[BNO_I2C_RATES];
+} bno_i2c_rate_stats_t;
+
+// Escalation steps of the I2C recovery, in order
+typedef enum {
+    BNO_RECOVER_NONE = 0,
+    BNO_RECOVER_RETRY,      // Issue the failed transaction again
+    BNO_RECOVER_BUS_RESET,  // Clear the bus and reset the controller
+    BNO_RECOVER_HUB_RESET,  // Pulse RSTN and rebuild the I2C driver
+} bno_recover_level_t;
+
+typedef struct {
+    uint32_t retries;
+    uint32_t bus_resets;
+    uint32_t hub_resets;
+    uint32_t failures;      // Escalations that ran out of steps
+    uint32_t stuck_sda;     // Failures seen with SDA held low
+    uint32_t last_us;       // Duration of the last bus or hub reset
+    uint32_t max_us;
+    bno_recover_level_t last_level;
+    esp_err_t last_cause;
+} bno_recovery_stats_t;
+
+// Cost of each delivered report, for comparing the blocking and async I2C
+// paths. Only sh2_service() calls that produced a report are counted.
+typedef struct {
+    uint32_t reports;
+    uint64_t service_us;      // Time spent in sh2_service()
+    uint64_t bus_wait_us;     // Of which blocked on I2C transactions
+    uint32_t service_max_us;
+    uint64_t latency_us;      // Hub interrupt to report decoded
+    uint32_t latency_max_us;
+    uint32_t prefetch_hits;   // Transfers already read by the time sh2 asked
+    uint32_t events_dropped;  // Decoded reports overwritten before bno_getSensorEvent() took them
+    uint32_t girv_reports;    // Gyro integrated RVs put in their ring
+    uint32_t girv_dropped;    // Gyro integrated RVs lost to a full ring
+    uint32_t resume_us;       // Last bno_resume() to the first report of medium accuracy or better
+} bno_perf_stats_t;
+
+// Rotation vector convergence since the hub last started, for comparing
+// starts with and without saved calibration
+typedef struct {
+    uint32_t medium_us;     // Start to the first report of medium accuracy, 0 until then
+    uint32_t high_us;       // Start to the first report of high accuracy, 0 until then
+    float accuracy_rad;     // Heading accuracy estimate of the latest report
+    uint32_t dcd_saves;     // Dynamic calibration saved to the hub's flash
+    uint32_t tare_persists;
+} bno_cal_stats_t;
+
+// Boot phases of the IMU stack, in order
+typedef enum {
+    BNO_BOOT_TASK_START = 0,  // IMU task running
+    BNO_BOOT_RESET,           // Hub out of RSTN (I2C)
+    BNO_BOOT_BUS,             // Bus driver up
+    BNO_BOOT_OPEN,            // sh2 open, hub advertisement received
+    BNO_BOOT_PROD_IDS,
+    BNO_BOOT_SUBSCRIBED,      // Sensor configs sent
+    BNO_BOOT_FIRST_SAMPLE,    // First sensor report decoded
+    BNO_BOOT_PHASES,
+} bno_boot_phase_t;
+
+// esp_timer time (us since power-on) each phase finished, 0 if not reached
+typedef struct {
+    uint32_t at_us[BNO_BOOT_PHASES];
+} bno_boot_profile_t;
+
+// Per channel receive throughput over the interval since the previous
+// bno_get_metrics() call
+typedef struct {
+    uint32_t bytes_ps;
+    uint32_t payloads_ps;
+} bno_chan_rate_t;
+
+// Transport and decoder counters from the sh2 driver plus derived rates
+typedef struct {
+    uint32_t interval_us;   // Span the rates cover, 0 on the first call
+    sh2_Metrics_t hub;
+    bno_chan_rate_t rx_rate[SHTP_MAX_CHANS];
+} bno_metrics_t;
+
+// An sh2 operation run on the IMU task on behalf of another task. start
+// issues exactly one sh2_* operation and returns its status; done is then
+// called on the IMU task with the final status.
+typedef int (bno_op_start_t)(void *arg);
+typedef void (bno_op_done_t)(void *cookie, int status);
+
+// Called on the IMU task with every report of a subscribed sensor. value->un
+// holds the member for value->sensorId.
+typedef void (bno_consumer_t)(const sh2_SensorValue_t *value, void *cookie);
+
+// Sensor streams that can be subscribed at once
+#define BNO_MAX_SUBSCRIPTIONS 8
+
+// Gyro integrated rotation vector, from bno_girv_read()
+typedef struct {
+    uint64_t timestamp_us;
+    sh2_GyroIntegratedRV_t rv;  // Orientation and angular velocity (rad/s)
+} bno_girv_sample_t;
+
 esp_err_t bno_init();
 
 bool bno_getSensorEvent(sh2_SensorValue_t *value);
@@ -21,8 +172,91 @@ esp_err_t bno_start_recording();
 
 // esp_err_t bno_reset();
 
+// Euler angles of the latest rotation vector, worked out on request.
+// ESP_ERR_NOT_FOUND before the first one.
+esp_err_t bno_get_euler(euler_convention_t conv, euler_angles_t *ypr);
+
+// Rotation vectors as bno_quat_q14_t, newest kept when full
 QueueHandle_t bno_get_result_queue();
 
+void bno_get_read_stats(bno_read_stats_t *stats);
+
+void bno_get_i2c_rate_stats(bno_i2c_rate_stats_t *stats);
+
+void bno_get_recovery_stats(bno_recovery_stats_t *stats);
+
+void bno_get_perf_stats(bno_perf_stats_t *stats);
+
+// Snapshot of the driver counters, taken by the IMU task. Safe from any task,
+// blocks until the IMU task gets to it.
+esp_err_t bno_get_metrics(bno_metrics_t *metrics);
+
+// Queue an sh2 operation for the IMU task, the only task that may call sh2
+esp_err_t bno_submit_op(bno_op_start_t *start, void *arg, bno_op_done_t *done, void *cookie);
+
+// Tare the rotation vector's X and Y axes, and with CONFIG_BNO08X_PERSIST_TARE
+// keep it for the following boots. Safe from any task, blocks until the hub
+// has answered.
+esp_err_t bno_tareXY();
+
+// Save the hub's dynamic calibration data to its flash now, so the next start
+// begins from it. Safe from any task, blocks until the hub has answered.
+esp_err_t bno_save_calibration();
+
+void bno_get_cal_stats(bno_cal_stats_t *stats);
+
+// Have the hub send the rotation vectors it's holding in its batch FIFO.
+// Safe from any task, blocks until the hub says they've been sent; by then
+// they're in the IMU task's event FIFO.
+esp_err_t bno_flush();
+
+// Let the hub batch sensor reports for up to batch_interval_us (0 for a
+// report per interrupt). Safe from any task; the IMU task sends every
+// subscription again with the new interval. Kept across hub resets.
+esp_err_t bno_set_batching(uint32_t batch_interval_us);
+
+// Have the hub send sensor_id every interval_us, and pass each report to
+// consumer (may be NULL). Replaces an existing subscription to the same
+// sensor; an interval of 0 unsubscribes. Safe from any task, the IMU task
+// sends the config to the hub and again after every hub reset.
+esp_err_t bno_subscribe(sh2_SensorId_t sensor_id, uint32_t interval_us, bno_consumer_t *consumer, void *cookie);
+
+// Most recent report of a subscribed sensor, false if none has arrived yet.
+// Not kept for the gyro integrated rotation vector, see bno_girv_read().
+bool bno_get_latest(sh2_SensorId_t sensor_id, sh2_SensorValue_t *value);
+
+// Take up to max gyro integrated rotation vectors, oldest first, from the
+// ring CONFIG_BNO08X_GIRV fills. Returns how many were taken. Only one task
+// may read.
+uint16_t bno_girv_read(bno_girv_sample_t *samples, uint16_t max);
+
+// Task to notify (xTaskNotifyGive) whenever new gyro integrated rotation
+// vectors are in the ring, NULL for none
+void bno_girv_set_reader(TaskHandle_t task);
+
+// Put the hub to sleep: sensors stop, but their configs and the fusion and
+// calibration state are kept. The IMU task then sleeps too until the hub or
+// another task needs it. Safe from any task, doesn't wait.
+esp_err_t bno_standby();
+
+// Wake the hub from bno_standby() with every sensor as it was. Safe from any
+// task, doesn't wait; the time to the first accurate report is in
+// bno_perf_stats_t.resume_us.
+esp_err_t bno_resume();
+
+// Sensor metadata: range, resolution, Q points and rate limits. Comes from
+// the NVS cache (CONFIG_BNO08X_FRS_CACHE) unless the hub firmware has
+// changed, otherwise it's read from the hub and cached. Safe from any task,
+// blocks while the hub is read.
+esp_err_t bno_get_metadata(sh2_SensorId_t sensor_id, sh2_SensorMetadata_t *meta);
+
+// Read an FRS record through the same cache. words is the capacity of data
+// on entry and the record length on return.
+esp_err_t bno_get_frs(uint16_t record_id, uint32_t *data, uint16_t *words);
+
+// Timestamps of the IMU stack's boot phases, logged at the first sample
+void bno_get_boot_profile(bno_boot_profile_t *profile);
+
 void bno_task(void *pvParameters);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "nvs.h"
+#include "esp_log.h"
+#include "frs_cache.h"
+
+static const char *TAG = "FRS_CACHE";
+
+// Hub firmware an entry was read from
+typedef struct {
+    uint32_t part_number;
+    uint32_t build_number;
+    uint16_t version_patch;
+    uint8_t version_major;
+    uint8_t version_minor;
+} frs_cache_tag_t;
+
+typedef struct {
+    frs_cache_tag_t tag;
+    sh2_SensorMetadata_t meta;
+} frs_cache_meta_t;
+
+typedef struct {
+    frs_cache_tag_t tag;
+    uint16_t words;
+    uint32_t data[FRS_CACHE_MAX_WORDS];
+} frs_cache_record_t;
+
+static nvs_handle_t _nvs = 0;
+static bool _open = false;
+static frs_cache_tag_t _tag;
+
+static void make_tag(frs_cache_tag_t *tag, const sh2_ProductId_t *id)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->part_number = id->swPartNumber;
+    tag->build_number = id->swBuildNumber;
+    tag->version_patch = id->swVersionPatch;
+    tag->version_major = id->swVersionMajor;
+    tag->version_minor = id->swVersionMinor;
+}
+
+// Read a tagged entry, ESP_ERR_NOT_FOUND if missing or from other firmware
+static esp_err_t get_entry(const char *key, void *entry, size_t len)
+{
+    size_t stored = len;
+
+    if (!_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = nvs_get_blob(_nvs, key, entry, &stored);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (stored != len || memcmp(entry, &_tag, sizeof(_tag)) != 0) {
+        // Left over from other firmware or an older layout
+        nvs_erase_key(_nvs, key);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t put_entry(const char *key, const void *entry, size_t len)
+{
+    if (!_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = nvs_set_blob(_nvs, key, entry, len);
+    if (ret == ESP_OK) {
+        ret = nvs_commit(_nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Couldn't store %s (%s)", key, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+esp_err_t frs_cache_open(const sh2_ProductId_t *id)
+{
+    frs_cache_tag_t stored;
+    size_t len = sizeof(stored);
+    esp_err_t ret;
+
+    if (_open) {
+        frs_cache_close();
+    }
+
+    if ((ret = nvs_open(FRS_CACHE_NAMESPACE, NVS_READWRITE, &_nvs)) != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't open NVS namespace (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+    _open = true;
+    make_tag(&_tag, id);
+
+    ret = nvs_get_blob(_nvs, "fw", &stored, &len);
+    if (ret == ESP_OK && len == sizeof(stored) && memcmp(&stored, &_tag, sizeof(_tag)) == 0) {
+        return ESP_OK;
+    }
+
+    // First boot, or the hub has been reflashed: start over
+    ESP_LOGI(TAG, "New hub firmware %" PRIu32 " v%u.%u.%u build %" PRIu32 ", clearing cache",
+             _tag.part_number, _tag.version_major, _tag.version_minor, _tag.version_patch, _tag.build_number);
+    nvs_erase_all(_nvs);
+    return put_entry("fw", &_tag, sizeof(_tag));
+}
+
+void frs_cache_close(void)
+{
+    if (_open) {
+        nvs_close(_nvs);
+        _open = false;
+    }
+}
+
+esp_err_t frs_cache_get_metadata(sh2_SensorId_t sensor_id, sh2_SensorMetadata_t *meta)
+{
+    frs_cache_meta_t entry;
+    char key[8];
+
+    snprintf(key, sizeof(key), "m%02X", sensor_id);
+    esp_err_t ret = get_entry(key, &entry, sizeof(entry));
+    if (ret == ESP_OK) {
+        *meta = entry.meta;
+    }
+    return ret;
+}
+
+esp_err_t frs_cache_put_metadata(sh2_SensorId_t sensor_id, const sh2_SensorMetadata_t *meta)
+{
+    frs_cache_meta_t entry;
+    char key[8];
+
+    memset(&entry, 0, sizeof(entry));
+    entry.tag = _tag;
+    entry.meta = *meta;
+
+    snprintf(key, sizeof(key), "m%02X", sensor_id);
+    return put_entry(key, &entry, sizeof(entry));
+}
+
+esp_err_t frs_cache_get_frs(uint16_t record_id, uint32_t *data, uint16_t *words)
+{
+    frs_cache_record_t entry;
+    char key[8];
+
+    snprintf(key, sizeof(key), "f%04X", record_id);
+    esp_err_t ret = get_entry(key, &entry, sizeof(entry));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (entry.words > *words) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(data, entry.data, entry.words * sizeof(uint32_t));
+    *words = entry.words;
+    return ESP_OK;
+}
+
+esp_err_t frs_cache_put_frs(uint16_t record_id, const uint32_t *data, uint16_t words)
+{
+    frs_cache_record_t entry;
+    char key[8];
+
+    if (words > FRS_CACHE_MAX_WORDS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.tag = _tag;
+    entry.words = words;
+    memcpy(entry.data, data, words * sizeof(uint32_t));
+
+    snprintf(key, sizeof(key), "f%04X", record_id);
+    return put_entry(key, &entry, sizeof(entry));
+}
+
+esp_err_t frs_cache_clear(void)
+{
+    if (!_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    nvs_erase_all(_nvs);
+    return put_entry("fw", &_tag, sizeof(_tag));
+}
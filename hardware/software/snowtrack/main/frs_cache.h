@@ -0,0 +1,40 @@
+#ifndef FRS_CACHE_H
+#define FRS_CACHE_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sh2.h"
+
+// Sensor metadata and FRS records of the BNO08x, kept in NVS so they're read
+// from the hub once per hub firmware rather than on every boot. Entries are
+// tagged with the product id they were read from: frs_cache_open() drops the
+// lot when the hub reports different firmware, and each entry is checked
+// against it again when it's first read.
+
+#define FRS_CACHE_NAMESPACE "bno_frs"
+
+// Largest FRS record kept, in 32-bit words
+#define FRS_CACHE_MAX_WORDS 16
+
+// Open the cache for the hub identified by id, the first entry of
+// sh2_getProdIds()
+esp_err_t frs_cache_open(const sh2_ProductId_t *id);
+
+void frs_cache_close(void);
+
+// ESP_ERR_NOT_FOUND if the sensor's metadata isn't cached yet
+esp_err_t frs_cache_get_metadata(sh2_SensorId_t sensor_id, sh2_SensorMetadata_t *meta);
+
+esp_err_t frs_cache_put_metadata(sh2_SensorId_t sensor_id, const sh2_SensorMetadata_t *meta);
+
+// words is the capacity of data on entry and the record length on return.
+// ESP_ERR_NOT_FOUND if the record isn't cached yet.
+esp_err_t frs_cache_get_frs(uint16_t record_id, uint32_t *data, uint16_t *words);
+
+esp_err_t frs_cache_put_frs(uint16_t record_id, const uint32_t *data, uint16_t words);
+
+// Drop every entry, for example after writing an FRS record to the hub
+esp_err_t frs_cache_clear(void);
+
+#endif
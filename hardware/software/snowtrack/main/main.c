@@ -9,12 +9,14 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_gap_bt_api.h"
@@ -22,6 +24,7 @@
 #include "esp_spp_api.h"
 #include "sh2.h"
 #include "bno08x.h"
+#include "euler.h"
 #include "spp_server.h"
 
 #include "time.h"
@@ -43,10 +46,64 @@ static long data_num = 0;
 
 static uint32_t recent_handle = 0;
 
+#if CONFIG_BNO08X_EULER_BENCH
+#define EULER_BENCH_QUATS 64
+#define EULER_BENCH_REPS 100
+
+typedef void (*euler_convert_t)(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out);
+
+static void ypr_ceva(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out)
+{
+    q_to_ypr(r, i, j, k, &out->yaw, &out->pitch, &out->roll);
+}
+
+static uint32_t euler_bench_ns(euler_convert_t convert, float (*q)[4], euler_convention_t conv)
+{
+    volatile float sink = 0;
+    euler_angles_t ypr;
+
+    int64_t start = esp_timer_get_time();
+    for (int rep = 0; rep < EULER_BENCH_REPS; rep++) {
+        for (int s = 0; s < EULER_BENCH_QUATS; s++) {
+            convert(q[s][0], q[s][1], q[s][2], q[s][3], conv, &ypr);
+            sink += ypr.yaw + ypr.pitch + ypr.roll;
+        }
+    }
+    (void)sink;
+    return (esp_timer_get_time() - start) * 1000 / (EULER_BENCH_QUATS * EULER_BENCH_REPS);
+}
+
+// Time the Euler kernels against libm, whose double precision is software
+// emulated here. tools/sh2_host/euler_bench does the same on the host, and
+// checks accuracy.
+static void euler_bench(void)
+{
+    static float q[EULER_BENCH_QUATS][4];
+    const float axis[3] = {0.267261f, 0.534522f, 0.801784f};
+
+    for (int s = 0; s < EULER_BENCH_QUATS; s++) {
+        float half = s * 0.1f;
+        q[s][0] = cosf(half);
+        for (int c = 0; c < 3; c++) {
+            q[s][c + 1] = sinf(half) * axis[c];
+        }
+    }
+
+    ESP_LOGI(TAG, "Euler conversion: q_to_euler %" PRIu32 " ns, q_to_euler_libm %" PRIu32 " ns, q_to_ypr %" PRIu32 " ns",
+             euler_bench_ns(q_to_euler, q, EULER_ZYX),
+             euler_bench_ns(q_to_euler_libm, q, EULER_ZYX),
+             euler_bench_ns(ypr_ceva, q, EULER_CEVA));
+}
+#endif
+
 void app_main(void)
 {
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
 
+#if CONFIG_BNO08X_EULER_BENCH
+    euler_bench();
+#endif
+
     char bda_str[18] = {0};
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
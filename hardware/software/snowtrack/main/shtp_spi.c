@@ -0,0 +1,202 @@
+#include <string.h>
+
+#include "shtp_spi.h"
+#include "sh2_err.h"
+
+#define SHTP_HDR_LEN 4
+
+static const uint8_t softreset_pkt[] = {5, 0, 1, 0, 1};
+
+static int spihal_open(sh2_Hal_t *self);
+static void spihal_close(sh2_Hal_t *self);
+static int spihal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us);
+static int spihal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len);
+static uint32_t spihal_getTimeUs(sh2_Hal_t *self);
+
+sh2_Hal_t *shtp_spi_init(shtp_spi_t *spi, const shtp_spi_port_t *port)
+{
+    memset(spi, 0, sizeof(*spi));
+    spi->port = port;
+
+    spi->hal.open = spihal_open;
+    spi->hal.close = spihal_close;
+    spi->hal.read = spihal_read;
+    spi->hal.write = spihal_write;
+    spi->hal.getTimeUs = spihal_getTimeUs;
+
+    return &spi->hal;
+}
+
+void shtp_spi_get_stats(const shtp_spi_t *spi, shtp_spi_stats_t *stats)
+{
+    *stats = spi->stats;
+}
+
+static int spihal_open(sh2_Hal_t *self)
+{
+    shtp_spi_t *spi = (shtp_spi_t *)self;
+    const shtp_spi_port_t *port = spi->port;
+
+    spi->txLen = 0;
+    port->setWake(port->ctx, false);
+
+    if (port->setReset != NULL) {
+        port->setReset(port->ctx, true);
+        port->delayUs(port->ctx, SHTP_SPI_RESET_PULSE_US);
+        port->setReset(port->ctx, false);
+    } else {
+        // No reset line, ask the hub to reset itself once it's listening
+        memcpy(spi->txBuf, softreset_pkt, sizeof(softreset_pkt));
+        spi->txLen = sizeof(softreset_pkt);
+        spi->wakeTimeUs = port->getTimeUs(port->ctx);
+        port->setWake(port->ctx, true);
+    }
+
+    // The hub signals it's out of reset by asserting H_INTN with its
+    // advertisement. sh2_open() reads it, we only make sure it's there.
+    if (!port->waitInt(port->ctx, SHTP_SPI_RESET_WAIT_US)) {
+        return SH2_ERR_TIMEOUT;
+    }
+
+    return SH2_OK;
+}
+
+static void spihal_close(sh2_Hal_t *self)
+{
+    shtp_spi_t *spi = (shtp_spi_t *)self;
+    const shtp_spi_port_t *port = spi->port;
+
+    spi->txLen = 0;
+    port->setWake(port->ctx, false);
+    if (port->setReset != NULL) {
+        port->setReset(port->ctx, true);
+    }
+}
+
+static int spihal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us)
+{
+    shtp_spi_t *spi = (shtp_spi_t *)self;
+    const shtp_spi_port_t *port = spi->port;
+
+    if (!port->waitInt(port->ctx, 0)) {
+        if (spi->txLen != 0 &&
+            (port->getTimeUs(port->ctx) - spi->wakeTimeUs) > SHTP_SPI_WAKE_TIMEOUT_US) {
+            // Hub missed the wake edge, give it another one
+            spi->stats.wakeTimeouts++;
+            port->setWake(port->ctx, false);
+            port->setWake(port->ctx, true);
+            spi->wakeTimeUs = port->getTimeUs(port->ctx);
+        }
+        return 0;
+    }
+
+    *t_us = port->intTimeUs(port->ctx);
+
+    // The hub is listening now, WAKE has done its job
+    if (spi->txLen != 0) {
+        port->setWake(port->ctx, false);
+    }
+
+    // Header first, sending ours at the same time if we have one
+    const uint8_t *tx = (spi->txLen != 0) ? spi->txBuf : NULL;
+    if (port->transfer(port->ctx, tx, pBuffer, SHTP_HDR_LEN, true) != 0) {
+        spi->stats.busErrors++;
+        port->transfer(port->ctx, NULL, NULL, 0, false);
+        return 0;
+    }
+
+    uint16_t rxLen = ((uint16_t)pBuffer[0] | (uint16_t)pBuffer[1] << 8) & ~0x8000;
+    if (rxLen == 0x7FFF) {
+        // Bus floating high, the hub didn't drive the header
+        rxLen = 0;
+    }
+
+    unsigned total = (rxLen > spi->txLen) ? rxLen : spi->txLen;
+    bool fits = (total <= len);
+    unsigned offset = SHTP_HDR_LEN;
+
+    if (total <= SHTP_HDR_LEN) {
+        port->transfer(port->ctx, NULL, NULL, 0, false);
+    }
+
+    // Clock the rest in one go where possible. Only split where our transmit
+    // data runs out, or to discard a hub transfer that doesn't fit.
+    while (offset < total) {
+        unsigned chunk = total - offset;
+        uint8_t *rx = pBuffer + offset;
+
+        tx = NULL;
+        if (offset < spi->txLen) {
+            tx = spi->txBuf + offset;
+            if (chunk > spi->txLen - offset) {
+                chunk = spi->txLen - offset;
+            }
+        }
+        if (!fits) {
+            rx = pBuffer;
+            if (chunk > len) {
+                chunk = len;
+            }
+        }
+
+        bool last = (offset + chunk >= total);
+        if (port->transfer(port->ctx, tx, rx, chunk, !last) != 0) {
+            spi->stats.busErrors++;
+            port->transfer(port->ctx, NULL, NULL, 0, false);
+            return 0;
+        }
+        offset += chunk;
+    }
+
+    spi->stats.transfers++;
+    if (spi->txLen != 0) {
+        spi->stats.txTransfers++;
+        spi->stats.txBytes += spi->txLen;
+        spi->txLen = 0;
+    }
+
+    if (rxLen == 0) {
+        return 0;
+    }
+
+    spi->stats.rxTransfers++;
+    spi->stats.rxBytes += rxLen;
+
+    if (!fits) {
+        spi->stats.rxTooLarge++;
+        return 0;
+    }
+
+    return rxLen;
+}
+
+static int spihal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len)
+{
+    shtp_spi_t *spi = (shtp_spi_t *)self;
+    const shtp_spi_port_t *port = spi->port;
+
+    if (len > sizeof(spi->txBuf)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    if (spi->txLen != 0) {
+        // Previous transfer still waiting for the hub, shtp will service us
+        // and try again
+        return 0;
+    }
+
+    // Goes out on the next H_INTN, full duplex with whatever the hub sends
+    memcpy(spi->txBuf, pBuffer, len);
+    spi->txLen = len;
+    spi->wakeTimeUs = port->getTimeUs(port->ctx);
+    port->setWake(port->ctx, true);
+
+    return len;
+}
+
+static uint32_t spihal_getTimeUs(sh2_Hal_t *self)
+{
+    shtp_spi_t *spi = (shtp_spi_t *)self;
+
+    return spi->port->getTimeUs(spi->port->ctx);
+}
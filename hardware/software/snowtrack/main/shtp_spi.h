@@ -0,0 +1,79 @@
+#ifndef SHTP_SPI_H
+#define SHTP_SPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+
+// SHTP over SPI for the BNO08x, independent of the SPI driver underneath.
+//
+// The hub only talks when it pulls H_INTN low. Every transfer is full duplex:
+// the host clocks a 4-byte header (its own, if it has something to send) and
+// keeps CS asserted for max(host length, hub length) bytes. To send when the
+// hub is idle the host drives WAKE (PS0) low and waits for H_INTN.
+//
+// The platform supplies a port with the pin and bus primitives; the core
+// implements sh2_Hal_t on top of it. This keeps the protocol buildable on the
+// host against a simulated hub.
+
+typedef struct shtp_spi_port_s {
+    // Block until H_INTN is asserted (low) or timeout_us elapses, true if
+    // asserted. A zero timeout just samples the pin.
+    bool (*waitInt)(void *ctx, uint32_t timeout_us);
+
+    // Host time of the last H_INTN falling edge
+    uint32_t (*intTimeUs)(void *ctx);
+
+    // Drive WAKE/PS0: asserted means low
+    void (*setWake)(void *ctx, bool asserted);
+
+    // Drive RSTN: asserted means low. May be NULL if the hub isn't wired for it
+    void (*setReset)(void *ctx, bool asserted);
+
+    // Full-duplex transfer of len bytes. tx may be NULL to clock out zeros.
+    // keepCs leaves CS asserted so the next call continues the same transfer.
+    // A zero-length call with keepCs false just releases CS. Returns 0 on
+    // success.
+    int (*transfer)(void *ctx, const uint8_t *tx, uint8_t *rx, unsigned len, bool keepCs);
+
+    uint32_t (*getTimeUs)(void *ctx);
+    void (*delayUs)(void *ctx, uint32_t us);
+
+    void *ctx;
+} shtp_spi_port_t;
+
+typedef struct {
+    uint32_t transfers;     // CS-framed transfers
+    uint32_t rxTransfers;   // Transfers that carried hub data
+    uint32_t txTransfers;   // Transfers that carried host data
+    uint32_t rxBytes;
+    uint32_t txBytes;
+    uint32_t rxTooLarge;    // Hub transfers that didn't fit the caller's buffer
+    uint32_t wakeTimeouts;  // WAKE asserted but H_INTN never followed
+    uint32_t busErrors;
+} shtp_spi_stats_t;
+
+typedef struct shtp_spi_s {
+    sh2_Hal_t hal;  // Must be first, sh2 passes this back as self
+    const shtp_spi_port_t *port;
+
+    uint8_t txBuf[SH2_HAL_MAX_TRANSFER_OUT];
+    unsigned txLen;  // Pending host transfer, 0 if none
+    uint32_t wakeTimeUs;
+
+    shtp_spi_stats_t stats;
+} shtp_spi_t;
+
+// Hardware reset pulse and the wait for the hub's first H_INTN
+#define SHTP_SPI_RESET_PULSE_US   (10000)
+#define SHTP_SPI_RESET_WAIT_US    (300000)
+// How long a write waits for the hub to answer WAKE
+#define SHTP_SPI_WAKE_TIMEOUT_US  (50000)
+
+// Fill in spi->hal with the SPI implementation and return it for sh2_open()
+sh2_Hal_t *shtp_spi_init(shtp_spi_t *spi, const shtp_spi_port_t *port);
+
+void shtp_spi_get_stats(const shtp_spi_t *spi, shtp_spi_stats_t *stats);
+
+#endif
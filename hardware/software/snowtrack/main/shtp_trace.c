@@ -0,0 +1,192 @@
+#include <string.h>
+
+#include "shtp_trace.h"
+
+static int tracehal_open(sh2_Hal_t *self);
+static void tracehal_close(sh2_Hal_t *self);
+static int tracehal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us);
+static int tracehal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len);
+static uint32_t tracehal_getTimeUs(sh2_Hal_t *self);
+
+static unsigned putVarint(uint8_t *p, uint32_t v)
+{
+    unsigned n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+
+    return n;
+}
+
+static bool getVarint(const uint8_t **cursor, const uint8_t *end, uint32_t *v)
+{
+    const uint8_t *p = *cursor;
+    uint32_t value = 0;
+
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (p >= end) {
+            return false;
+        }
+        uint8_t b = *p++;
+        value |= (uint32_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *cursor = p;
+            *v = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void shtp_trace_flush(shtp_trace_t *trace)
+{
+    if (trace->used > 0) {
+        trace->sink(trace->cookie, trace->buf, trace->used);
+        trace->bytes += trace->used;
+        trace->used = 0;
+    }
+}
+
+static void record(shtp_trace_t *trace, uint8_t type, uint32_t t_us, const uint8_t *data, unsigned len)
+{
+    if (!trace->started) {
+        memcpy(trace->buf, SHTP_TRACE_MAGIC, 4);
+        trace->buf[4] = SHTP_TRACE_VERSION;
+        memset(&trace->buf[5], 0, 3);
+        trace->used = SHTP_TRACE_HDR_LEN;
+        trace->lastUs = 0;
+        trace->started = true;
+    }
+
+    if (len > SH2_HAL_MAX_TRANSFER_IN ||
+        (trace->limit != 0 && trace->bytes + trace->used + SHTP_TRACE_MAX_RECORD > trace->limit)) {
+        trace->dropped++;
+        return;
+    }
+
+    if (trace->used + SHTP_TRACE_MAX_RECORD > sizeof(trace->buf)) {
+        shtp_trace_flush(trace);
+    }
+
+    uint8_t *p = trace->buf + trace->used;
+    unsigned n = 0;
+
+    p[n++] = type;
+    n += putVarint(p + n, t_us - trace->lastUs);
+    n += putVarint(p + n, len);
+    if (len > 0) {
+        memcpy(p + n, data, len);
+        n += len;
+    }
+
+    trace->used += n;
+    trace->lastUs = t_us;
+    trace->records++;
+}
+
+sh2_Hal_t *shtp_trace_wrap(shtp_trace_t *trace, sh2_Hal_t *inner,
+                           shtp_trace_sink_t *sink, void *cookie, uint32_t limit)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->inner = inner;
+    trace->sink = sink;
+    trace->cookie = cookie;
+    trace->limit = limit;
+
+    trace->hal.open = tracehal_open;
+    trace->hal.close = tracehal_close;
+    trace->hal.read = tracehal_read;
+    trace->hal.write = tracehal_write;
+    trace->hal.getTimeUs = tracehal_getTimeUs;
+
+    return &trace->hal;
+}
+
+static int tracehal_open(sh2_Hal_t *self)
+{
+    shtp_trace_t *trace = (shtp_trace_t *)self;
+
+    int rc = trace->inner->open(trace->inner);
+    record(trace, SHTP_TRACE_OPEN, trace->inner->getTimeUs(trace->inner), NULL, 0);
+
+    return rc;
+}
+
+static void tracehal_close(sh2_Hal_t *self)
+{
+    shtp_trace_t *trace = (shtp_trace_t *)self;
+
+    record(trace, SHTP_TRACE_CLOSE, trace->inner->getTimeUs(trace->inner), NULL, 0);
+    shtp_trace_flush(trace);
+    trace->inner->close(trace->inner);
+}
+
+static int tracehal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us)
+{
+    shtp_trace_t *trace = (shtp_trace_t *)self;
+
+    int rc = trace->inner->read(trace->inner, pBuffer, len, t_us);
+    if (rc > 0) {
+        record(trace, SHTP_TRACE_READ, *t_us, pBuffer, rc);
+    }
+
+    return rc;
+}
+
+static int tracehal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len)
+{
+    shtp_trace_t *trace = (shtp_trace_t *)self;
+
+    int rc = trace->inner->write(trace->inner, pBuffer, len);
+    if (rc > 0) {
+        record(trace, SHTP_TRACE_WRITE, trace->inner->getTimeUs(trace->inner), pBuffer, rc);
+    }
+
+    return rc;
+}
+
+static uint32_t tracehal_getTimeUs(sh2_Hal_t *self)
+{
+    shtp_trace_t *trace = (shtp_trace_t *)self;
+
+    return trace->inner->getTimeUs(trace->inner);
+}
+
+bool shtp_trace_begin(const uint8_t *data, unsigned len, const uint8_t **cursor)
+{
+    if (len < SHTP_TRACE_HDR_LEN || memcmp(data, SHTP_TRACE_MAGIC, 4) != 0 ||
+        data[4] != SHTP_TRACE_VERSION) {
+        return false;
+    }
+
+    *cursor = data + SHTP_TRACE_HDR_LEN;
+    return true;
+}
+
+bool shtp_trace_next(const uint8_t **cursor, const uint8_t *end, shtp_trace_rec_t *rec)
+{
+    const uint8_t *p = *cursor;
+    uint32_t dt, len;
+
+    if (p >= end) {
+        return false;
+    }
+    uint8_t type = *p++;
+
+    if (!getVarint(&p, end, &dt) || !getVarint(&p, end, &len) ||
+        len > SH2_HAL_MAX_TRANSFER_IN || (uint32_t)(end - p) < len) {
+        return false;
+    }
+
+    rec->type = type;
+    rec->t_us += dt;
+    rec->len = len;
+    rec->data = p;
+    *cursor = p + len;
+
+    return true;
+}
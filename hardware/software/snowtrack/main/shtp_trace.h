@@ -0,0 +1,76 @@
+#ifndef SHTP_TRACE_H
+#define SHTP_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+
+// Capture of raw SHTP traffic. shtp_trace_wrap() puts a recording sh2_Hal_t
+// in front of the real one; every transfer read from or written to the hub
+// is appended to a compact binary trace and handed to a sink in blocks.
+//
+// Trace format, little endian:
+//   header  "SHTR", version, 3 reserved bytes
+//   record  type (1 byte), dt_us (varint), len (varint), len bytes
+// dt_us is the time since the previous record. Reads are stamped with the
+// t_us the HAL reported for them, everything else with getTimeUs(). Empty
+// polls aren't recorded.
+
+#define SHTP_TRACE_MAGIC   "SHTR"
+#define SHTP_TRACE_VERSION (1)
+#define SHTP_TRACE_HDR_LEN (8)
+
+#define SHTP_TRACE_READ  (1)
+#define SHTP_TRACE_WRITE (2)
+#define SHTP_TRACE_OPEN  (3)
+#define SHTP_TRACE_CLOSE (4)
+
+// Largest record: type, two 5-byte varints, a full transfer
+#define SHTP_TRACE_MAX_RECORD (1 + 5 + 5 + SH2_HAL_MAX_TRANSFER_IN)
+#define SHTP_TRACE_BUF_LEN    (SHTP_TRACE_MAX_RECORD + 256)
+
+typedef void (shtp_trace_sink_t)(void *cookie, const uint8_t *data, unsigned len);
+
+typedef struct shtp_trace_s {
+    sh2_Hal_t hal;  // Must be first, sh2 passes this back as self
+    sh2_Hal_t *inner;
+
+    shtp_trace_sink_t *sink;
+    void *cookie;
+    uint32_t limit;  // Stop recording after this many bytes, 0 for no limit
+
+    bool started;
+    uint32_t lastUs;
+    unsigned used;
+    uint8_t buf[SHTP_TRACE_BUF_LEN];
+
+    uint32_t records;
+    uint32_t bytes;    // Bytes handed to the sink, header included
+    uint32_t dropped;  // Records not written because of the limit
+} shtp_trace_t;
+
+typedef struct {
+    uint8_t type;
+    uint32_t t_us;  // Accumulated from dt_us
+    uint16_t len;
+    const uint8_t *data;
+} shtp_trace_rec_t;
+
+// Wrap inner so its traffic is recorded. Returns the HAL to pass to sh2_open()
+sh2_Hal_t *shtp_trace_wrap(shtp_trace_t *trace, sh2_Hal_t *inner,
+                           shtp_trace_sink_t *sink, void *cookie, uint32_t limit);
+
+// Hand any buffered records to the sink
+void shtp_trace_flush(shtp_trace_t *trace);
+
+// Check the header of a trace held in memory. On success *cursor points at
+// the first record.
+bool shtp_trace_begin(const uint8_t *data, unsigned len, const uint8_t **cursor);
+
+// Parse the record at *cursor. t_us in rec carries the running time, so pass
+// the same rec back in for each call. Returns false at the end of the trace
+// or on a truncated record.
+bool shtp_trace_next(const uint8_t **cursor, const uint8_t *end, shtp_trace_rec_t *rec);
+
+#endif
@@ -39,13 +39,46 @@ typedef enum {
     TYPE_START_RECORDING     = 0x01,
     TYPE_STOP_RECORDING      = 0x02,
     TYPE_RECEIVE_RECORDINGS  = 0x03,
-    TYPE_CLEAR_RECORDINGS    = 0x04
+    TYPE_CLEAR_RECORDINGS    = 0x04,
+    TYPE_GET_METRICS         = 0x05,
+    TYPE_TARE_XY             = 0x06,
+    TYPE_FLUSH               = 0x07,
+    TYPE_STANDBY             = 0x08,
+    TYPE_RESUME              = 0x09,
+    TYPE_SAVE_CALIBRATION    = 0x0A,
+    TYPE_STREAM_START        = 0x0B,
+    TYPE_STREAM_STOP         = 0x0C
 } command_type_t;
 
 typedef enum {
-    RESP_STATUS
+    RESP_STATUS,
+    RESP_METRICS,
+    RESP_QUATS
 } response_type_t;
 
+// RESP_METRICS layout, integers little endian u32 unless noted:
+//   type (u8), version (u8), interval_us,
+//   shtp: rxBadChan, rxShortFragments, rxTooLargePayloads, rxInterruptedPayloads,
+//         rxRingFull, rxPayloads, rxZeroCopy, rxCopyBytes,
+//         badTxChan, txDiscards, txTooLargePayloads, txQueueFull,
+//   sh2:  reports, eventCopyBytes, execBadPayload, emptyPayloads, unknownReportIds,
+//         skippedReports,
+//   channel count (u8), then per channel:
+//         rxPayloads, rxBytes, txPayloads, txBytes, seqGaps, bytes_ps, payloads_ps,
+//         SHTP_LATENCY_BINS reassembly latency bins
+#define METRICS_VERSION 2
+
+// RESP_QUATS layout, sent while streaming: type (u8), count (u8), then count
+// rotation vectors of w, x, y, z as little endian Q14 i16. 8 bytes a sample
+// where "%f %f %f %f\n" took about 40.
+#define QUATS_MAX BNO_RESULT_QUEUE_LEN
+#define QUATS_LEN (2 + QUATS_MAX * 8)
+
+// How long the server waits for a command before forwarding the quaternions
+// queued meanwhile
+#define STREAM_PERIOD_MS 20
+#define METRICS_LEN (2 + 4 + 18 * 4 + 1 + SHTP_MAX_CHANS * (7 + SHTP_LATENCY_BINS) * 4)
+
 enum status_t {
     STAT_OK,
     STAT_INVALID_COMMAND,
@@ -70,6 +103,7 @@ static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_NONE;
 static const esp_spp_role_t role_slave = ESP_SPP_ROLE_SLAVE;
 
 static uint32_t recent_handle = 0;
+static bool streaming = false;
 
 QueueHandle_t command_queue = NULL;
 
@@ -108,6 +142,7 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
         ESP_LOGI(TAG, "ESP_SPP_CLOSE_EVT status:%d handle:%"PRIu32" close_by_remote:%d", param->close.status,
                  param->close.handle, param->close.async);
         recent_handle = 0;
+        streaming = false;
         break;
     case ESP_SPP_START_EVT:
         if (param->start.status == ESP_SPP_SUCCESS) {
@@ -136,7 +171,7 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
             };
 
             // Catch invalid commands
-            if (command.command_type > TYPE_CLEAR_RECORDINGS) {
+            if (command.command_type > TYPE_STREAM_STOP) {
                 uint8_t response[2] = {RESP_STATUS, STAT_INVALID_COMMAND};
                 esp_spp_write(recent_handle, sizeof(response), response);
                 break;
@@ -235,6 +270,103 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
     return;
 }
 
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+    return p + 4;
+}
+
+static uint8_t *put_i16(uint8_t *p, int16_t v)
+{
+    p[0] = (uint16_t)v & 0xFF;
+    p[1] = ((uint16_t)v >> 8) & 0xFF;
+    return p + 2;
+}
+
+// Forward what the IMU has queued, as it came from the hub
+static void send_quats(QueueHandle_t imu_queue)
+{
+    static uint8_t response[QUATS_LEN];
+    bno_quat_q14_t quat;
+    uint8_t *p = response + 2;
+    uint8_t count = 0;
+
+    while (count < QUATS_MAX && xQueueReceive(imu_queue, &quat, 0) == pdPASS) {
+        p = put_i16(p, quat.w);
+        p = put_i16(p, quat.x);
+        p = put_i16(p, quat.y);
+        p = put_i16(p, quat.z);
+        count++;
+    }
+
+    if (count == 0 || recent_handle == 0) {
+        return;
+    }
+    response[0] = RESP_QUATS;
+    response[1] = count;
+    esp_spp_write(recent_handle, p - response, response);
+}
+
+static void send_metrics()
+{
+    static bno_metrics_t metrics;
+    static uint8_t response[METRICS_LEN];
+
+    if (bno_get_metrics(&metrics) != ESP_OK) {
+        uint8_t status[2] = {RESP_STATUS, STAT_ERROR};
+        esp_spp_write(recent_handle, sizeof(status), status);
+        return;
+    }
+
+    const shtp_Metrics_t *shtp = &metrics.hub.shtp;
+    uint8_t *p = response;
+
+    *p++ = RESP_METRICS;
+    *p++ = METRICS_VERSION;
+    p = put_u32(p, metrics.interval_us);
+
+    p = put_u32(p, shtp->rxBadChan);
+    p = put_u32(p, shtp->rxShortFragments);
+    p = put_u32(p, shtp->rxTooLargePayloads);
+    p = put_u32(p, shtp->rxInterruptedPayloads);
+    p = put_u32(p, shtp->rxRingFull);
+    p = put_u32(p, shtp->rxPayloads);
+    p = put_u32(p, shtp->rxZeroCopy);
+    p = put_u32(p, shtp->rxCopyBytes);
+    p = put_u32(p, shtp->badTxChan);
+    p = put_u32(p, shtp->txDiscards);
+    p = put_u32(p, shtp->txTooLargePayloads);
+    p = put_u32(p, shtp->txQueueFull);
+
+    p = put_u32(p, metrics.hub.reports);
+    p = put_u32(p, metrics.hub.eventCopyBytes);
+    p = put_u32(p, metrics.hub.execBadPayload);
+    p = put_u32(p, metrics.hub.emptyPayloads);
+    p = put_u32(p, metrics.hub.unknownReportIds);
+    p = put_u32(p, metrics.hub.skippedReports);
+
+    *p++ = SHTP_MAX_CHANS;
+    for (int i = 0; i < SHTP_MAX_CHANS; i++) {
+        const shtp_ChanMetrics_t *chan = &shtp->chan[i];
+
+        p = put_u32(p, chan->rxPayloads);
+        p = put_u32(p, chan->rxBytes);
+        p = put_u32(p, chan->txPayloads);
+        p = put_u32(p, chan->txBytes);
+        p = put_u32(p, chan->seqGaps);
+        p = put_u32(p, metrics.rx_rate[i].bytes_ps);
+        p = put_u32(p, metrics.rx_rate[i].payloads_ps);
+        for (int bin = 0; bin < SHTP_LATENCY_BINS; bin++) {
+            p = put_u32(p, chan->assemblyUs[bin]);
+        }
+    }
+
+    esp_spp_write(recent_handle, p - response, response);
+}
+
 void server_init() 
 {
     command_queue = xQueueCreate(10, sizeof(command_t));
@@ -329,13 +461,68 @@ void server_task(void *pvParameters)
     } while (imu_queue == NULL);
 
     while (1) {
-        rtos_ret = xQueueReceive(command_queue, &command, portMAX_DELAY);
+        rtos_ret = xQueueReceive(command_queue, &command,
+                                 streaming ? pdMS_TO_TICKS(STREAM_PERIOD_MS) : portMAX_DELAY);
+        if (streaming) {
+            send_quats(imu_queue);
+        }
         if (rtos_ret != pdPASS) {
-            ESP_LOGE(TAG, "Failed to recieve command from queue (%d)", rtos_ret);
+            if (!streaming) {
+                ESP_LOGE(TAG, "Failed to recieve command from queue (%d)", rtos_ret);
+            }
             continue;
         }
 
         ESP_LOGI(TAG, "Task recieved command: %d", command.command_type);
+
+        switch (command.command_type) {
+        case TYPE_GET_METRICS:
+            send_metrics();
+            break;
+        case TYPE_TARE_XY:
+        {
+            // Runs on the IMU task, this one waits for the hub's answer
+            uint8_t response[2] = {RESP_STATUS, (bno_tareXY() == ESP_OK) ? STAT_OK : STAT_ERROR};
+            esp_spp_write(recent_handle, sizeof(response), response);
+        }
+            break;
+        case TYPE_FLUSH:
+        {
+            // Fresh data for a live view while the hub is batching
+            uint8_t response[2] = {RESP_STATUS, (bno_flush() == ESP_OK) ? STAT_OK : STAT_ERROR};
+            esp_spp_write(recent_handle, sizeof(response), response);
+        }
+            break;
+        case TYPE_STANDBY:
+        {
+            // Between runs: the hub keeps its configs and fusion state
+            uint8_t response[2] = {RESP_STATUS, (bno_standby() == ESP_OK) ? STAT_OK : STAT_ERROR};
+            esp_spp_write(recent_handle, sizeof(response), response);
+        }
+            break;
+        case TYPE_RESUME:
+        {
+            uint8_t response[2] = {RESP_STATUS, (bno_resume() == ESP_OK) ? STAT_OK : STAT_ERROR};
+            esp_spp_write(recent_handle, sizeof(response), response);
+        }
+            break;
+        case TYPE_SAVE_CALIBRATION:
+        {
+            uint8_t response[2] = {RESP_STATUS, (bno_save_calibration() == ESP_OK) ? STAT_OK : STAT_ERROR};
+            esp_spp_write(recent_handle, sizeof(response), response);
+        }
+            break;
+        case TYPE_STREAM_START:
+        case TYPE_STREAM_STOP:
+        {
+            streaming = (command.command_type == TYPE_STREAM_START);
+            uint8_t response[2] = {RESP_STATUS, STAT_OK};
+            esp_spp_write(recent_handle, sizeof(response), response);
+        }
+            break;
+        default:
+            break;
+        }
     }
 
     vTaskDelete(NULL);
@@ -75,3 +75,97 @@ void q_to_ypr(float r, float i, float j, float k, float *pYaw, float *pPitch, fl
     *pRoll = (float)atan2((double)num, (double)den);
 }
 
+
+// Arguments of yaw = atan2(yn, yd), pitch = asin(p), roll = atan2(rn, rd)
+typedef struct {
+    float yn, yd;
+    float p;
+    float rn, rd;
+} euler_args_t;
+
+static void euler_args(float r, float i, float j, float k, euler_convention_t conv, euler_args_t *a)
+{
+    float rr = r * r, ii = i * i, jj = j * j, kk = k * k;
+
+    switch (conv) {
+    case EULER_CEVA:
+        a->yn = 2.0f * (i * j - r * k);
+        a->yd = 2.0f * (rr + jj) - 1.0f;
+        a->p = 2.0f * (j * k + r * i);
+        a->rn = 2.0f * (r * j - i * k);
+        a->rd = 2.0f * (rr + kk) - 1.0f;
+        break;
+    case EULER_DIEBEL_321:
+        a->yn = 2.0f * (r * k - i * j);
+        a->yd = rr + ii - jj - kk;
+        a->p = 2.0f * (i * k + r * j) / (rr + ii + jj + kk);
+        a->rn = 2.0f * (r * i - j * k);
+        a->rd = rr - ii - jj + kk;
+        break;
+    case EULER_ZYX:
+    default:
+        a->yn = 2.0f * (i * j + r * k);
+        a->yd = rr + ii - jj - kk;
+        a->p = 2.0f * (r * j - i * k) / (rr + ii + jj + kk);
+        a->rn = 2.0f * (j * k + r * i);
+        a->rd = rr - ii - jj + kk;
+        break;
+    }
+
+    if (a->p > 1.0f) a->p = 1.0f;
+    if (a->p < -1.0f) a->p = -1.0f;
+}
+
+// atan(t) for t in [0, 1], Abramowitz & Stegun 4.4.49
+#define ATAN_A1  0.9998660f
+#define ATAN_A3 -0.3302995f
+#define ATAN_A5  0.1801410f
+#define ATAN_A7 -0.0851330f
+#define ATAN_A9  0.0208351f
+
+float euler_atan2f(float y, float x)
+{
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float hi = (ax > ay) ? ax : ay;
+    float lo = (ax > ay) ? ay : ax;
+
+    if (hi == 0.0f) {
+        return 0.0f;
+    }
+
+    // Reduce to an octant, then unfold
+    float t = lo / hi;
+    float t2 = t * t;
+    float a = t * (ATAN_A1 + t2 * (ATAN_A3 + t2 * (ATAN_A5 + t2 * (ATAN_A7 + t2 * ATAN_A9))));
+
+    if (ay > ax) a = (float)(M_PI / 2) - a;
+    if (x < 0.0f) a = (float)M_PI - a;
+    return (y < 0.0f) ? -a : a;
+}
+
+float euler_asinf(float x)
+{
+    // (1 - x)(1 + x) keeps its precision near +-1, where 1 - x * x doesn't
+    return euler_atan2f(x, sqrtf((1.0f - x) * (1.0f + x)));
+}
+
+void q_to_euler(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out)
+{
+    euler_args_t a;
+
+    euler_args(r, i, j, k, conv, &a);
+    out->yaw = euler_atan2f(a.yn, a.yd);
+    out->pitch = euler_asinf(a.p);
+    out->roll = euler_atan2f(a.rn, a.rd);
+}
+
+void q_to_euler_libm(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out)
+{
+    euler_args_t a;
+
+    euler_args(r, i, j, k, conv, &a);
+    out->yaw = (float)atan2((double)a.yn, (double)a.yd);
+    out->pitch = (float)asin((double)a.p);
+    out->roll = (float)atan2((double)a.rn, (double)a.rd);
+}
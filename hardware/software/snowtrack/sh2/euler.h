@@ -31,4 +31,39 @@ float q_to_roll(float r, float i, float j, float k);
 void q_to_ypr(float r, float i, float j, float k,
               float *pRoll, float *pPitch, float *pYaw);
 
+// Euler angle conventions used around the project. All are yaw, then pitch,
+// then roll, and differ in axes and signs.
+typedef enum {
+    // Yaw about z, pitch about y, roll about x (aerospace ZYX). The firmware's
+    // log and quaternion_to_euler() in Software/snowboard_wearable.py.
+    EULER_ZYX,
+    // q_to_ypr() above: yaw about z, pitch about x, roll about y.
+    EULER_CEVA,
+    // Diebel (2006) sequence (3, 2, 1), eqn. 452, for a quaternion taking
+    // world to body. quat_to_elev_azim_roll() in Software/plotter.py.
+    EULER_DIEBEL_321,
+} euler_convention_t;
+
+// Radians
+typedef struct {
+    float yaw;
+    float pitch;
+    float roll;
+} euler_angles_t;
+
+// Polynomial atan2 and asin in single precision, for targets where libm's
+// double versions are software emulated. Max error against double libm,
+// measured over their whole domain by tools/sh2_host/euler_bench:
+//   euler_atan2f  1.2e-5 rad
+//   euler_asinf   1.2e-5 rad
+float euler_atan2f(float y, float x);
+float euler_asinf(float x);
+
+// Quaternion to Euler angles with the fast kernels, max error 1.2e-5 rad per
+// angle for unit quaternions (pitch clamped to +-pi/2)
+void q_to_euler(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out);
+
+// The same with double precision libm, the reference for q_to_euler()
+void q_to_euler_libm(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out);
+
 #endif
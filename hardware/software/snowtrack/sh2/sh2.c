@@ -39,6 +39,7 @@
 #include "sh2_err.h"
 #include "shtp.h"
 #include "sh2_util.h"
+#include "sh2_reports.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -70,6 +71,25 @@
 // Max number of report ids supported
 #define SH2_MAX_REPORT_IDS (64)
 
+// Sensors whose sample clocks are modelled at once.  0 leaves sensor event
+// timestamps as the raw interrupt time adjusted by the hub's delays.
+#ifndef SH2_CLOCK_STREAMS
+#define SH2_CLOCK_STREAMS (8)
+#endif
+
+// Clock model gains: each sample moves the model 1/8 of the way to the raw
+// timestamp and the period 1/128 of the residual, which is close to
+// critically damped.  Residuals larger than a period (or the floor below)
+// are outliers; that many in a row restart the model.
+#define CLOCK_ALPHA_SHIFT (3)
+#define CLOCK_BETA_SHIFT (7)
+#define CLOCK_MIN_OUTLIER_US (2000)
+#define CLOCK_MAX_OUTLIERS (3)
+
+// Period estimates further than this off the configured interval are taken
+// to be the hub rounding the rate, not its clock drifting
+#define CLOCK_MAX_DRIFT_PPM (50000)
+
 #if defined(_MSC_VER)
 #define PACKED_STRUCT struct
 #pragma pack(push, 1)
@@ -81,6 +101,12 @@
 
 #define ADVERT_TIMEOUT_US (200000)
 
+// Time limit for operations that don't set their own. Without one, an op
+// whose response is lost would hold sh2 forever.
+#ifndef SH2_OP_TIMEOUT_US
+#define SH2_OP_TIMEOUT_US (5000000)
+#endif
+
 // Command and Subcommand values
 #define SH2_CMD_ERRORS                 1
 #define SH2_CMD_COUNTS                 2
@@ -196,12 +222,14 @@ typedef struct sh2_s sh2_t;
 typedef int (sh2_OpStart_t)(sh2_t *pSh2);
 typedef void (sh2_OpRx_t)(sh2_t *pSh2, const uint8_t *payload, uint16_t len);
 typedef void (sh2_OpReset_t)(sh2_t *pSh2);
+typedef void (sh2_OpDone_t)(sh2_t *pSh2, int status);
 
 typedef struct sh2_Op_s {
     uint32_t timeout_us;
     sh2_OpStart_t *start;
     sh2_OpRx_t *rx;
     sh2_OpReset_t *onReset;
+    sh2_OpDone_t *done;  // Post-processing once complete, before the caller hears
 } sh2_Op_t;
 
 // Parameters and state information for the operation in progress
@@ -227,6 +255,7 @@ typedef union {
         uint32_t *pData;
         uint16_t *pWords;
         uint16_t nextOffset;
+        sh2_SensorMetadata_t *pMetadata;
     } getFrs;
     struct {
         uint16_t frsType;
@@ -261,6 +290,7 @@ typedef union {
     } startCal;
     struct {
         sh2_CalStatus_t status;
+        sh2_CalStatus_t *pStatus;
     } finishCal;
     struct {
         uint8_t wheelIndex;
@@ -273,6 +303,27 @@ typedef union {
 // Max length of an FRS record, words.
 #define MAX_FRS_WORDS (72)
 
+// Sample clock of one sensor, times in microseconds Q16 on the host clock.
+// t follows the raw timestamps with an alpha-beta filter, so period tracks
+// the hub's oscillator against the host's and jitter in the raw timestamps
+// is smoothed out.
+typedef struct clockStream_s {
+    uint8_t sensorId;       // 0 if unused
+    bool started;
+    uint8_t lastSeq;
+    uint8_t runOutliers;
+    uint32_t nominal_us;    // Report interval last configured, 0 if unknown
+    int64_t t;              // Model time of the last sample
+    int64_t period;         // 0 until estimated
+    int64_t lastRaw;
+    uint64_t lastOut_us;
+    uint32_t lastUse;
+    uint32_t samples;
+    uint32_t outliers;
+    uint32_t resyncs;
+    uint32_t residualMax_us;
+} clockStream_t;
+
 struct sh2_s {
     // Pointer to the SHTP HAL
     sh2_Hal_t *pHal;
@@ -290,6 +341,17 @@ struct sh2_s {
     uint8_t lastCmdId;
     uint8_t cmdSeq;
     uint8_t nextCmdSeq;
+
+    // Non-blocking operation support. sh2_async() arms asyncNext so the next
+    // operation returns once started; sh2_service() then times it out.
+    bool asyncNext;
+    sh2_OpCallback_t *asyncCallback;
+    void *asyncCookie;
+    bool opAsync;
+    bool opStarting;
+    uint32_t opStart_us;
+    sh2_OpCallback_t *opCallback;
+    void *opCookie;
     
     // Event callback and it's cookie
     sh2_EventCallback_t *eventCallback;
@@ -299,6 +361,27 @@ struct sh2_s {
     sh2_SensorCallback_t *sensorCallback;
     void * sensorCookie;
 
+    // By-reference sensor callback, takes precedence when set
+    sh2_SensorRefCallback_t *sensorRefCallback;
+    void * sensorRefCookie;
+
+    // Batch sensor callback, takes precedence over both.  Reports of the
+    // payload being parsed collect in batch until it's flushed.
+    sh2_SensorBatchCallback_t *sensorBatchCallback;
+    void * sensorBatchCookie;
+    sh2_SensorEventRef_t batch[SH2_MAX_BATCH_EVENTS];
+    uint16_t batchLen;
+
+    // 64-bit extension of the HAL's timestamps
+    uint32_t lastHostInt;
+    uint32_t hostRollovers;
+
+#if SH2_CLOCK_STREAMS
+    // Sample clock models, see clockSample()
+    clockStream_t clock[SH2_CLOCK_STREAMS];
+    uint32_t clockTick;
+#endif
+
     // Storage space for reading sensor metadata
     uint32_t frsData[MAX_FRS_WORDS];
     uint16_t frsDataLen;
@@ -307,6 +390,9 @@ struct sh2_s {
     uint32_t execBadPayload;
     uint32_t emptyPayloads;
     uint32_t unknownReportIds;
+    uint32_t reports;
+    uint32_t eventCopyBytes;
+    uint32_t skippedReports;
 
 };
 
@@ -336,11 +422,6 @@ typedef PACKED_STRUCT {
     uint8_t sensorId;
 } ForceFlushResp_t;
 
-typedef struct sh2_ReportLen_s {
-    uint8_t id;
-    uint8_t len;
-} sh2_ReportLen_t;
-
 // SENSORHUB_FRS_WRITE_REQ
 #define SENSORHUB_FRS_WRITE_REQ      (0xF7)
 typedef PACKED_STRUCT {
@@ -431,59 +512,26 @@ sh2_t _sh2;
 // SH2 Async Event Message
 static sh2_AsyncEvent_t sh2AsyncEvent;
 
-// Lengths of reports by report id.
-static const sh2_ReportLen_t sh2ReportLens[] = {
+// Lengths of reports by report id, 0 for unknown ids. REPORT_SKIP marks
+// sensor reports that aren't built in (see sh2_reports.h).
+#define REPORT_SKIP (0x80)
+#define REPORT_LEN(x) ((x) & 0x7F)
+
+#define SENSOR_REPORT_LEN(name, len, decoder, member) \
+    [SH2_##name] = (len) | (SH2_REPORT_ENABLED(name) ? 0 : REPORT_SKIP),
+static const uint8_t sh2ReportLens[256] = {
     // Sensor reports
-    {.id = SH2_ACCELEROMETER,                .len = 10},  
-    {.id = SH2_GYROSCOPE_CALIBRATED,         .len = 10},
-    {.id = SH2_MAGNETIC_FIELD_CALIBRATED,    .len = 10},
-    {.id = SH2_LINEAR_ACCELERATION,          .len = 10},
-    {.id = SH2_ROTATION_VECTOR,              .len = 14},
-    {.id = SH2_GRAVITY,                      .len = 10},
-    {.id = SH2_GYROSCOPE_UNCALIBRATED,       .len = 16},
-    {.id = SH2_GAME_ROTATION_VECTOR,         .len = 12},
-    {.id = SH2_GEOMAGNETIC_ROTATION_VECTOR,  .len = 14},
-    {.id = SH2_PRESSURE,                     .len =  8},
-    {.id = SH2_AMBIENT_LIGHT,                .len =  8},
-    {.id = SH2_HUMIDITY,                     .len =  6},
-    {.id = SH2_PROXIMITY,                    .len =  6},
-    {.id = SH2_TEMPERATURE,                  .len =  6},
-    {.id = SH2_MAGNETIC_FIELD_UNCALIBRATED,  .len = 16},
-    {.id = SH2_TAP_DETECTOR,                 .len =  5},
-    {.id = SH2_STEP_COUNTER,                 .len = 12},
-    {.id = SH2_SIGNIFICANT_MOTION,           .len =  6},
-    {.id = SH2_STABILITY_CLASSIFIER,         .len =  6},
-    {.id = SH2_RAW_ACCELEROMETER,            .len = 16},
-    {.id = SH2_RAW_GYROSCOPE,                .len = 16},
-    {.id = SH2_RAW_MAGNETOMETER,             .len = 16},
-    {.id = SH2_STEP_DETECTOR,                .len =  8},
-    {.id = SH2_SHAKE_DETECTOR,               .len =  6},
-    {.id = SH2_FLIP_DETECTOR,                .len =  6},
-    {.id = SH2_PICKUP_DETECTOR,              .len =  8},
-    {.id = SH2_STABILITY_DETECTOR,           .len =  6},
-    {.id = SH2_PERSONAL_ACTIVITY_CLASSIFIER, .len = 16},
-    {.id = SH2_SLEEP_DETECTOR,               .len =  6},
-    {.id = SH2_TILT_DETECTOR,                .len =  6},
-    {.id = SH2_POCKET_DETECTOR,              .len =  6},
-    {.id = SH2_CIRCLE_DETECTOR,              .len =  6},
-    {.id = SH2_HEART_RATE_MONITOR,           .len =  6},
-    {.id = SH2_ARVR_STABILIZED_RV,           .len = 14},
-    {.id = SH2_ARVR_STABILIZED_GRV,          .len = 12},
-    {.id = SH2_GYRO_INTEGRATED_RV,           .len = 14},
-    {.id = SH2_IZRO_MOTION_REQUEST,          .len =  6},
-    {.id = SH2_RAW_OPTICAL_FLOW,             .len = 24},
-    {.id = SH2_DEAD_RECKONING_POSE,          .len = 60},
-    {.id = SH2_WHEEL_ENCODER,                .len = 12},
+    SH2_SENSOR_REPORTS(SENSOR_REPORT_LEN)
 
     // Other response types
-    {.id = SENSORHUB_FLUSH_COMPLETED,        .len =  2},
-    {.id = SENSORHUB_COMMAND_RESP,           .len = 16},
-    {.id = SENSORHUB_FRS_READ_RESP,          .len = 16},
-    {.id = SENSORHUB_FRS_WRITE_RESP,         .len =  4},
-    {.id = SENSORHUB_PROD_ID_RESP,           .len = 16},
-    {.id = SENSORHUB_TIMESTAMP_REBASE,       .len =  5},
-    {.id = SENSORHUB_BASE_TIMESTAMP_REF,     .len =  5},
-    {.id = SENSORHUB_GET_FEATURE_RESP,       .len = 17},
+    [SENSORHUB_FLUSH_COMPLETED]        =  2,
+    [SENSORHUB_COMMAND_RESP]           = 16,
+    [SENSORHUB_FRS_READ_RESP]          = 16,
+    [SENSORHUB_FRS_WRITE_RESP]         =  4,
+    [SENSORHUB_PROD_ID_RESP]           = 16,
+    [SENSORHUB_TIMESTAMP_REBASE]       =  5,
+    [SENSORHUB_BASE_TIMESTAMP_REF]     =  5,
+    [SENSORHUB_GET_FEATURE_RESP]       = 17,
 };
 
 // ------------------------------------------------------------------------
@@ -518,12 +566,33 @@ static void opRx(sh2_t *pSh2, const uint8_t *payload, uint16_t len)
 
 static int opCompleted(sh2_t *pSh2, int status)
 {
+    const sh2_Op_t *pOp = pSh2->pOp;
+
     // Record status
     pSh2->opStatus = status;
 
     // Signal that op is done.
     pSh2->pOp = 0;
 
+    if (pOp == 0) {
+        // Already completed, don't report it twice
+        return SH2_OK;
+    }
+    if (pOp->done != 0) {
+        pOp->done(pSh2, status);
+    }
+
+    // Non-blocking ops that finish inside their start method are reported by
+    // opProcess once start has returned.
+    if (pSh2->opAsync && !pSh2->opStarting) {
+        sh2_OpCallback_t *callback = pSh2->opCallback;
+        pSh2->opAsync = false;
+        pSh2->opCallback = 0;
+        if (callback != 0) {
+            callback(pSh2->opCookie, status);
+        }
+    }
+
     return SH2_OK;
 }
 
@@ -541,15 +610,9 @@ static void opOnReset(sh2_t *pSh2)
     }
 }
 
-static uint8_t getReportLen(uint8_t reportId)
+static inline uint8_t getReportLen(uint8_t reportId)
 {
-    for (unsigned n = 0; n < ARRAY_LEN(sh2ReportLens); n++) {
-        if (sh2ReportLens[n].id == reportId) {
-            return sh2ReportLens[n].len;
-        }
-    }
-
-    return 0;
+    return REPORT_LEN(sh2ReportLens[reportId]);
 }
 
 static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
@@ -577,7 +640,7 @@ static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, u
         if (reportLen == 0) {
             // An unrecognized report id
             pSh2->unknownReportIds++;
-            return;
+            break;
         }
         else {
             // Check for unsolicited initialize response
@@ -626,11 +689,65 @@ static void sensorhubControlHdlr(void *cookie, uint8_t *payload, uint16_t len, u
 }
 
 
+static uint32_t opTimeoutUs(const sh2_Op_t *pOp)
+{
+    return (pOp->timeout_us != 0) ? pOp->timeout_us : SH2_OP_TIMEOUT_US;
+}
+
+// An op rejected before opProcess still consumes sh2_async(), so its callback
+// can't fire for whatever op comes next
+static int opReject(sh2_t *pSh2, int status)
+{
+    pSh2->asyncNext = false;
+    return status;
+}
+
+// Start an op and leave it to sh2_service()
+static int opProcessAsync(sh2_t *pSh2, const sh2_Op_t *pOp)
+{
+    // Checked before the async state is touched, so the op in flight keeps
+    // its callback and timeout
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
+    pSh2->asyncNext = false;
+    pSh2->opAsync = true;
+    pSh2->opCallback = pSh2->asyncCallback;
+    pSh2->opCookie = pSh2->asyncCookie;
+    pSh2->opStart_us = pSh2->pHal->getTimeUs(pSh2->pHal);
+
+    pSh2->opStarting = true;
+    int status = opStart(pSh2, pOp);
+    pSh2->opStarting = false;
+
+    if (status != SH2_OK) {
+        // Reported through the return value only
+        pSh2->opAsync = false;
+        pSh2->opCallback = 0;
+        return status;
+    }
+
+    if (pSh2->pOp == 0 && pSh2->opAsync) {
+        // Finished inside start
+        sh2_OpCallback_t *callback = pSh2->opCallback;
+        pSh2->opAsync = false;
+        pSh2->opCallback = 0;
+        if (callback != 0) {
+            callback(pSh2->opCookie, pSh2->opStatus);
+        }
+    }
+
+    return SH2_OK;
+}
+
 static int opProcess(sh2_t *pSh2, const sh2_Op_t *pOp)
 {
     int status = SH2_OK;
     uint32_t start_us = 0;
 
+    if (pSh2->asyncNext) {
+        return opProcessAsync(pSh2, pOp);
+    }
+
     start_us = pSh2->pHal->getTimeUs(pSh2->pHal);
     
     status = opStart(pSh2, pOp);
@@ -641,8 +758,7 @@ static int opProcess(sh2_t *pSh2, const sh2_Op_t *pOp)
     uint32_t now_us = start_us;
     // While op not complete and not timed out.
     while ((pSh2->pOp != 0) &&
-           ((pOp->timeout_us == 0) ||
-            ((now_us-start_us) < pOp->timeout_us))) {
+           ((now_us-start_us) < opTimeoutUs(pOp))) {
 
         if (pSh2->pShtp == 0) {
             // Was SH2 interface closed unexpectedly?
@@ -666,23 +782,214 @@ static int opProcess(sh2_t *pSh2, const sh2_Op_t *pOp)
     return pSh2->opStatus;
 }
 
-// Produce 64-bit microsecond timestamp for a sensor event
-static uint64_t touSTimestamp(uint32_t hostInt, int32_t referenceDelta, uint16_t delay)
+// Extend a 32-bit HAL timestamp to 64 bits.  Payloads are handled in the
+// order they were read, so a timestamp going backwards means it wrapped.
+static uint64_t hostTimeUs(sh2_t *pSh2, uint32_t hostInt)
+{
+    if (hostInt < pSh2->lastHostInt) {
+        pSh2->hostRollovers++;
+    }
+    pSh2->lastHostInt = hostInt;
+
+    return ((uint64_t)pSh2->hostRollovers << 32) + hostInt;
+}
+
+#if SH2_CLOCK_STREAMS
+// Find the clock model for a sensor, taking over the least recently used one
+// if it has none
+static clockStream_t *clockStream(sh2_t *pSh2, uint8_t sensorId)
 {
-    static uint32_t lastHostInt = 0;
-    static uint32_t rollovers = 0;
-    uint64_t timestamp;
+    clockStream_t *oldest = &pSh2->clock[0];
 
-    // Count times hostInt timestamps rolled over to produce upper bits
-    if (hostInt < lastHostInt) {
-        rollovers++;
+    for (int n = 0; n < SH2_CLOCK_STREAMS; n++) {
+        clockStream_t *s = &pSh2->clock[n];
+        if (s->sensorId == sensorId) {
+            return s;
+        }
+        if (s->lastUse < oldest->lastUse) {
+            oldest = s;
+        }
     }
-    lastHostInt = hostInt;
-    
-    timestamp = ((uint64_t)rollovers << 32);
-    timestamp += hostInt + (referenceDelta + delay) * 100;
 
-    return timestamp;
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->sensorId = sensorId;
+    return oldest;
+}
+
+// Seed a sensor's model with the interval it was just configured for
+static void clockSetInterval(sh2_t *pSh2, uint8_t sensorId, uint32_t interval_us)
+{
+    if (interval_us == 0) {
+        return;
+    }
+
+    clockStream_t *s = clockStream(pSh2, sensorId);
+    s->lastUse = ++pSh2->clockTick;
+    if (s->nominal_us != interval_us) {
+        s->nominal_us = interval_us;
+        s->period = (int64_t)interval_us << 16;
+        s->started = false;
+    }
+}
+
+// Restart the models, keeping the configured intervals: timestamps from
+// before a hub reset don't carry over
+static void clockRestart(sh2_t *pSh2)
+{
+    for (int n = 0; n < SH2_CLOCK_STREAMS; n++) {
+        pSh2->clock[n].started = false;
+        pSh2->clock[n].period = (int64_t)pSh2->clock[n].nominal_us << 16;
+    }
+}
+
+// Timestamp a sample from the sensor's clock model.  offset_us is the
+// sample's time relative to host_us, the interrupt, as counted by the hub's
+// clock.  seq is the report's sequence number, or -1 for reports without
+// one, which are taken to be consecutive.  The result is monotonic per
+// sensor and moves at most max(period, CLOCK_MIN_OUTLIER_US) >>
+// CLOCK_ALPHA_SHIFT off the model's prediction for each sample.
+static uint64_t clockSample(sh2_t *pSh2, uint8_t sensorId, int seq, uint64_t host_us, int32_t offset_us)
+{
+    clockStream_t *s = clockStream(pSh2, sensorId);
+    int64_t offset = (int64_t)offset_us << 16;
+    int64_t n = 1;
+
+    // Hub ticks to host time, by the ratio of the estimated period to the
+    // configured one.  Matters for batches, which reach seconds back.
+    if (s->nominal_us != 0 && s->period != 0) {
+        int64_t nominal = (int64_t)s->nominal_us << 16;
+        int64_t drift_ppm = (s->period - nominal) * 1000000 / nominal;
+        if (drift_ppm < CLOCK_MAX_DRIFT_PPM && drift_ppm > -CLOCK_MAX_DRIFT_PPM) {
+            offset = (int64_t)offset_us * ((s->period << 16) / nominal);
+        }
+    }
+
+    int64_t raw = ((int64_t)host_us << 16) + offset;
+    if (raw < 0) {
+        raw = 0;
+    }
+
+    // Samples since the last one, counting those lost on the way
+    if (seq >= 0) {
+        n = (uint8_t)(seq - s->lastSeq);
+        if (n == 0) {
+            n = 1;
+        }
+        s->lastSeq = (uint8_t)seq;
+    }
+    s->lastUse = ++pSh2->clockTick;
+    s->samples++;
+
+    if (!s->started) {
+        s->started = true;
+        s->t = raw;
+    }
+    else if (s->period == 0) {
+        // First period estimate straight from two raw timestamps
+        if (raw > s->lastRaw) {
+            s->period = (raw - s->lastRaw) / n;
+        }
+        s->t = raw;
+    }
+    else {
+        int64_t pred = s->t + n * s->period;
+        int64_t r = raw - pred;
+        int64_t limit = s->period;
+        if (limit < ((int64_t)CLOCK_MIN_OUTLIER_US << 16)) {
+            limit = (int64_t)CLOCK_MIN_OUTLIER_US << 16;
+        }
+
+        uint32_t absR_us = (uint32_t)(((r < 0) ? -r : r) >> 16);
+        if (absR_us > s->residualMax_us) {
+            s->residualMax_us = absR_us;
+        }
+
+        if (r > limit || r < -limit) {
+            s->outliers++;
+            if (++s->runOutliers < CLOCK_MAX_OUTLIERS) {
+                // Coast on the prediction
+                s->t = pred;
+            }
+            else {
+                // Not noise: the rate changed or the hub restarted
+                s->resyncs++;
+                s->runOutliers = 0;
+                s->period = (int64_t)s->nominal_us << 16;
+                s->t = raw;
+            }
+        }
+        else {
+            s->runOutliers = 0;
+            s->t = pred + r / (1 << CLOCK_ALPHA_SHIFT);
+            s->period += r / (n << CLOCK_BETA_SHIFT);
+        }
+    }
+    s->lastRaw = raw;
+
+    uint64_t out_us = (uint64_t)(s->t + (1 << 15)) >> 16;
+    if (s->samples > 1 && out_us <= s->lastOut_us) {
+        out_us = s->lastOut_us + 1;
+    }
+    s->lastOut_us = out_us;
+
+    return out_us;
+}
+#endif
+
+// Sample period of a sensor as the clock model sees it, 0 if unknown
+static uint32_t samplePeriodUs(sh2_t *pSh2, uint8_t sensorId)
+{
+#if SH2_CLOCK_STREAMS
+    clockStream_t *s = clockStream(pSh2, sensorId);
+    if (s->period > 0) {
+        return (uint32_t)((s->period + (1 << 15)) >> 16);
+    }
+    return s->nominal_us;
+#else
+    (void)pSh2;
+    (void)sensorId;
+    return 0;
+#endif
+}
+
+// Timestamp for a sensor event offset_us (hub clock) from the interrupt
+static uint64_t sampleTimestamp(sh2_t *pSh2, uint8_t sensorId, int seq, uint64_t host_us, int32_t offset_us)
+{
+#if SH2_CLOCK_STREAMS
+    return clockSample(pSh2, sensorId, seq, host_us, offset_us);
+#else
+    (void)pSh2;
+    (void)sensorId;
+    (void)seq;
+    int64_t t = (int64_t)host_us + offset_us;
+    return (t > 0) ? (uint64_t)t : 0;
+#endif
+}
+
+// Hand the collected batch to the batch callback
+static void flushBatch(sh2_t *pSh2)
+{
+    if (pSh2->batchLen != 0) {
+        pSh2->sensorBatchCallback(pSh2->sensorBatchCookie, pSh2->batch, pSh2->batchLen);
+        pSh2->batchLen = 0;
+    }
+}
+
+// Add a report to the batch, flushing it if full
+static void batchReport(sh2_t *pSh2, uint8_t reportId, const uint8_t *pReport, uint8_t reportLen,
+                        uint64_t timestamp_uS, int64_t delay_uS)
+{
+    sh2_SensorEventRef_t *ref = &pSh2->batch[pSh2->batchLen++];
+
+    ref->timestamp_uS = timestamp_uS;
+    ref->delay_uS = delay_uS;
+    ref->reportId = reportId;
+    ref->report = pReport;
+    ref->len = reportLen;
+
+    if (pSh2->batchLen == SH2_MAX_BATCH_EVENTS) {
+        flushBatch(pSh2);
+    }
 }
 
 static void sensorhubInputHdlr(sh2_t *pSh2, uint8_t *payload, uint16_t len, uint32_t timestamp)
@@ -691,6 +998,7 @@ static void sensorhubInputHdlr(sh2_t *pSh2, uint8_t *payload, uint16_t len, uint
     uint16_t cursor = 0;
 
     int32_t referenceDelta = 0;
+    uint64_t host_us = hostTimeUs(pSh2, timestamp);
 
     while (cursor < len) {
         // Get next report id
@@ -701,7 +1009,7 @@ static void sensorhubInputHdlr(sh2_t *pSh2, uint8_t *payload, uint16_t len, uint
         if (reportLen == 0) {
             // An unrecognized report id
             pSh2->unknownReportIds++;
-            return;
+            break;
         }
         else {
             if (reportId == SENSORHUB_BASE_TIMESTAMP_REF) {
@@ -716,20 +1024,49 @@ static void sensorhubInputHdlr(sh2_t *pSh2, uint8_t *payload, uint16_t len, uint
                 referenceDelta += rpt->timebase;
             }
             else if (reportId == SENSORHUB_FLUSH_COMPLETED) {
+                // Deliver the reports that preceded it first
+                if (pSh2->sensorBatchCallback != 0) {
+                    flushBatch(pSh2);
+                }
                 // Route this as if it arrived on command channel.
                 opRx(pSh2, payload+cursor, reportLen);
             }
+            else if (sh2ReportLens[reportId] & REPORT_SKIP) {
+                // Sensor not built in
+                pSh2->skippedReports++;
+            }
             else {
                 // Sensor event.  Call callback
                 uint8_t *pReport = payload+cursor;
                 uint16_t delay = ((pReport[2] & 0xFC) << 6) + pReport[3];
-                event.timestamp_uS = touSTimestamp(timestamp, referenceDelta, delay);
-                event.delay_uS = (referenceDelta + delay) * 100;
-                event.reportId = reportId;
-                memcpy(event.report, pReport, reportLen);
-                event.len = reportLen;
-                if (pSh2->sensorCallback != 0) {
-                    pSh2->sensorCallback(pSh2->sensorCookie, &event);
+                // Delays are in 100us units
+                uint64_t sample_us = sampleTimestamp(pSh2, reportId, pReport[1], host_us,
+                                                     (referenceDelta + delay) * 100);
+                pSh2->reports++;
+                if (pSh2->sensorBatchCallback != 0) {
+                    batchReport(pSh2, reportId, pReport, reportLen,
+                                sample_us, (referenceDelta + delay) * 100);
+                }
+                else if (pSh2->sensorRefCallback != 0) {
+                    // Hand over the report where it lies
+                    sh2_SensorEventRef_t ref;
+                    ref.timestamp_uS = sample_us;
+                    ref.delay_uS = (referenceDelta + delay) * 100;
+                    ref.reportId = reportId;
+                    ref.report = pReport;
+                    ref.len = reportLen;
+                    pSh2->sensorRefCallback(pSh2->sensorRefCookie, &ref);
+                }
+                else {
+                    event.timestamp_uS = sample_us;
+                    event.delay_uS = (referenceDelta + delay) * 100;
+                    event.reportId = reportId;
+                    memcpy(event.report, pReport, reportLen);
+                    pSh2->eventCopyBytes += reportLen;
+                    event.len = reportLen;
+                    if (pSh2->sensorCallback != 0) {
+                        pSh2->sensorCallback(pSh2->sensorCookie, &event);
+                    }
                 }
             }
             
@@ -737,6 +1074,10 @@ static void sensorhubInputHdlr(sh2_t *pSh2, uint8_t *payload, uint16_t len, uint
             cursor += reportLen;
         }
     }
+
+    if (pSh2->sensorBatchCallback != 0) {
+        flushBatch(pSh2);
+    }
 }
 
 static void sensorhubInputNormalHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
@@ -762,18 +1103,57 @@ static void sensorhubInputGyroRvHdlr(void *cookie, uint8_t *payload, uint16_t le
     uint8_t reportId = SH2_GYRO_INTEGRATED_RV;
     uint8_t reportLen = getReportLen(reportId);
 
+    if (sh2ReportLens[reportId] & REPORT_SKIP) {
+        // Sensor not built in
+        pSh2->skippedReports += len / reportLen;
+        return;
+    }
+
+    uint64_t host_us = hostTimeUs(pSh2, timestamp);
+
+    // No delay or sequence number in these. The last report of the payload
+    // is the one the interrupt was for, the others came a period apart
+    // before it.
+    uint32_t period_us = samplePeriodUs(pSh2, reportId);
+    int32_t older = (int32_t)(len / reportLen) - 1;
+
     while (cursor < len) {
-        event.timestamp_uS = timestamp;
-        event.reportId = reportId;
-        memcpy(event.report, payload+cursor, reportLen);
-        event.len = reportLen;
+        int32_t offset_us = -older * (int32_t)period_us;
+        uint64_t sample_us = sampleTimestamp(pSh2, reportId, -1, host_us, offset_us);
+        older--;
 
-        if (pSh2->sensorCallback != 0) {
-            pSh2->sensorCallback(pSh2->sensorCookie, &event);
+        pSh2->reports++;
+        if (pSh2->sensorBatchCallback != 0) {
+            batchReport(pSh2, reportId, payload+cursor, reportLen, sample_us, 0);
+        }
+        else if (pSh2->sensorRefCallback != 0) {
+            sh2_SensorEventRef_t ref;
+            ref.timestamp_uS = sample_us;
+            ref.delay_uS = 0;
+            ref.reportId = reportId;
+            ref.report = payload+cursor;
+            ref.len = reportLen;
+            pSh2->sensorRefCallback(pSh2->sensorRefCookie, &ref);
+        }
+        else {
+            event.timestamp_uS = sample_us;
+            event.delay_uS = 0;
+            event.reportId = reportId;
+            memcpy(event.report, payload+cursor, reportLen);
+            pSh2->eventCopyBytes += reportLen;
+            event.len = reportLen;
+
+            if (pSh2->sensorCallback != 0) {
+                pSh2->sensorCallback(pSh2->sensorCookie, &event);
+            }
         }
 
         cursor += reportLen;
     }
+
+    if (pSh2->sensorBatchCallback != 0) {
+        flushBatch(pSh2);
+    }
 }
 
 static void executableDeviceHdlr(void *cookie, uint8_t *payload, uint16_t len, uint32_t timestamp)
@@ -792,6 +1172,9 @@ static void executableDeviceHdlr(void *cookie, uint8_t *payload, uint16_t len, u
         case EXECUTABLE_DEVICE_RESP_RESET_COMPLETE:
             // reset process is now done.
             pSh2->resetComplete = true;
+#if SH2_CLOCK_STREAMS
+            clockRestart(pSh2);
+#endif
             
             // Send reset event to SH2 operation processor.
             // Some commands may handle themselves.  Most will be aborted with SH2_ERR.
@@ -1202,6 +1585,19 @@ static void stuffMetadata(sh2_SensorMetadata_t *pData, uint32_t *frsData)
            pData->vendorIdLen);
 }
 
+static void getMetadataDone(sh2_t *pSh2, int status)
+{
+    if (status == SH2_OK) {
+        stuffMetadata(pSh2->opData.getFrs.pMetadata, pSh2->frsData);
+    }
+}
+
+const sh2_Op_t getMetadataOp = {
+    .start = getFrsStart,
+    .rx = getFrsRx,
+    .done = getMetadataDone,
+};
+
 // ------------------------------------------------------------------------
 // Set FRS.
 
@@ -1774,6 +2170,9 @@ static void finishCalRx(sh2_t *pSh2, const uint8_t *payload, uint16_t len)
     if (wrongResponse(pSh2, resp)) return;
 
     pSh2->opData.finishCal.status = (sh2_CalStatus_t)resp->r[1];
+    if (pSh2->opData.finishCal.pStatus != 0) {
+        *pSh2->opData.finishCal.pStatus = pSh2->opData.finishCal.status;
+    }
 
     // Complete this operation
     if (pSh2->opData.finishCal.status == SH2_CAL_SUCCESS) {
@@ -1913,6 +2312,9 @@ void sh2_close(void)
 {
     sh2_t *pSh2 = &_sh2;
     
+    // A pending non-blocking op won't complete now
+    opCompleted(pSh2, SH2_ERR);
+
     if (pSh2->pShtp != 0) {
         shtp_close(pSh2->pShtp);
     }
@@ -1933,6 +2335,88 @@ void sh2_service(void)
     if (pSh2->pShtp != 0) {
         shtp_service(pSh2->pShtp);
     }
+
+    // Time out a non-blocking operation
+    if (pSh2->opAsync && pSh2->pOp != 0 &&
+        (pSh2->pHal->getTimeUs(pSh2->pHal) - pSh2->opStart_us) >= opTimeoutUs(pSh2->pOp)) {
+        opCompleted(pSh2, SH2_ERR_TIMEOUT);
+    }
+}
+
+/**
+ * @brief Make the next operation non-blocking.
+ *
+ * Only the next operation call: if it fails before starting, its error is
+ * returned and callback is never called.
+ *
+ * @param  callback Called from sh2_service() with the operation's final status, or 0 to poll.
+ * @param  cookie A value that will be passed to callback.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_async(sh2_OpCallback_t *callback, void *cookie)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    if (pSh2->pShtp == 0) {
+        return SH2_ERR;  // sh2 API isn't open
+    }
+
+    pSh2->asyncNext = true;
+    pSh2->asyncCallback = callback;
+    pSh2->asyncCookie = cookie;
+
+    return SH2_OK;
+}
+
+/**
+ * @brief Status of the most recent operation.
+ *
+ * @return SH2_ERR_OP_IN_PROGRESS while it runs, then its final status.
+ */
+int sh2_opStatus(void)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    if (pSh2->pOp != 0) {
+        return SH2_ERR_OP_IN_PROGRESS;
+    }
+
+    return pSh2->opStatus;
+}
+
+/**
+ * @brief Hand HAL reads to a separate producer through the SHTP receive ring.
+ *
+ * @param  enable true to have sh2_service() drain the ring, false to read the HAL directly.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setRxRing(bool enable)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    if (pSh2->pShtp == 0) {
+        return SH2_ERR;
+    }
+
+    return shtp_setRxRing(pSh2->pShtp, enable);
+}
+
+/**
+ * @brief Read one transfer from the HAL into the receive ring.
+ *
+ * Producer side of sh2_service() when the receive ring is enabled.
+ *
+ * @return Transfer length, 0 if nothing was read, negative value from sh2_err.h on error.
+ */
+int sh2_pump(void)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    if (pSh2->pShtp == 0) {
+        return SH2_ERR;
+    }
+
+    return shtp_pump(pSh2->pShtp);
 }
 
 /**
@@ -1952,6 +2436,129 @@ int sh2_setSensorCallback(sh2_SensorCallback_t *callback, void *cookie)
     return SH2_OK;
 }
 
+/**
+ * @brief Register a function to receive sensor events by reference.
+ *
+ * @param  callback A function that will be called each time a sensor event is received, or 0.
+ * @param  cookie  A value that will be passed to the sensor callback function.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setSensorRefCallback(sh2_SensorRefCallback_t *callback, void *cookie)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    pSh2->sensorRefCallback = callback;
+    pSh2->sensorRefCookie = cookie;
+
+    return SH2_OK;
+}
+
+/**
+ * @brief Register a function to receive all the sensor events of a payload at once.
+ *
+ * @param  callback A function that will be called with each payload's sensor events, or 0.
+ * @param  cookie  A value that will be passed to the sensor callback function.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setSensorBatchCallback(sh2_SensorBatchCallback_t *callback, void *cookie)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    pSh2->sensorBatchCallback = callback;
+    pSh2->sensorBatchCookie = cookie;
+    pSh2->batchLen = 0;
+
+    return SH2_OK;
+}
+
+/**
+ * @brief Get receive path copy statistics.
+ *
+ * @param  stats Filled in with counts since sh2_open().
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_getRxStats(sh2_RxStats_t *stats)
+{
+    sh2_t *pSh2 = &_sh2;
+
+    if (pSh2->pShtp == 0) {
+        return SH2_ERR;
+    }
+
+    shtp_getRxStats(pSh2->pShtp, &stats->payloads, &stats->zeroCopyPayloads, &stats->shtpCopyBytes);
+    stats->reports = pSh2->reports;
+    stats->eventCopyBytes = pSh2->eventCopyBytes;
+
+    return SH2_OK;
+}
+
+/**
+ * @brief Snapshot transport and decoder counters.
+ *
+ * @param  metrics Filled in with counts since sh2_open().
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_getMetrics(sh2_Metrics_t *metrics)
+{
+    sh2_t *pSh2 = &_sh2;
+    void *pShtp = pSh2->pShtp;
+
+    if (pShtp == 0) {
+        return SH2_ERR;
+    }
+
+    shtp_getMetrics(pShtp, &metrics->shtp);
+    metrics->reports = pSh2->reports;
+    metrics->eventCopyBytes = pSh2->eventCopyBytes;
+    metrics->execBadPayload = pSh2->execBadPayload;
+    metrics->emptyPayloads = pSh2->emptyPayloads;
+    metrics->unknownReportIds = pSh2->unknownReportIds;
+    metrics->skippedReports = pSh2->skippedReports;
+
+    return SH2_OK;
+}
+
+/**
+ * @brief Get the sample clock model of a sensor.
+ *
+ * @param  sensorId Which sensor.
+ * @param  model Filled in with the model's state.
+ * @return SH2_OK (0), on success.  SH2_ERR_BAD_PARAM if the sensor isn't modelled.
+ */
+int sh2_getClockModel(uint8_t sensorId, sh2_ClockModel_t *model)
+{
+#if SH2_CLOCK_STREAMS
+    sh2_t *pSh2 = &_sh2;
+
+    for (int n = 0; n < SH2_CLOCK_STREAMS; n++) {
+        clockStream_t *s = &pSh2->clock[n];
+        if (s->sensorId != sensorId || sensorId == 0) {
+            continue;
+        }
+
+        int64_t nominal = (int64_t)s->nominal_us << 16;
+        model->sensorId = sensorId;
+        model->samples = s->samples;
+        model->nominal_us = s->nominal_us;
+        model->period_ns = (uint32_t)((s->period * 1000) >> 16);
+        model->drift_ppm = (nominal != 0 && s->period != 0)
+            ? (int32_t)((s->period - nominal) * 1000000 / nominal) : 0;
+        model->residualMax_us = s->residualMax_us;
+        model->outliers = s->outliers;
+        model->resyncs = s->resyncs;
+        model->timestamp_us = s->lastOut_us;
+
+        s->residualMax_us = 0;
+        return SH2_OK;
+    }
+#else
+    (void)sensorId;
+    (void)model;
+#endif
+
+    return SH2_ERR_BAD_PARAM;
+}
+
 /**
  * @brief Reset the sensor hub device by sending RESET (1) command on "device" channel.
  *
@@ -2011,9 +2618,12 @@ int sh2_getProdIds(sh2_ProductIds_t *prodIds)
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2034,9 +2644,12 @@ int sh2_getSensorConfig(sh2_SensorId_t sensorId, sh2_SensorConfig_t *pConfig)
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2059,9 +2672,12 @@ int sh2_setSensorConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConf
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
  
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2069,6 +2685,10 @@ int sh2_setSensorConfig(sh2_SensorId_t sensorId, const sh2_SensorConfig_t *pConf
     pSh2->opData.setSensorConfig.sensorId = sensorId;
     pSh2->opData.setSensorConfig.pConfig = pConfig;
 
+#if SH2_CLOCK_STREAMS
+    clockSetInterval(pSh2, sensorId, pConfig->reportInterval_us);
+#endif
+
     return opProcess(pSh2, &setSensorConfigOp);
 }
 
@@ -2084,11 +2704,11 @@ int sh2_getMetadata(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData)
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
     // pData must be non-null
-    if (pData == 0) return SH2_ERR_BAD_PARAM;
+    if (pData == 0) return opReject(pSh2, SH2_ERR_BAD_PARAM);
   
     // Convert sensorId to metadata recordId
     unsigned i;
@@ -2099,10 +2719,13 @@ int sh2_getMetadata(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData)
     }
     if (i >= ARRAY_LEN(sensorToRecordMap)) {
         // no match was found
-        return SH2_ERR_BAD_PARAM;
+        return opReject(pSh2, SH2_ERR_BAD_PARAM);
     }
     uint16_t recordId = sensorToRecordMap[i].recordId;
     
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2111,16 +2734,10 @@ int sh2_getMetadata(sh2_SensorId_t sensorId, sh2_SensorMetadata_t *pData)
     pSh2->opData.getFrs.pData = pSh2->frsData;
     pSh2->frsDataLen = ARRAY_LEN(pSh2->frsData);
     pSh2->opData.getFrs.pWords = &pSh2->frsDataLen;
+    pSh2->opData.getFrs.pMetadata = pData;
 
-    // Read an FRS record
-    int status = opProcess(pSh2, &getFrsOp);
-    
-    // Copy the results into pData
-    if (status == SH2_OK) {
-        stuffMetadata(pData, pSh2->frsData);
-    }
-
-    return status;
+    // Read an FRS record, getMetadataDone copies the results into pData
+    return opProcess(pSh2, &getMetadataOp);
 }
 
 /**
@@ -2137,13 +2754,16 @@ int sh2_getFrs(uint16_t recordId, uint32_t *pData, uint16_t *words)
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
     if ((pData == 0) || (words == 0)) {
-        return SH2_ERR_BAD_PARAM;
+        return opReject(pSh2, SH2_ERR_BAD_PARAM);
     }
     
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2168,13 +2788,16 @@ int sh2_setFrs(uint16_t recordId, uint32_t *pData, uint16_t words)
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
     if ((pData == 0) && (words != 0)) {
-        return SH2_ERR_BAD_PARAM;
+        return opReject(pSh2, SH2_ERR_BAD_PARAM);
     }
     
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2198,9 +2821,12 @@ int sh2_getErrors(uint8_t severity, sh2_ErrorRecord_t *pErrors, uint16_t *numErr
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2223,9 +2849,12 @@ int sh2_getCounts(sh2_SensorId_t sensorId, sh2_Counts_t *pCounts)
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2246,9 +2875,12 @@ int sh2_clearCounts(sh2_SensorId_t sensorId)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2273,9 +2905,12 @@ int sh2_setTareNow(uint8_t axes,    // SH2_TARE_X | SH2_TARE_Y | SH2_TARE_Z
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2298,9 +2933,12 @@ int sh2_clearTare(void)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2321,9 +2959,12 @@ int sh2_persistTare(void)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2345,9 +2986,12 @@ int sh2_setReorientation(sh2_Quaternion_t *orientation)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2377,8 +3021,9 @@ int sh2_reinitialize(void)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
 
     return opProcess(pSh2, &reinitOp);
 }
@@ -2393,8 +3038,9 @@ int sh2_saveDcdNow(void)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
 
     return opProcess(pSh2, &saveDcdNowOp);
 }
@@ -2410,9 +3056,12 @@ int sh2_getOscType(sh2_OscType_t *pOscType)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     pSh2->opData.getOscType.pOscType = pOscType;
 
     return opProcess(pSh2, &getOscTypeOp);
@@ -2429,9 +3078,12 @@ int sh2_setCalConfig(uint8_t sensors)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     pSh2->opData.calConfig.sensors = sensors;
 
     return opProcess(pSh2, &setCalConfigOp);
@@ -2448,9 +3100,12 @@ int sh2_getCalConfig(uint8_t *pSensors)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     pSh2->opData.getCalConfig.pSensors = pSensors;
 
     return opProcess(pSh2, &getCalConfigOp);
@@ -2467,9 +3122,12 @@ int sh2_setDcdAutoSave(bool enabled)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2490,9 +3148,12 @@ int sh2_flush(sh2_SensorId_t sensorId)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2511,8 +3172,9 @@ int sh2_clearDcdAndReset(void)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
 
     return opProcess(pSh2, &clearDcdAndResetOp);
 }
@@ -2528,9 +3190,12 @@ int sh2_startCal(uint32_t interval_us)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
@@ -2550,18 +3215,18 @@ int sh2_finishCal(sh2_CalStatus_t *status)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     
-    int retval = opProcess(pSh2, &finishCalOp);
-    if (status != NULL) {
-        *status = pSh2->opData.finishCal.status;
-    }
+    pSh2->opData.finishCal.pStatus = status;
 
-    return retval;
+    return opProcess(pSh2, &finishCalOp);
 }
 
 /**
@@ -2575,9 +3240,12 @@ int sh2_setIZro(sh2_IZroMotionIntent_t intent)
     sh2_t *pSh2 = &_sh2;
 
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     // clear opData
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
 
@@ -2594,11 +3262,12 @@ int sh2_reportWheelEncoder(uint8_t wheelIndex, uint32_t timestamp, int16_t wheel
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
-    //No callback (am i doing this right?)
-    pSh2->pOp = 0;
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     pSh2->opData.wheelRequest.wheelIndex = wheelIndex;
     pSh2->opData.wheelRequest.timestamp = timestamp;
@@ -2612,9 +3281,12 @@ int sh2_saveDeadReckoningCalNow(void){
     sh2_t *pSh2 = &_sh2;
     
     if (pSh2->pShtp == 0) {
-        return SH2_ERR;  // sh2 API isn't open
+        return opReject(pSh2, SH2_ERR);  // sh2 API isn't open
     }
 
+    // opData belongs to the operation in progress, if any
+    if (pSh2->pOp != 0) return opReject(pSh2, SH2_ERR_OP_IN_PROGRESS);
+
     memset(&pSh2->opData, 0, sizeof(sh2_OpData_t));
     pSh2->opData.sendCmd.req.command = SH2_CMD_DR_CAL_SAVE;
 
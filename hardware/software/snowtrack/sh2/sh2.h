@@ -31,6 +31,7 @@
 #include <stdbool.h>
 
 #include "sh2_hal.h"
+#include "shtp.h"
 
 /***************************************************************************************
  * Public type definitions
@@ -52,6 +53,81 @@ typedef struct sh2_SensorEvent {
 
 typedef void (sh2_SensorCallback_t)(void * cookie, sh2_SensorEvent_t *pEvent);
 
+/**
+ * @brief Sensor Event, by reference
+ *
+ * As sh2_SensorEvent_t, but report points into the receive buffer instead of
+ * holding a copy.  It is only valid until the callback returns.
+ */
+typedef struct sh2_SensorEventRef {
+    uint64_t timestamp_uS;
+    int64_t delay_uS;
+    uint8_t len;
+    uint8_t reportId;
+    const uint8_t *report;
+} sh2_SensorEventRef_t;
+
+typedef void (sh2_SensorRefCallback_t)(void * cookie, const sh2_SensorEventRef_t *pEvent);
+
+/**
+ * @brief Sensor events from one payload, by reference
+ *
+ * events holds count reports in the order they arrived.  Like
+ * sh2_SensorEventRef_t, the array and the reports it points to are only valid
+ * until the callback returns.  A payload with more than SH2_MAX_BATCH_EVENTS
+ * reports is delivered in several batches.
+ */
+#define SH2_MAX_BATCH_EVENTS (32)
+typedef void (sh2_SensorBatchCallback_t)(void * cookie, const sh2_SensorEventRef_t *events, uint16_t count);
+
+/**
+ * @brief Completion of a non-blocking operation, see sh2_async()
+ */
+typedef void (sh2_OpCallback_t)(void * cookie, int status);
+
+/**
+ * @brief Receive path copy accounting
+ */
+typedef struct sh2_RxStats {
+    uint32_t payloads;          /**< Payloads delivered by SHTP */
+    uint32_t zeroCopyPayloads;  /**< Of which handed over straight from the transfer buffer */
+    uint32_t shtpCopyBytes;     /**< Bytes SHTP copied while assembling payloads */
+    uint32_t reports;           /**< Sensor events delivered */
+    uint32_t eventCopyBytes;    /**< Bytes copied into sh2_SensorEvent_t */
+} sh2_RxStats_t;
+
+/**
+ * @brief Transport and decoder counters
+ */
+typedef struct sh2_Metrics {
+    shtp_Metrics_t shtp;        /**< SHTP transport counters, per channel and overall */
+    uint32_t reports;           /**< Sensor events delivered */
+    uint32_t eventCopyBytes;    /**< Bytes copied into sh2_SensorEvent_t */
+    uint32_t execBadPayload;    /**< Executable channel payloads that couldn't be parsed */
+    uint32_t emptyPayloads;     /**< Sensorhub payloads with no reports in them */
+    uint32_t unknownReportIds;  /**< Reports dropped for an unrecognized id */
+    uint32_t skippedReports;    /**< Reports from sensors left out of the build (sh2_reports.h) */
+} sh2_Metrics_t;
+
+/**
+ * @brief Sample clock model of one sensor
+ *
+ * Sensor event timestamps are taken from a per-sensor model of the hub's
+ * sample clock, fitted to the interrupt time and the hub's timebase and delay
+ * fields, rather than used raw.
+ */
+typedef struct sh2_ClockModel {
+    uint8_t sensorId;
+    uint32_t samples;           /**< Samples timestamped */
+    uint32_t nominal_us;        /**< Report interval configured through sh2_setSensorConfig(), 0 if unknown */
+    uint32_t period_ns;         /**< Estimated sample period on the host clock */
+    int32_t drift_ppm;          /**< period_ns against nominal_us: hub clock error plus the hub's rate rounding */
+    uint32_t residualMax_us;    /**< Largest raw timestamp error seen since the previous call */
+    uint32_t outliers;          /**< Raw timestamps too far off to use */
+    uint32_t resyncs;           /**< Times the model restarted from a raw timestamp */
+    uint64_t timestamp_us;      /**< Timestamp of the latest sample */
+} sh2_ClockModel_t;
+
 /**
  * @brief Product Id value
  *
@@ -480,6 +556,27 @@ void sh2_close(void);
  */
 void sh2_service(void);
 
+/**
+ * @brief Hand HAL reads to a separate producer through the SHTP receive ring.
+ *
+ * Requires SHTP built with SHTP_RX_RING_SLOTS.  Once enabled, sh2_service()
+ * dispatches transfers that sh2_pump() has read, and never reads the HAL itself.
+ *
+ * @param  enable true to have sh2_service() drain the ring, false to read the HAL directly.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setRxRing(bool enable);
+
+/**
+ * @brief Read one transfer from the HAL into the receive ring.
+ *
+ * Producer side of sh2_service() when the receive ring is enabled.  May be called
+ * from a different thread or core than sh2_service().
+ *
+ * @return Transfer length, 0 if nothing was read, SH2_ERR_OP_IN_PROGRESS if the ring is full.
+ */
+int sh2_pump(void);
+
 /**
  * @brief Register a function to receive sensor events.
  *
@@ -489,6 +586,89 @@ void sh2_service(void);
  */
 int sh2_setSensorCallback(sh2_SensorCallback_t *callback, void *cookie);
 
+/**
+ * @brief Register a function to receive sensor events by reference.
+ *
+ * Sensor reports are passed to the callback in place, without being copied into
+ * an sh2_SensorEvent_t.  Decode them with sh2_decodeSensorEventRef() before
+ * returning.  While set, this replaces the callback from sh2_setSensorCallback().
+ *
+ * @param  callback A function that will be called each time a sensor event is received, or 0.
+ * @param  cookie  A value that will be passed to the sensor callback function.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setSensorRefCallback(sh2_SensorRefCallback_t *callback, void *cookie);
+
+/**
+ * @brief Register a function to receive all the sensor events of a payload at once.
+ *
+ * The reports of each payload are collected by reference and passed to the
+ * callback together, one call per payload instead of one per report.  Decode
+ * them with sh2_decodeSensorBatch() before returning.  While set, this replaces
+ * the callbacks from sh2_setSensorCallback() and sh2_setSensorRefCallback().
+ *
+ * @param  callback A function that will be called with each payload's sensor events, or 0.
+ * @param  cookie  A value that will be passed to the sensor callback function.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_setSensorBatchCallback(sh2_SensorBatchCallback_t *callback, void *cookie);
+
+/**
+ * @brief Get the sample clock model of a sensor.
+ *
+ * Reading it clears residualMax_us.
+ *
+ * @param  sensorId Which sensor.
+ * @param  model Filled in with the model's state.
+ * @return SH2_OK (0), on success.  SH2_ERR_BAD_PARAM if the sensor isn't modelled.
+ */
+int sh2_getClockModel(uint8_t sensorId, sh2_ClockModel_t *model);
+
+/**
+ * @brief Get receive path copy statistics.
+ *
+ * @param  stats Filled in with counts since sh2_open().
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_getRxStats(sh2_RxStats_t *stats);
+
+/**
+ * @brief Snapshot transport and decoder counters.
+ *
+ * May be called from a task other than the one servicing sh2.  Each counter
+ * is read whole but the snapshot isn't taken atomically.
+ *
+ * @param  metrics Filled in with counts since sh2_open().
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_getMetrics(sh2_Metrics_t *metrics);
+
+/**
+ * @brief Make the next operation non-blocking.
+ *
+ * The next call to an operation (sh2_getProdIds(), sh2_setSensorConfig(),
+ * sh2_getFrs(), sh2_setTareNow(), ...) returns as soon as its request is queued.
+ * sh2_service() then carries it to completion and calls callback with the
+ * final status, sensor events flowing as usual meanwhile.  If the call itself
+ * returns an error the callback isn't made.  An operation still running after
+ * its time limit (SH2_OP_TIMEOUT_US unless it sets its own) completes with
+ * SH2_ERR_TIMEOUT.  Buffers passed to the operation must stay valid until it
+ * completes.  Only one operation runs at a time; others return
+ * SH2_ERR_OP_IN_PROGRESS until it's done.
+ *
+ * @param  callback Called with the operation's status, or 0 to poll sh2_opStatus().
+ * @param  cookie A value that will be passed to callback.
+ * @return SH2_OK (0), on success.  Negative value from sh2_err.h on error.
+ */
+int sh2_async(sh2_OpCallback_t *callback, void *cookie);
+
+/**
+ * @brief Status of the most recent operation.
+ *
+ * @return SH2_ERR_OP_IN_PROGRESS while it runs, then its final status.
+ */
+int sh2_opStatus(void);
+
 /**
  * @brief Reset the sensor hub device by sending RESET (1) command on "device" channel.
  *
@@ -22,6 +22,7 @@
 #include "sh2_SensorValue.h"
 #include "sh2_err.h"
 #include "sh2_util.h"
+#include "sh2_reports.h"
 
 #include <stdio.h>
 
@@ -32,582 +33,463 @@ const float scaleRadToDeg = 180.0f / 3.14159265358f;
 // ------------------------------------------------------------------------
 // Forward declarations
 
-static int decodeRawAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeLinearAcceleration(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGravity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRawGyroscope(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGyroscopeCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGyroscopeUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRawMagnetometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeMagneticFieldCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeMagneticFieldUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGameRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGeomagneticRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePressure(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeAmbientLight(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeHumidity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeProximity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeTemperature(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeReserved(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeTapDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStepCounter(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeSignificantMotion(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStabilityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeShakeDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeFlipDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePickupDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeStabilityDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeSleepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeTiltDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodePocketDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeCircleDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeHeartRateMonitor(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeArvrStabilizedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeArvrStabilizedGRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeGyroIntegratedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeIZroRequest(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeRawOptFlow(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeDeadReckoningPose(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
-static int decodeWheelEncoder(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
+typedef int (sh2_Decoder_t)(sh2_SensorValue_t *value, const uint8_t *report);
+
+static int decodeReport(sh2_SensorValue_t *value, uint8_t reportId, uint64_t timestamp_uS,
+                        const uint8_t *report);
+
+#define DECLARE_DECODER(name, len, decoder, member) static sh2_Decoder_t decoder;
+SH2_SENSOR_REPORTS(DECLARE_DECODER)
+
+// Each member named in the registry must exist in sh2_SensorValue_t
+#define CHECK_MEMBER(name, len, decoder, member) \
+    CHECK_##name = sizeof(((sh2_SensorValue_t *)0)->un.member),
+enum { SH2_SENSOR_REPORTS(CHECK_MEMBER) };
+
+// Decoder dispatch, generated from the registry. The compiler turns the
+// switch into a jump table, and decoders of reports that aren't built in
+// aren't referenced, so they drop out.
+#define DECODE_CASE(name, len, decoder, member) \
+        case SH2_##name: \
+            return SH2_REPORT_ENABLED(name) ? decoder(value, report) : SH2_ERR;
 
 // ------------------------------------------------------------------------
 // Public API
 
 int sh2_decodeSensorEvent(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
 {
-    // Fill out fields of *value based on *event, converting data from message representation
-    // to natural representation.
+    return decodeReport(value, event->reportId, event->timestamp_uS, event->report);
+}
+
+int sh2_decodeSensorEventRef(sh2_SensorValue_t *value, const sh2_SensorEventRef_t *event)
+{
+    return decodeReport(value, event->reportId, event->timestamp_uS, event->report);
+}
+
+int sh2_decodeSensorBatch(sh2_SensorValue_t *values, const sh2_SensorEventRef_t *events, uint16_t count)
+{
+    int decoded = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (decodeReport(&values[decoded], events[i].reportId, events[i].timestamp_uS,
+                         events[i].report) == SH2_OK) {
+            decoded++;
+        }
+    }
+
+    return decoded;
+}
 
-    int rc = SH2_OK;
+// ------------------------------------------------------------------------
+// Private utility functions
 
-    value->sensorId = event->reportId;
-    value->timestamp = event->timestamp_uS;
+static int decodeReport(sh2_SensorValue_t *value, uint8_t reportId, uint64_t timestamp_uS,
+                        const uint8_t *report)
+{
+    // Fill out fields of *value based on the report, converting data from message representation
+    // to natural representation.
+
+    value->sensorId = reportId;
+    value->timestamp = timestamp_uS;
 
     if (value->sensorId != SH2_GYRO_INTEGRATED_RV) {
-        value->sequence = event->report[1];
-        value->status = event->report[2] & 0x03;
+        value->sequence = report[1];
+        value->status = report[2] & 0x03;
     }
     else {
         value->sequence = 0;
         value->status = 0;
     }
 
-    // extract delay field (100uS units)
-    
-    
-    switch (value->sensorId) {
-        case SH2_RAW_ACCELEROMETER:
-            rc = decodeRawAccelerometer(value, event);
-            break;
-        case SH2_ACCELEROMETER:
-            rc = decodeAccelerometer(value, event);
-            break;
-        case SH2_LINEAR_ACCELERATION:
-            rc = decodeLinearAcceleration(value, event);
-            break;
-        case SH2_GRAVITY:
-            rc = decodeGravity(value, event);
-            break;
-        case SH2_RAW_GYROSCOPE:
-            rc = decodeRawGyroscope(value, event);
-            break;
-        case SH2_GYROSCOPE_CALIBRATED:
-            rc = decodeGyroscopeCalibrated(value, event);
-            break;
-        case SH2_GYROSCOPE_UNCALIBRATED:
-            rc = decodeGyroscopeUncal(value, event);
-            break;
-        case SH2_RAW_MAGNETOMETER:
-            rc = decodeRawMagnetometer(value, event);
-            break;
-        case SH2_MAGNETIC_FIELD_CALIBRATED:
-            rc = decodeMagneticFieldCalibrated(value, event);
-            break;
-        case SH2_MAGNETIC_FIELD_UNCALIBRATED:
-            rc = decodeMagneticFieldUncal(value, event);
-            break;
-        case SH2_ROTATION_VECTOR:
-            rc = decodeRotationVector(value, event);
-            break;
-        case SH2_GAME_ROTATION_VECTOR:
-            rc = decodeGameRotationVector(value, event);
-            break;
-        case SH2_GEOMAGNETIC_ROTATION_VECTOR:
-            rc = decodeGeomagneticRotationVector(value, event);
-            break;
-        case SH2_PRESSURE:
-            rc = decodePressure(value, event);
-            break;
-        case SH2_AMBIENT_LIGHT:
-            rc = decodeAmbientLight(value, event);
-            break;
-        case SH2_HUMIDITY:
-            rc = decodeHumidity(value, event);
-            break;
-        case SH2_PROXIMITY:
-            rc = decodeProximity(value, event);
-            break;
-        case SH2_TEMPERATURE:
-            rc = decodeTemperature(value, event);
-            break;
-        case SH2_RESERVED:
-            rc = decodeReserved(value, event);
-            break;
-        case SH2_TAP_DETECTOR:
-            rc = decodeTapDetector(value, event);
-            break;
-        case SH2_STEP_DETECTOR:
-            rc = decodeStepDetector(value, event);
-            break;
-        case SH2_STEP_COUNTER:
-            rc = decodeStepCounter(value, event);
-            break;
-        case SH2_SIGNIFICANT_MOTION:
-            rc = decodeSignificantMotion(value, event);
-            break;
-        case SH2_STABILITY_CLASSIFIER:
-            rc = decodeStabilityClassifier(value, event);
-            break;
-        case SH2_SHAKE_DETECTOR:
-            rc = decodeShakeDetector(value, event);
-            break;
-        case SH2_FLIP_DETECTOR:
-            rc = decodeFlipDetector(value, event);
-            break;
-        case SH2_PICKUP_DETECTOR:
-            rc = decodePickupDetector(value, event);
-            break;
-        case SH2_STABILITY_DETECTOR:
-            rc = decodeStabilityDetector(value, event);
-            break;
-        case SH2_PERSONAL_ACTIVITY_CLASSIFIER:
-            rc = decodePersonalActivityClassifier(value, event);
-            break;
-        case SH2_SLEEP_DETECTOR:
-            rc = decodeSleepDetector(value, event);
-            break;
-        case SH2_TILT_DETECTOR:
-            rc = decodeTiltDetector(value, event);
-            break;
-        case SH2_POCKET_DETECTOR:
-            rc = decodePocketDetector(value, event);
-            break;
-        case SH2_CIRCLE_DETECTOR:
-            rc = decodeCircleDetector(value, event);
-            break;
-        case SH2_HEART_RATE_MONITOR:
-            rc = decodeHeartRateMonitor(value, event);
-            break;
-        case SH2_ARVR_STABILIZED_RV:
-            rc = decodeArvrStabilizedRV(value, event);
-            break;
-        case SH2_ARVR_STABILIZED_GRV:
-            rc = decodeArvrStabilizedGRV(value, event);
-            break;
-        case SH2_GYRO_INTEGRATED_RV:
-            rc = decodeGyroIntegratedRV(value, event);
-            break;
-        case SH2_IZRO_MOTION_REQUEST:
-            rc = decodeIZroRequest(value, event);
-            break;
-        case SH2_RAW_OPTICAL_FLOW:
-            rc = decodeRawOptFlow(value, event);
-            break;
-        case SH2_DEAD_RECKONING_POSE:
-            rc = decodeDeadReckoningPose(value, event);
-            break;
-        case SH2_WHEEL_ENCODER:
-            rc = decodeWheelEncoder(value, event);
-            break;
+    switch (reportId) {
+        SH2_SENSOR_REPORTS(DECODE_CASE)
         default:
             // Unknown report id
-            rc = SH2_ERR;
-            break;
+            return SH2_ERR;
     }
-
-    return rc;
 }
 
-// ------------------------------------------------------------------------
-// Private utility functions
-
-static int decodeRawAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeRawAccelerometer(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.rawAccelerometer.x = read16(&event->report[4]);
-    value->un.rawAccelerometer.y = read16(&event->report[6]);
-    value->un.rawAccelerometer.z = read16(&event->report[8]);
-    value->un.rawAccelerometer.timestamp = read32(&event->report[12]);
+    value->un.rawAccelerometer.x = read16(&report[4]);
+    value->un.rawAccelerometer.y = read16(&report[6]);
+    value->un.rawAccelerometer.z = read16(&report[8]);
+    value->un.rawAccelerometer.timestamp = read32(&report[12]);
 
     return SH2_OK;
 }
 
-static int decodeAccelerometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeAccelerometer(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.accelerometer.x = read16(&event->report[4]) * SCALE_Q(8);
-    value->un.accelerometer.y = read16(&event->report[6]) * SCALE_Q(8);
-    value->un.accelerometer.z = read16(&event->report[8]) * SCALE_Q(8);
+    value->un.accelerometer.x = read16(&report[4]) * SCALE_Q(8);
+    value->un.accelerometer.y = read16(&report[6]) * SCALE_Q(8);
+    value->un.accelerometer.z = read16(&report[8]) * SCALE_Q(8);
 
     return SH2_OK;
 }
 
-static int decodeLinearAcceleration(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeLinearAcceleration(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.linearAcceleration.x = read16(&event->report[4]) * SCALE_Q(8);
-    value->un.linearAcceleration.y = read16(&event->report[6]) * SCALE_Q(8);
-    value->un.linearAcceleration.z = read16(&event->report[8]) * SCALE_Q(8);
+    value->un.linearAcceleration.x = read16(&report[4]) * SCALE_Q(8);
+    value->un.linearAcceleration.y = read16(&report[6]) * SCALE_Q(8);
+    value->un.linearAcceleration.z = read16(&report[8]) * SCALE_Q(8);
 
     return SH2_OK;
 }
 
-static int decodeGravity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeGravity(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.gravity.x = read16(&event->report[4]) * SCALE_Q(8);
-    value->un.gravity.y = read16(&event->report[6]) * SCALE_Q(8);
-    value->un.gravity.z = read16(&event->report[8]) * SCALE_Q(8);
+    value->un.gravity.x = read16(&report[4]) * SCALE_Q(8);
+    value->un.gravity.y = read16(&report[6]) * SCALE_Q(8);
+    value->un.gravity.z = read16(&report[8]) * SCALE_Q(8);
 
     return SH2_OK;
 }
 
-static int decodeRawGyroscope(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeRawGyroscope(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.rawGyroscope.x = read16(&event->report[4]);
-    value->un.rawGyroscope.y = read16(&event->report[6]);
-    value->un.rawGyroscope.z = read16(&event->report[8]);
-    value->un.rawGyroscope.temperature = read16(&event->report[10]);
-    value->un.rawGyroscope.timestamp = read32(&event->report[12]);
+    value->un.rawGyroscope.x = read16(&report[4]);
+    value->un.rawGyroscope.y = read16(&report[6]);
+    value->un.rawGyroscope.z = read16(&report[8]);
+    value->un.rawGyroscope.temperature = read16(&report[10]);
+    value->un.rawGyroscope.timestamp = read32(&report[12]);
 
     return SH2_OK;
 }
 
-static int decodeGyroscopeCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeGyroscopeCalibrated(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.gyroscope.x = read16(&event->report[4]) * SCALE_Q(9);
-    value->un.gyroscope.y = read16(&event->report[6]) * SCALE_Q(9);
-    value->un.gyroscope.z = read16(&event->report[8]) * SCALE_Q(9);
+    value->un.gyroscope.x = read16(&report[4]) * SCALE_Q(9);
+    value->un.gyroscope.y = read16(&report[6]) * SCALE_Q(9);
+    value->un.gyroscope.z = read16(&report[8]) * SCALE_Q(9);
 
     return SH2_OK;
 }
 
-static int decodeGyroscopeUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeGyroscopeUncal(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.gyroscopeUncal.x = read16(&event->report[4]) * SCALE_Q(9);
-    value->un.gyroscopeUncal.y = read16(&event->report[6]) * SCALE_Q(9);
-    value->un.gyroscopeUncal.z = read16(&event->report[8]) * SCALE_Q(9);
+    value->un.gyroscopeUncal.x = read16(&report[4]) * SCALE_Q(9);
+    value->un.gyroscopeUncal.y = read16(&report[6]) * SCALE_Q(9);
+    value->un.gyroscopeUncal.z = read16(&report[8]) * SCALE_Q(9);
 
-    value->un.gyroscopeUncal.biasX = read16(&event->report[10]) * SCALE_Q(9);
-    value->un.gyroscopeUncal.biasY = read16(&event->report[12]) * SCALE_Q(9);
-    value->un.gyroscopeUncal.biasZ = read16(&event->report[14]) * SCALE_Q(9);
+    value->un.gyroscopeUncal.biasX = read16(&report[10]) * SCALE_Q(9);
+    value->un.gyroscopeUncal.biasY = read16(&report[12]) * SCALE_Q(9);
+    value->un.gyroscopeUncal.biasZ = read16(&report[14]) * SCALE_Q(9);
 
     return SH2_OK;
 }
 
-static int decodeRawMagnetometer(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeRawMagnetometer(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.rawMagnetometer.x = read16(&event->report[4]);
-    value->un.rawMagnetometer.y = read16(&event->report[6]);
-    value->un.rawMagnetometer.z = read16(&event->report[8]);
-    value->un.rawMagnetometer.timestamp = read32(&event->report[12]);
+    value->un.rawMagnetometer.x = read16(&report[4]);
+    value->un.rawMagnetometer.y = read16(&report[6]);
+    value->un.rawMagnetometer.z = read16(&report[8]);
+    value->un.rawMagnetometer.timestamp = read32(&report[12]);
 
     return SH2_OK;
 }
 
-static int decodeMagneticFieldCalibrated(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeMagneticFieldCalibrated(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.magneticField.x = read16(&event->report[4]) * SCALE_Q(4);
-    value->un.magneticField.y = read16(&event->report[6]) * SCALE_Q(4);
-    value->un.magneticField.z = read16(&event->report[8]) * SCALE_Q(4);
+    value->un.magneticField.x = read16(&report[4]) * SCALE_Q(4);
+    value->un.magneticField.y = read16(&report[6]) * SCALE_Q(4);
+    value->un.magneticField.z = read16(&report[8]) * SCALE_Q(4);
 
     return SH2_OK;
 }
 
-static int decodeMagneticFieldUncal(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeMagneticFieldUncal(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.magneticFieldUncal.x = read16(&event->report[4]) * SCALE_Q(4);
-    value->un.magneticFieldUncal.y = read16(&event->report[6]) * SCALE_Q(4);
-    value->un.magneticFieldUncal.z = read16(&event->report[8]) * SCALE_Q(4);
+    value->un.magneticFieldUncal.x = read16(&report[4]) * SCALE_Q(4);
+    value->un.magneticFieldUncal.y = read16(&report[6]) * SCALE_Q(4);
+    value->un.magneticFieldUncal.z = read16(&report[8]) * SCALE_Q(4);
 
-    value->un.magneticFieldUncal.biasX = read16(&event->report[10]) * SCALE_Q(4);
-    value->un.magneticFieldUncal.biasY = read16(&event->report[12]) * SCALE_Q(4);
-    value->un.magneticFieldUncal.biasZ = read16(&event->report[14]) * SCALE_Q(4);
+    value->un.magneticFieldUncal.biasX = read16(&report[10]) * SCALE_Q(4);
+    value->un.magneticFieldUncal.biasY = read16(&report[12]) * SCALE_Q(4);
+    value->un.magneticFieldUncal.biasZ = read16(&report[14]) * SCALE_Q(4);
 
     return SH2_OK;
 }
 
-static int decodeRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+// Quaternion components of the rotation vector reports, kept as sent for
+// consumers that don't need floats
+static void readQuatQ14(sh2_QuatQ14_t *q14, const uint8_t *report)
 {
-    value->un.rotationVector.i = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.rotationVector.j = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.rotationVector.k = read16(&event->report[8]) * SCALE_Q(14);
-    value->un.rotationVector.real = read16(&event->report[10]) * SCALE_Q(14);
-    value->un.rotationVector.accuracy = read16(&event->report[12]) * SCALE_Q(12);
-
-    return SH2_OK;
+    q14->i = read16(&report[4]);
+    q14->j = read16(&report[6]);
+    q14->k = read16(&report[8]);
+    q14->real = read16(&report[10]);
 }
 
-static int decodeGameRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeRotationVector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.gameRotationVector.i = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.gameRotationVector.j = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.gameRotationVector.k = read16(&event->report[8]) * SCALE_Q(14);
-    value->un.gameRotationVector.real = read16(&event->report[10]) * SCALE_Q(14);
+    value->un.rotationVector.i = read16(&report[4]) * SCALE_Q(14);
+    value->un.rotationVector.j = read16(&report[6]) * SCALE_Q(14);
+    value->un.rotationVector.k = read16(&report[8]) * SCALE_Q(14);
+    value->un.rotationVector.real = read16(&report[10]) * SCALE_Q(14);
+    readQuatQ14(&value->un.rotationVector.q14, report);
+    value->un.rotationVector.accuracy = read16(&report[12]) * SCALE_Q(12);
 
     return SH2_OK;
 }
 
-static int decodeGeomagneticRotationVector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeGameRotationVector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.geoMagRotationVector.i = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.geoMagRotationVector.j = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.geoMagRotationVector.k = read16(&event->report[8]) * SCALE_Q(14);
-    value->un.geoMagRotationVector.real = read16(&event->report[10]) * SCALE_Q(14);
-    value->un.geoMagRotationVector.accuracy = read16(&event->report[12]) * SCALE_Q(12);
+    value->un.gameRotationVector.i = read16(&report[4]) * SCALE_Q(14);
+    value->un.gameRotationVector.j = read16(&report[6]) * SCALE_Q(14);
+    value->un.gameRotationVector.k = read16(&report[8]) * SCALE_Q(14);
+    value->un.gameRotationVector.real = read16(&report[10]) * SCALE_Q(14);
+    readQuatQ14(&value->un.gameRotationVector.q14, report);
 
     return SH2_OK;
 }
 
-static int decodePressure(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeGeomagneticRotationVector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.pressure.value = read32(&event->report[4]) * SCALE_Q(20);
+    value->un.geoMagRotationVector.i = read16(&report[4]) * SCALE_Q(14);
+    value->un.geoMagRotationVector.j = read16(&report[6]) * SCALE_Q(14);
+    value->un.geoMagRotationVector.k = read16(&report[8]) * SCALE_Q(14);
+    value->un.geoMagRotationVector.real = read16(&report[10]) * SCALE_Q(14);
+    readQuatQ14(&value->un.geoMagRotationVector.q14, report);
+    value->un.geoMagRotationVector.accuracy = read16(&report[12]) * SCALE_Q(12);
 
     return SH2_OK;
 }
 
-static int decodeAmbientLight(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodePressure(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.ambientLight.value = read32(&event->report[4]) * SCALE_Q(8);
+    value->un.pressure.value = read32(&report[4]) * SCALE_Q(20);
 
     return SH2_OK;
 }
 
-static int decodeHumidity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeAmbientLight(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.humidity.value = read16(&event->report[4]) * SCALE_Q(8);
+    value->un.ambientLight.value = read32(&report[4]) * SCALE_Q(8);
 
     return SH2_OK;
 }
 
-static int decodeProximity(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeHumidity(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.proximity.value = read16(&event->report[4]) * SCALE_Q(4);
+    value->un.humidity.value = read16(&report[4]) * SCALE_Q(8);
 
     return SH2_OK;
 }
 
-static int decodeTemperature(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeProximity(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.temperature.value = read16(&event->report[4]) * SCALE_Q(7);
+    value->un.proximity.value = read16(&report[4]) * SCALE_Q(4);
 
     return SH2_OK;
 }
 
-static int decodeReserved(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeTemperature(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.reserved.tbd = read16(&event->report[4]) * SCALE_Q(7);
+    value->un.temperature.value = read16(&report[4]) * SCALE_Q(7);
 
     return SH2_OK;
 }
 
-static int decodeTapDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeTapDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.tapDetector.flags = event->report[4];
+    value->un.tapDetector.flags = report[4];
 
     return SH2_OK;
 }
 
-static int decodeStepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeStepDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.stepDetector.latency = readu32(&event->report[4]);
+    value->un.stepDetector.latency = readu32(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeStepCounter(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeStepCounter(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.stepCounter.latency = readu32(&event->report[4]);
-    value->un.stepCounter.steps = readu32(&event->report[8]);
+    value->un.stepCounter.latency = readu32(&report[4]);
+    value->un.stepCounter.steps = readu32(&report[8]);
 
     return SH2_OK;
 }
 
-static int decodeSignificantMotion(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeSignificantMotion(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.sigMotion.motion = readu16(&event->report[4]);
+    value->un.sigMotion.motion = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeStabilityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeStabilityClassifier(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.stabilityClassifier.classification = event->report[4];
+    value->un.stabilityClassifier.classification = report[4];
 
     return SH2_OK;
 }
 
-static int decodeShakeDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeShakeDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.shakeDetector.shake = readu16(&event->report[4]);
+    value->un.shakeDetector.shake = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeFlipDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeFlipDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.flipDetector.flip = readu16(&event->report[4]);
+    value->un.flipDetector.flip = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodePickupDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodePickupDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.pickupDetector.pickup = readu16(&event->report[4]);
+    value->un.pickupDetector.pickup = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeStabilityDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeStabilityDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.stabilityDetector.stability = readu16(&event->report[4]);
+    value->un.stabilityDetector.stability = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodePersonalActivityClassifier(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.personalActivityClassifier.page = event->report[4] & 0x7F;
-    value->un.personalActivityClassifier.lastPage = ((event->report[4] & 0x80) != 0);
-    value->un.personalActivityClassifier.mostLikelyState = event->report[5];
+    value->un.personalActivityClassifier.page = report[4] & 0x7F;
+    value->un.personalActivityClassifier.lastPage = ((report[4] & 0x80) != 0);
+    value->un.personalActivityClassifier.mostLikelyState = report[5];
     for (int n = 0; n < 10; n++) {
-        value->un.personalActivityClassifier.confidence[n] = event->report[6+n];
+        value->un.personalActivityClassifier.confidence[n] = report[6+n];
     }
     
     return SH2_OK;
 }
 
-static int decodeSleepDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeSleepDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.sleepDetector.sleepState = event->report[4];
+    value->un.sleepDetector.sleepState = report[4];
 
     return SH2_OK;
 }
 
-static int decodeTiltDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeTiltDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.tiltDetector.tilt = readu16(&event->report[4]);
+    value->un.tiltDetector.tilt = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodePocketDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodePocketDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.pocketDetector.pocket = readu16(&event->report[4]);
+    value->un.pocketDetector.pocket = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeCircleDetector(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeCircleDetector(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.circleDetector.circle = readu16(&event->report[4]);
+    value->un.circleDetector.circle = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeHeartRateMonitor(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeHeartRateMonitor(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.heartRateMonitor.heartRate = readu16(&event->report[4]);
+    value->un.heartRateMonitor.heartRate = readu16(&report[4]);
 
     return SH2_OK;
 }
 
-static int decodeArvrStabilizedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeArvrStabilizedRV(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.arvrStabilizedRV.i = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.arvrStabilizedRV.j = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.arvrStabilizedRV.k = read16(&event->report[8]) * SCALE_Q(14);
-    value->un.arvrStabilizedRV.real = read16(&event->report[10]) * SCALE_Q(14);
-    value->un.arvrStabilizedRV.accuracy = read16(&event->report[12]) * SCALE_Q(12);
+    value->un.arvrStabilizedRV.i = read16(&report[4]) * SCALE_Q(14);
+    value->un.arvrStabilizedRV.j = read16(&report[6]) * SCALE_Q(14);
+    value->un.arvrStabilizedRV.k = read16(&report[8]) * SCALE_Q(14);
+    value->un.arvrStabilizedRV.real = read16(&report[10]) * SCALE_Q(14);
+    readQuatQ14(&value->un.arvrStabilizedRV.q14, report);
+    value->un.arvrStabilizedRV.accuracy = read16(&report[12]) * SCALE_Q(12);
 
     return SH2_OK;
 }
 
-static int decodeArvrStabilizedGRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeArvrStabilizedGRV(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.arvrStabilizedGRV.i = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.arvrStabilizedGRV.j = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.arvrStabilizedGRV.k = read16(&event->report[8]) * SCALE_Q(14);
-    value->un.arvrStabilizedGRV.real = read16(&event->report[10]) * SCALE_Q(14);
+    value->un.arvrStabilizedGRV.i = read16(&report[4]) * SCALE_Q(14);
+    value->un.arvrStabilizedGRV.j = read16(&report[6]) * SCALE_Q(14);
+    value->un.arvrStabilizedGRV.k = read16(&report[8]) * SCALE_Q(14);
+    value->un.arvrStabilizedGRV.real = read16(&report[10]) * SCALE_Q(14);
+    readQuatQ14(&value->un.arvrStabilizedGRV.q14, report);
 
     return SH2_OK;
 }
 
-static int decodeGyroIntegratedRV(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeGyroIntegratedRV(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.gyroIntegratedRV.i = read16(&event->report[0]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.j = read16(&event->report[2]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.k = read16(&event->report[4]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.real = read16(&event->report[6]) * SCALE_Q(14);
-    value->un.gyroIntegratedRV.angVelX = read16(&event->report[8]) * SCALE_Q(10);
-    value->un.gyroIntegratedRV.angVelY = read16(&event->report[10]) * SCALE_Q(10);
-    value->un.gyroIntegratedRV.angVelZ = read16(&event->report[12]) * SCALE_Q(10);
+    value->un.gyroIntegratedRV.i = read16(&report[0]) * SCALE_Q(14);
+    value->un.gyroIntegratedRV.j = read16(&report[2]) * SCALE_Q(14);
+    value->un.gyroIntegratedRV.k = read16(&report[4]) * SCALE_Q(14);
+    value->un.gyroIntegratedRV.real = read16(&report[6]) * SCALE_Q(14);
+    value->un.gyroIntegratedRV.angVelX = read16(&report[8]) * SCALE_Q(10);
+    value->un.gyroIntegratedRV.angVelY = read16(&report[10]) * SCALE_Q(10);
+    value->un.gyroIntegratedRV.angVelZ = read16(&report[12]) * SCALE_Q(10);
 
     return SH2_OK;
 }
 
-static int decodeIZroRequest(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeIZroRequest(sh2_SensorValue_t *value, const uint8_t *report)
 {
-    value->un.izroRequest.intent = (sh2_IZroMotionIntent_t)event->report[4];
-    value->un.izroRequest.request = (sh2_IZroMotionRequest_t)event->report[5];
+    value->un.izroRequest.intent = (sh2_IZroMotionIntent_t)report[4];
+    value->un.izroRequest.request = (sh2_IZroMotionRequest_t)report[5];
 
     return SH2_OK;
 }
 
-static int decodeRawOptFlow(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event)
+static int decodeRawOptFlow(sh2_SensorValue_t *value, const uint8_t *report)
 {
     // Decode Raw optical flow
-    value->un.rawOptFlow.dx = read16(&event->report[4]);
-    value->un.rawOptFlow.dy = read16(&event->report[6]);
-    value->un.rawOptFlow.iq = read16(&event->report[8]);
-    value->un.rawOptFlow.resX = read8(&event->report[10]);
-    value->un.rawOptFlow.resY = read8(&event->report[11]);
-    value->un.rawOptFlow.shutter = read8(&event->report[12]);
-    value->un.rawOptFlow.frameMax = read8(&event->report[13]);
-    value->un.rawOptFlow.frameAvg = read8(&event->report[14]);
-    value->un.rawOptFlow.frameMin = read8(&event->report[15]);
-    value->un.rawOptFlow.laserOn = read8(&event->report[16]);
-    value->un.rawOptFlow.dt = read16(&event->report[18]);
-    value->un.rawOptFlow.timestamp = read32(&event->report[20]);
+    value->un.rawOptFlow.dx = read16(&report[4]);
+    value->un.rawOptFlow.dy = read16(&report[6]);
+    value->un.rawOptFlow.iq = read16(&report[8]);
+    value->un.rawOptFlow.resX = read8(&report[10]);
+    value->un.rawOptFlow.resY = read8(&report[11]);
+    value->un.rawOptFlow.shutter = read8(&report[12]);
+    value->un.rawOptFlow.frameMax = read8(&report[13]);
+    value->un.rawOptFlow.frameAvg = read8(&report[14]);
+    value->un.rawOptFlow.frameMin = read8(&report[15]);
+    value->un.rawOptFlow.laserOn = read8(&report[16]);
+    value->un.rawOptFlow.dt = read16(&report[18]);
+    value->un.rawOptFlow.timestamp = read32(&report[20]);
     
     return SH2_OK;
 }
 
-static int decodeDeadReckoningPose(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event){
-    value->un.deadReckoningPose.timestamp = read32(&event->report[4]);
-    value->un.deadReckoningPose.linPosX = read32(&event->report[8]) * SCALE_Q(17);
-    value->un.deadReckoningPose.linPosY = read32(&event->report[12]) * SCALE_Q(17);
-    value->un.deadReckoningPose.linPosZ = read32(&event->report[16]) * SCALE_Q(17);
+static int decodeDeadReckoningPose(sh2_SensorValue_t *value, const uint8_t *report){
+    value->un.deadReckoningPose.timestamp = read32(&report[4]);
+    value->un.deadReckoningPose.linPosX = read32(&report[8]) * SCALE_Q(17);
+    value->un.deadReckoningPose.linPosY = read32(&report[12]) * SCALE_Q(17);
+    value->un.deadReckoningPose.linPosZ = read32(&report[16]) * SCALE_Q(17);
 
-    value->un.deadReckoningPose.i = read32(&event->report[20]) * SCALE_Q(30);
-    value->un.deadReckoningPose.j = read32(&event->report[24]) * SCALE_Q(30);
-    value->un.deadReckoningPose.k = read32(&event->report[28]) * SCALE_Q(30);
-    value->un.deadReckoningPose.real = read32(&event->report[32]) * SCALE_Q(30);
+    value->un.deadReckoningPose.i = read32(&report[20]) * SCALE_Q(30);
+    value->un.deadReckoningPose.j = read32(&report[24]) * SCALE_Q(30);
+    value->un.deadReckoningPose.k = read32(&report[28]) * SCALE_Q(30);
+    value->un.deadReckoningPose.real = read32(&report[32]) * SCALE_Q(30);
 
-    value->un.deadReckoningPose.linVelX = read32(&event->report[36]) * SCALE_Q(25);
-    value->un.deadReckoningPose.linVelY = read32(&event->report[40]) * SCALE_Q(25);
-    value->un.deadReckoningPose.linVelZ = read32(&event->report[44]) * SCALE_Q(25);
+    value->un.deadReckoningPose.linVelX = read32(&report[36]) * SCALE_Q(25);
+    value->un.deadReckoningPose.linVelY = read32(&report[40]) * SCALE_Q(25);
+    value->un.deadReckoningPose.linVelZ = read32(&report[44]) * SCALE_Q(25);
 
-    value->un.deadReckoningPose.angVelX = read32(&event->report[48]) * SCALE_Q(25);
-    value->un.deadReckoningPose.angVelY = read32(&event->report[52]) * SCALE_Q(25);
-    value->un.deadReckoningPose.angVelZ = read32(&event->report[56]) * SCALE_Q(25);
+    value->un.deadReckoningPose.angVelX = read32(&report[48]) * SCALE_Q(25);
+    value->un.deadReckoningPose.angVelY = read32(&report[52]) * SCALE_Q(25);
+    value->un.deadReckoningPose.angVelZ = read32(&report[56]) * SCALE_Q(25);
     return SH2_OK;
 }
 
-static int decodeWheelEncoder(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event){
-    value->un.wheelEncoder.timestamp = read32(&event->report[4]);
-    value->un.wheelEncoder.wheelIndex = read8(&event->report[8]);
-    value->un.wheelEncoder.dataType = read8(&event->report[9]);
-    value->un.wheelEncoder.data = read16(&event->report[10]);
+static int decodeWheelEncoder(sh2_SensorValue_t *value, const uint8_t *report){
+    value->un.wheelEncoder.timestamp = read32(&report[4]);
+    value->un.wheelEncoder.wheelIndex = read8(&report[8]);
+    value->un.wheelEncoder.dataType = read8(&report[9]);
+    value->un.wheelEncoder.data = read16(&report[10]);
     return SH2_OK;
 }
@@ -161,6 +161,16 @@ typedef struct sh2_MagneticFieldUncalibrated {
     float biasZ;  /**< @brief [uTesla] */
 } sh2_MagneticFieldUncalibrated_t;
 
+/**
+ * @brief Quaternion as sent by the hub, each component Q14 (1.0 = 16384)
+ */
+typedef struct sh2_QuatQ14 {
+    int16_t i;  /**< @brief Quaternion component i */
+    int16_t j;  /**< @brief Quaternion component j */
+    int16_t k;  /**< @brief Quaternion component k */
+    int16_t real;  /**< @brief Quaternion component real */
+} sh2_QuatQ14_t;
+
 /**
  * @brief Rotation Vector with Accuracy
  *
@@ -172,6 +182,7 @@ typedef struct sh2_RotationVectorWAcc {
     float k;  /**< @brief Quaternion component k */
     float real;  /**< @brief Quaternion component, real */
     float accuracy;  /**< @brief Accuracy estimate [radians] */
+    sh2_QuatQ14_t q14;  /**< @brief The same quaternion, unconverted */
 } sh2_RotationVectorWAcc_t;
 
 /**
@@ -184,6 +195,7 @@ typedef struct sh2_RotationVector {
     float j;  /**< @brief Quaternion component j */
     float k;  /**< @brief Quaternion component k */
     float real;  /**< @brief Quaternion component real */
+    sh2_QuatQ14_t q14;  /**< @brief The same quaternion, unconverted */
 } sh2_RotationVector_t;
 
 /**
@@ -541,5 +553,10 @@ typedef struct sh2_SensorValue {
 } sh2_SensorValue_t;
 
 int sh2_decodeSensorEvent(sh2_SensorValue_t *value, const sh2_SensorEvent_t *event);
+int sh2_decodeSensorEventRef(sh2_SensorValue_t *value, const sh2_SensorEventRef_t *event);
+
+// Decode count events into values, in order.  Events that can't be decoded
+// are left out, so returns the number of values filled in.
+int sh2_decodeSensorBatch(sh2_SensorValue_t *values, const sh2_SensorEventRef_t *events, uint16_t count);
 
 #endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2015-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor report registry
+ *
+ * One entry per sensor report: X(name, len, decoder, member). The report id
+ * is SH2_<name>, len its length in bytes, decoder the function in
+ * sh2_SensorValue.c that fills sh2_SensorValue_t, and member the field of
+ * sh2_SensorValue_t.un it fills.  sh2.c and sh2_SensorValue.c expand the
+ * list into lookup tables indexed by report id.
+ *
+ * By default every report is built in.  Define SH2_REPORT_ALLOWLIST to 1 and
+ * SH2_WITH_<name> to 1 for each report to keep; the others are still
+ * recognized (so the reports after them in a payload are parsed) but aren't
+ * delivered, and their decoders are left out of the build.
+ */
+
+#ifndef SH2_REPORTS_H
+#define SH2_REPORTS_H
+
+#define SH2_SENSOR_REPORTS(X) \
+    X(RAW_ACCELEROMETER,            16, decodeRawAccelerometer,           rawAccelerometer) \
+    X(ACCELEROMETER,                10, decodeAccelerometer,              accelerometer) \
+    X(LINEAR_ACCELERATION,          10, decodeLinearAcceleration,         linearAcceleration) \
+    X(GRAVITY,                      10, decodeGravity,                    gravity) \
+    X(RAW_GYROSCOPE,                16, decodeRawGyroscope,               rawGyroscope) \
+    X(GYROSCOPE_CALIBRATED,         10, decodeGyroscopeCalibrated,        gyroscope) \
+    X(GYROSCOPE_UNCALIBRATED,       16, decodeGyroscopeUncal,             gyroscopeUncal) \
+    X(RAW_MAGNETOMETER,             16, decodeRawMagnetometer,            rawMagnetometer) \
+    X(MAGNETIC_FIELD_CALIBRATED,    10, decodeMagneticFieldCalibrated,    magneticField) \
+    X(MAGNETIC_FIELD_UNCALIBRATED,  16, decodeMagneticFieldUncal,         magneticFieldUncal) \
+    X(ROTATION_VECTOR,              14, decodeRotationVector,             rotationVector) \
+    X(GAME_ROTATION_VECTOR,         12, decodeGameRotationVector,         gameRotationVector) \
+    X(GEOMAGNETIC_ROTATION_VECTOR,  14, decodeGeomagneticRotationVector,  geoMagRotationVector) \
+    X(PRESSURE,                      8, decodePressure,                   pressure) \
+    X(AMBIENT_LIGHT,                 8, decodeAmbientLight,               ambientLight) \
+    X(HUMIDITY,                      6, decodeHumidity,                   humidity) \
+    X(PROXIMITY,                     6, decodeProximity,                  proximity) \
+    X(TEMPERATURE,                   6, decodeTemperature,                temperature) \
+    X(TAP_DETECTOR,                  5, decodeTapDetector,                tapDetector) \
+    X(STEP_DETECTOR,                 8, decodeStepDetector,               stepDetector) \
+    X(STEP_COUNTER,                 12, decodeStepCounter,                stepCounter) \
+    X(SIGNIFICANT_MOTION,            6, decodeSignificantMotion,          sigMotion) \
+    X(STABILITY_CLASSIFIER,          6, decodeStabilityClassifier,        stabilityClassifier) \
+    X(SHAKE_DETECTOR,                6, decodeShakeDetector,              shakeDetector) \
+    X(FLIP_DETECTOR,                 6, decodeFlipDetector,               flipDetector) \
+    X(PICKUP_DETECTOR,               8, decodePickupDetector,             pickupDetector) \
+    X(STABILITY_DETECTOR,            6, decodeStabilityDetector,          stabilityDetector) \
+    X(PERSONAL_ACTIVITY_CLASSIFIER, 16, decodePersonalActivityClassifier, personalActivityClassifier) \
+    X(SLEEP_DETECTOR,                6, decodeSleepDetector,              sleepDetector) \
+    X(TILT_DETECTOR,                 6, decodeTiltDetector,               tiltDetector) \
+    X(POCKET_DETECTOR,               6, decodePocketDetector,             pocketDetector) \
+    X(CIRCLE_DETECTOR,               6, decodeCircleDetector,             circleDetector) \
+    X(HEART_RATE_MONITOR,            6, decodeHeartRateMonitor,           heartRateMonitor) \
+    X(ARVR_STABILIZED_RV,           14, decodeArvrStabilizedRV,           arvrStabilizedRV) \
+    X(ARVR_STABILIZED_GRV,          12, decodeArvrStabilizedGRV,          arvrStabilizedGRV) \
+    X(GYRO_INTEGRATED_RV,           14, decodeGyroIntegratedRV,           gyroIntegratedRV) \
+    X(IZRO_MOTION_REQUEST,           6, decodeIZroRequest,                izroRequest) \
+    X(RAW_OPTICAL_FLOW,             24, decodeRawOptFlow,                 rawOptFlow) \
+    X(DEAD_RECKONING_POSE,          60, decodeDeadReckoningPose,          deadReckoningPose) \
+    X(WHEEL_ENCODER,                12, decodeWheelEncoder,               wheelEncoder)
+
+// SH2_REPORT_ENABLED(name) is 1 if the report is built in. An undefined
+// SH2_WITH_<name> counts as 0: SH2_WITH_x defined as 1 pastes into
+// SH2_PLACEHOLDER_1, which supplies the extra argument that shifts the 1 into
+// second place.
+#define SH2_PLACEHOLDER_1 0,
+#define SH2_SECOND_ARG(ignored, val, ...) val
+#define SH2_IS_ONE(x) SH2_IS_ONE_(x)
+#define SH2_IS_ONE_(val) SH2_IS_ONE__(SH2_PLACEHOLDER_##val)
+#define SH2_IS_ONE__(arg_or_junk) SH2_SECOND_ARG(arg_or_junk 1, 0, 0)
+
+#if SH2_REPORT_ALLOWLIST
+#define SH2_REPORT_ENABLED(name) SH2_IS_ONE(SH2_WITH_##name)
+#else
+#define SH2_REPORT_ENABLED(name) 1
+#endif
+
+#endif
@@ -27,13 +27,45 @@
 // ------------------------------------------------------------------------
 // Private types
 
+#ifndef SHTP_INSTANCES
 #define SHTP_INSTANCES (1)  // Number of SHTP devices supported
-#define SHTP_MAX_CHANS (8)  // Max channels per SHTP device
+#endif
 #define SHTP_HDR_LEN (4)
+#define SHTP_TX_SLOTS (8)   // Outgoing transfers that can wait for the HAL
+
+// Slots in the receive ring, 0 to build without it. Must be a power of 2.
+#ifndef SHTP_RX_RING_SLOTS
+#define SHTP_RX_RING_SLOTS (0)
+#endif
+
+#if SHTP_RX_RING_SLOTS
+#if (SHTP_RX_RING_SLOTS & (SHTP_RX_RING_SLOTS - 1)) != 0
+#error "SHTP_RX_RING_SLOTS must be a power of 2"
+#endif
+
+#include <stdatomic.h>
+
+// One transfer as read by the producer
+typedef struct shtp_RxSlot_s {
+    uint16_t len;
+    uint32_t t_us;
+    uint8_t data[SH2_HAL_MAX_TRANSFER_IN];
+} shtp_RxSlot_t;
+#endif
+
+// One outgoing transfer, header included
+typedef struct shtp_TxSlot_s {
+    uint16_t len;
+    bool last;  // Final transfer of its cargo
+    shtp_TxCallback_t *callback;
+    void *cookie;
+    uint8_t data[SH2_HAL_MAX_TRANSFER_OUT];
+} shtp_TxSlot_t;
 
 typedef struct shtp_Channel_s {
     uint8_t nextOutSeq;
     uint8_t nextInSeq;
+    shtp_ChanMetrics_t metrics;
     shtp_Callback_t *callback;
     void *cookie;
 } shtp_Channel_t;
@@ -48,8 +80,11 @@ typedef struct shtp_s {
     shtp_EventCallback_t *eventCallback;
     void * eventCookie;
 
-    // Transmit support
-    uint8_t outTransfer[SH2_HAL_MAX_TRANSFER_OUT];
+    // Transmit support. Cargos are split into transfers when queued and
+    // written to the HAL in order as it accepts them.
+    shtp_TxSlot_t txSlot[SHTP_TX_SLOTS];
+    uint8_t txHead;
+    uint8_t txCount;
 
     // Receive support
     uint16_t inRemaining;
@@ -59,6 +94,16 @@ typedef struct shtp_s {
     uint32_t inTimestamp;
     uint8_t inTransfer[SH2_HAL_MAX_TRANSFER_IN];
 
+#if SHTP_RX_RING_SLOTS
+    // Receive ring. Only the producer writes rxHead and the slot it points
+    // at; only the consumer writes rxTail. Counters run freely and wrap.
+    bool rxRing;
+    bool rxDraining;
+    atomic_uint rxHead;
+    atomic_uint rxTail;
+    shtp_RxSlot_t rxSlot[SHTP_RX_RING_SLOTS];
+#endif
+
     // SHTP Channels
     shtp_Channel_t      chan[SHTP_MAX_CHANS];
 
@@ -67,10 +112,15 @@ typedef struct shtp_s {
     uint32_t rxShortFragments;
     uint32_t rxTooLargePayloads;
     uint32_t rxInterruptedPayloads;
+    uint32_t rxRingFull;
+    uint32_t rxPayloads;
+    uint32_t rxZeroCopy;
+    uint32_t rxCopyBytes;
     
     uint32_t badTxChan;
     uint32_t txDiscards;
     uint32_t txTooLargePayloads;
+    uint32_t txQueueFull;
 
 } shtp_t;
 
@@ -120,54 +170,54 @@ static inline uint16_t min_u16(uint16_t a, uint16_t b)
     }
 }
 
-// Send a cargo as a sequence of transports
-static int txProcess(shtp_t *pShtp, uint8_t chan, const uint8_t* pData, uint32_t len)
+// Split a cargo into transfers at the tail of the transmit queue
+static int txEnqueue(shtp_t *pShtp, uint8_t chan, const uint8_t* pData, uint16_t len,
+                     shtp_TxCallback_t *callback, void *cookie)
 {
-    int status = SH2_OK;
-    
+    const uint16_t maxCargo = SH2_HAL_MAX_TRANSFER_OUT - SHTP_HDR_LEN;
+    uint16_t transfers = (len + maxCargo - 1) / maxCargo;
     bool continuation = false;
     uint16_t cursor = 0;
-    uint16_t remaining;
-    uint16_t transferLen;  // length of transfer, minus the header
-    uint16_t lenField;
+    uint16_t remaining = len;
+
+    if (len == 0) {
+        // Nothing to send
+        if (callback != 0) {
+            callback(cookie, SH2_OK);
+        }
+        return SH2_OK;
+    }
+    if (pShtp->txCount + transfers > SHTP_TX_SLOTS) {
+        pShtp->txQueueFull++;
+        return SH2_ERR_OP_IN_PROGRESS;
+    }
 
-    cursor = 0;
-    remaining = len;
     while (remaining > 0) {
-        // How much data (not header) can we send in next transfer
-        transferLen = min_u16(remaining, SH2_HAL_MAX_TRANSFER_OUT-SHTP_HDR_LEN);
-        
+        shtp_TxSlot_t *pSlot = &pShtp->txSlot[(pShtp->txHead + pShtp->txCount) % SHTP_TX_SLOTS];
+
+        // How much data (not header) goes in this transfer
+        uint16_t transferLen = min_u16(remaining, maxCargo);
+
         // Length field will be transferLen + SHTP_HDR_LEN
-        lenField = transferLen + SHTP_HDR_LEN;
+        uint16_t lenField = transferLen + SHTP_HDR_LEN;
 
-        // Put the header in the out buffer
-        pShtp->outTransfer[0] = lenField & 0xFF;
-        pShtp->outTransfer[1] = (lenField >> 8) & 0x7F;
+        pSlot->data[0] = lenField & 0xFF;
+        pSlot->data[1] = (lenField >> 8) & 0x7F;
         if (continuation) {
-            pShtp->outTransfer[1] |= 0x80;
+            pSlot->data[1] |= 0x80;
         }
-        pShtp->outTransfer[2] = chan;
-        pShtp->outTransfer[3] = pShtp->chan[chan].nextOutSeq++;
+        pSlot->data[2] = chan;
+        pSlot->data[3] = pShtp->chan[chan].nextOutSeq++;
+        memcpy(pSlot->data+SHTP_HDR_LEN, pData+cursor, transferLen);
+        pSlot->len = lenField;
 
-        // Stage one tranfer in the out buffer
-        memcpy(pShtp->outTransfer+SHTP_HDR_LEN, pData+cursor, transferLen);
         remaining -= transferLen;
         cursor += transferLen;
 
-        // Transmit (try repeatedly while HAL write returns 0)
-        status = pShtp->pHal->write(pShtp->pHal, pShtp->outTransfer, lenField);
-        while (status == 0)
-        {
-            shtp_service(pShtp);
-            status = pShtp->pHal->write(pShtp->pHal, pShtp->outTransfer, lenField);
-        }
-        
-        if (status < 0)
-        {
-            // Error, throw away this cargo
-            pShtp->txDiscards++;
-            return status;
-        }
+        pSlot->last = (remaining == 0);
+        pSlot->callback = callback;
+        pSlot->cookie = cookie;
+        pShtp->txCount++;
 
         // For the rest of this transmission, packets are continuations.
         continuation = true;
@@ -176,6 +226,74 @@ static int txProcess(shtp_t *pShtp, uint8_t chan, const uint8_t* pData, uint32_t
     return SH2_OK;
 }
 
+// Drop the transfer at the head of the queue, completing its cargo if it
+// was the last one
+static void txPop(shtp_t *pShtp, int status)
+{
+    shtp_TxSlot_t *pSlot = &pShtp->txSlot[pShtp->txHead];
+    shtp_ChanMetrics_t *pMetrics = &pShtp->chan[pSlot->data[2]].metrics;
+    bool last = pSlot->last;
+    shtp_TxCallback_t *callback = pSlot->callback;
+    void *cookie = pSlot->cookie;
+
+    pShtp->txHead = (pShtp->txHead + 1) % SHTP_TX_SLOTS;
+    pShtp->txCount--;
+
+    if (status == SH2_OK) {
+        pMetrics->txBytes += pSlot->len - SHTP_HDR_LEN;
+        if (last) {
+            pMetrics->txPayloads++;
+        }
+    }
+
+    if (last && callback != 0) {
+        callback(cookie, status);
+    }
+}
+
+// Write queued transfers until the HAL stops accepting them
+static void txAdvance(shtp_t *pShtp)
+{
+    while (pShtp->txCount > 0) {
+        shtp_TxSlot_t *pSlot = &pShtp->txSlot[pShtp->txHead];
+
+        int status = pShtp->pHal->write(pShtp->pHal, pSlot->data, pSlot->len);
+        if (status == 0) {
+            // HAL busy, try again on the next service
+            return;
+        }
+
+        if (status < 0) {
+            // Error, throw away the rest of this cargo
+            pShtp->txDiscards++;
+            while (pShtp->txCount > 0 && !pShtp->txSlot[pShtp->txHead].last) {
+                txPop(pShtp, status);
+            }
+            txPop(pShtp, status);
+            continue;
+        }
+
+        txPop(pShtp, SH2_OK);
+    }
+}
+
+// Account a payload handed to its channel listener
+static void rxDelivered(shtp_t *pShtp, uint8_t chan, uint16_t len, uint32_t assembly_us)
+{
+    shtp_ChanMetrics_t *pMetrics = &pShtp->chan[chan].metrics;
+    unsigned bin = 0;
+    uint32_t limit = SHTP_LATENCY_BIN0_US;
+
+    while (bin < SHTP_LATENCY_BINS-1 && assembly_us >= limit) {
+        bin++;
+        limit <<= 1;
+    }
+
+    pMetrics->rxPayloads++;
+    pMetrics->rxBytes += len;
+    pMetrics->assemblyUs[bin]++;
+}
+
 static void rxAssemble(shtp_t *pShtp, uint8_t *in, uint16_t len, uint32_t t_us)
 {
     uint16_t payloadLen;
@@ -198,13 +316,6 @@ static void rxAssemble(shtp_t *pShtp, uint8_t *in, uint16_t len, uint32_t t_us)
     chan = in[2];
     seq = in[3];
 
-    if (seq != pShtp->chan[chan].nextInSeq){
-        if (pShtp->eventCallback) {
-            pShtp->eventCallback(pShtp->eventCookie,
-                                 SHTP_BAD_SN);
-        }
-    }
-    
     if (payloadLen < SHTP_HDR_LEN) {
         pShtp->rxShortFragments++;
         if (pShtp->eventCallback) {
@@ -223,6 +334,15 @@ static void rxAssemble(shtp_t *pShtp, uint8_t *in, uint16_t len, uint32_t t_us)
         return;
     }
 
+    // Checked once chan is known to be valid
+    if (seq != pShtp->chan[chan].nextInSeq){
+        pShtp->chan[chan].metrics.seqGaps++;
+        if (pShtp->eventCallback) {
+            pShtp->eventCallback(pShtp->eventCookie,
+                                 SHTP_BAD_SN);
+        }
+    }
+
     // Discard earlier assembly in progress if the received data doesn't match it.
     if (pShtp->inRemaining) {
         // Check this against previously received data.
@@ -249,6 +369,21 @@ static void rxAssemble(shtp_t *pShtp, uint8_t *in, uint16_t len, uint32_t t_us)
     // Remember next sequence number we expect for this channel.
     pShtp->chan[chan].nextInSeq = seq + 1;
 
+    if (pShtp->inRemaining == 0 && !continuation && len >= payloadLen) {
+        // The whole payload is in this one transfer, the common case for
+        // input reports. Deliver it from where it lies instead of copying it
+        // to inPayload. in stays valid until the callback returns.
+        pShtp->rxPayloads++;
+        pShtp->rxZeroCopy++;
+        rxDelivered(pShtp, chan, payloadLen - SHTP_HDR_LEN, 0);
+        if (pShtp->chan[chan].callback != 0) {
+            pShtp->chan[chan].callback(pShtp->chan[chan].cookie,
+                                       in + SHTP_HDR_LEN, payloadLen - SHTP_HDR_LEN,
+                                       t_us);
+        }
+        return;
+    }
+
     if (pShtp->inRemaining == 0) {
         if (payloadLen > sizeof(pShtp->inPayload)) {
             // Error: This payload won't fit! Discard it.
@@ -277,11 +412,14 @@ static void rxAssemble(shtp_t *pShtp, uint8_t *in, uint16_t len, uint32_t t_us)
         len = payloadLen;
     }
     memcpy(pShtp->inPayload + pShtp->inCursor, in+SHTP_HDR_LEN, len-SHTP_HDR_LEN);
+    pShtp->rxCopyBytes += len-SHTP_HDR_LEN;
     pShtp->inCursor += len-SHTP_HDR_LEN;
     pShtp->inRemaining = payloadLen - len;
 
     // If whole payload received, deliver it to channel listener.
     if (pShtp->inRemaining == 0) {
+        pShtp->rxPayloads++;
+        rxDelivered(pShtp, chan, pShtp->inCursor, t_us - pShtp->inTimestamp);
 
         // Call callback if there is one.
         if (pShtp->chan[chan].callback != 0) {
@@ -338,6 +476,11 @@ void shtp_close(void *pInstance)
 {
     shtp_t *pShtp = (shtp_t *)pInstance;
 
+    // Anything still queued will never go out
+    while (pShtp->txCount > 0) {
+        txPop(pShtp, SH2_ERR);
+    }
+
     pShtp->pHal->close(pShtp->pHal);
     
     // Deallocate the SHTP instance.
@@ -377,6 +520,15 @@ int shtp_listenChan(void *pInstance,
 int shtp_send(void *pInstance,
               uint8_t channel,
               const uint8_t *payload, uint16_t len)
+{
+    return shtp_sendAsync(pInstance, channel, payload, len, 0, 0);
+}
+
+// Queue an SHTP payload, with a callback when it's been sent
+int shtp_sendAsync(void *pInstance,
+                   uint8_t channel,
+                   const uint8_t *payload, uint16_t len,
+                   shtp_TxCallback_t *callback, void *cookie)
 {
     shtp_t *pShtp = (shtp_t *)pInstance;
     
@@ -389,7 +541,95 @@ int shtp_send(void *pInstance,
         return SH2_ERR_BAD_PARAM;
     }
 
-    return txProcess(pShtp, channel, payload, len);
+    int status = txEnqueue(pShtp, channel, payload, len, callback, cookie);
+    if (status != SH2_OK) {
+        return status;
+    }
+
+    // Start it on its way if the HAL will take it now
+    txAdvance(pShtp);
+
+    return SH2_OK;
+}
+
+void shtp_getRxStats(void *pInstance, uint32_t *payloads, uint32_t *zeroCopy, uint32_t *copyBytes)
+{
+    shtp_t *pShtp = (shtp_t *)pInstance;
+
+    *payloads = pShtp->rxPayloads;
+    *zeroCopy = pShtp->rxZeroCopy;
+    *copyBytes = pShtp->rxCopyBytes;
+}
+
+void shtp_getMetrics(void *pInstance, shtp_Metrics_t *metrics)
+{
+    shtp_t *pShtp = (shtp_t *)pInstance;
+
+    metrics->rxBadChan = pShtp->rxBadChan;
+    metrics->rxShortFragments = pShtp->rxShortFragments;
+    metrics->rxTooLargePayloads = pShtp->rxTooLargePayloads;
+    metrics->rxInterruptedPayloads = pShtp->rxInterruptedPayloads;
+    metrics->rxRingFull = pShtp->rxRingFull;
+    metrics->rxPayloads = pShtp->rxPayloads;
+    metrics->rxZeroCopy = pShtp->rxZeroCopy;
+    metrics->rxCopyBytes = pShtp->rxCopyBytes;
+    metrics->badTxChan = pShtp->badTxChan;
+    metrics->txDiscards = pShtp->txDiscards;
+    metrics->txTooLargePayloads = pShtp->txTooLargePayloads;
+    metrics->txQueueFull = pShtp->txQueueFull;
+
+    for (int n = 0; n < SHTP_MAX_CHANS; n++) {
+        metrics->chan[n] = pShtp->chan[n].metrics;
+    }
+}
+
+// Switch between reading the HAL in shtp_service() and draining the ring
+int shtp_setRxRing(void *pInstance, bool enable)
+{
+#if SHTP_RX_RING_SLOTS
+    shtp_t *pShtp = (shtp_t *)pInstance;
+
+    pShtp->rxRing = enable;
+    return SH2_OK;
+#else
+    (void)pInstance;
+    return enable ? SH2_ERR_BAD_PARAM : SH2_OK;
+#endif
+}
+
+// Producer side of the receive ring: read one transfer from the HAL into
+// the next free slot.
+int shtp_pump(void *pInstance)
+{
+#if SHTP_RX_RING_SLOTS
+    shtp_t *pShtp = (shtp_t *)pInstance;
+    unsigned head = atomic_load_explicit(&pShtp->rxHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&pShtp->rxTail, memory_order_acquire);
+
+    if (head - tail >= SHTP_RX_RING_SLOTS) {
+        // Consumer is behind. Leave the data with the hub until it catches up.
+        pShtp->rxRingFull++;
+        return SH2_ERR_OP_IN_PROGRESS;
+    }
+
+    shtp_RxSlot_t *pSlot = &pShtp->rxSlot[head & (SHTP_RX_RING_SLOTS - 1)];
+    uint32_t t_us = 0;
+    int len = pShtp->pHal->read(pShtp->pHal, pSlot->data, sizeof(pSlot->data), &t_us);
+    if (len <= 0) {
+        return len;
+    }
+
+    pSlot->len = len;
+    pSlot->t_us = t_us;
+
+    // Publish the slot
+    atomic_store_explicit(&pShtp->rxHead, head + 1, memory_order_release);
+
+    return len;
+#else
+    (void)pInstance;
+    return SH2_ERR;
+#endif
 }
 
 // Check for received data and process it.
@@ -397,6 +637,36 @@ void shtp_service(void *pInstance)
 {
     shtp_t *pShtp = (shtp_t *)pInstance;
     uint32_t t_us = 0;
+
+    // Queued transfers go out as the HAL makes room, never blocking receive
+    txAdvance(pShtp);
+
+#if SHTP_RX_RING_SLOTS
+    if (pShtp->rxRing) {
+        // A listener that runs a blocking sh2 operation from its callback
+        // services us again. Leave the slot being assembled alone until it
+        // returns.
+        if (pShtp->rxDraining) {
+            return;
+        }
+
+        unsigned tail = atomic_load_explicit(&pShtp->rxTail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&pShtp->rxHead, memory_order_acquire);
+        if (tail == head) {
+            return;
+        }
+
+        // One transfer per call, as when reading the HAL directly
+        shtp_RxSlot_t *pSlot = &pShtp->rxSlot[tail & (SHTP_RX_RING_SLOTS - 1)];
+        pShtp->rxDraining = true;
+        rxAssemble(pShtp, pSlot->data, pSlot->len, pSlot->t_us);
+        pShtp->rxDraining = false;
+
+        // Hand the slot back to the producer
+        atomic_store_explicit(&pShtp->rxTail, tail + 1, memory_order_release);
+        return;
+    }
+#endif
     
     int len = pShtp->pHal->read(pShtp->pHal, pShtp->inTransfer, sizeof(pShtp->inTransfer), &t_us);
     if (len > 0) {
@@ -27,6 +27,39 @@
 
 #include "sh2_hal.h"
 
+#define SHTP_MAX_CHANS (8)  // Max channels per SHTP device
+
+// Reassembly latency histogram: bin i counts payloads whose first and last
+// fragments were less than SHTP_LATENCY_BIN0_US << i apart, the last bin
+// everything slower
+#define SHTP_LATENCY_BINS (8)
+#define SHTP_LATENCY_BIN0_US (250)
+
+typedef struct shtp_ChanMetrics_s {
+    uint32_t rxPayloads;
+    uint32_t rxBytes;   // Payload bytes, headers excluded
+    uint32_t txPayloads;
+    uint32_t txBytes;
+    uint32_t seqGaps;   // Transfers that didn't carry the expected sequence number
+    uint32_t assemblyUs[SHTP_LATENCY_BINS];
+} shtp_ChanMetrics_t;
+
+typedef struct shtp_Metrics_s {
+    uint32_t rxBadChan;
+    uint32_t rxShortFragments;
+    uint32_t rxTooLargePayloads;
+    uint32_t rxInterruptedPayloads;
+    uint32_t rxRingFull;
+    uint32_t rxPayloads;
+    uint32_t rxZeroCopy;
+    uint32_t rxCopyBytes;
+    uint32_t badTxChan;
+    uint32_t txDiscards;
+    uint32_t txTooLargePayloads;
+    uint32_t txQueueFull;
+    shtp_ChanMetrics_t chan[SHTP_MAX_CHANS];
+} shtp_Metrics_t;
+
 typedef enum shtp_Event_e {
     SHTP_SHORT_FRAGMENT = 1,
     SHTP_TOO_LARGE_PAYLOADS = 2,
@@ -40,6 +73,10 @@ typedef enum shtp_Event_e {
 typedef void shtp_Callback_t(void * cookie, uint8_t *payload, uint16_t len, uint32_t timestamp);
 typedef void shtp_EventCallback_t(void *cookie, shtp_Event_t shtpEvent);
 
+// Called once per queued cargo: SH2_OK when its last transfer has been
+// written, or the HAL's error if it was discarded
+typedef void shtp_TxCallback_t(void *cookie, int status);
+
 // Open the SHTP communications session.
 // Takes a pointer to a HAL, which will be opened by this function.
 // Returns a pointer referencing the open SHTP session.  (Pass this as pInstance to later calls.)
@@ -59,12 +96,43 @@ int shtp_listenChan(void *pShtp,
                     uint8_t channel,
                     shtp_Callback_t *callback, void * cookie);
 
-// Send an SHTP payload on a particular channel
+// Send an SHTP payload on a particular channel.
+// The payload is split into transfers and queued; whatever the HAL won't take
+// right away goes out from later shtp_service() calls. Returns
+// SH2_ERR_OP_IN_PROGRESS if the queue has no room for it.
 int shtp_send(void *pShtp,
               uint8_t channel, const uint8_t *payload, uint16_t len);
 
+// As shtp_send, calling callback once the payload is sent or discarded
+int shtp_sendAsync(void *pShtp,
+                   uint8_t channel, const uint8_t *payload, uint16_t len,
+                   shtp_TxCallback_t *callback, void *cookie);
+
 // Check for received data and process it.
 void shtp_service(void *pShtp);
 
+// Receive path accounting: payloads delivered, how many of them went to the
+// listener straight from the transfer buffer, and bytes copied assembling
+// the rest
+void shtp_getRxStats(void *pShtp, uint32_t *payloads, uint32_t *zeroCopy, uint32_t *copyBytes);
+
+// Snapshot every transport counter. Safe to call from another thread: each
+// counter is read whole, but the set as a whole isn't taken atomically.
+void shtp_getMetrics(void *pShtp, shtp_Metrics_t *metrics);
+
+// Receive ring (built in when SHTP_RX_RING_SLOTS is nonzero).
+// With the ring enabled shtp_service() no longer reads the HAL. A producer,
+// typically an I/O task on another core, calls shtp_pump() to read transfers
+// into a ring of preallocated slots, and each shtp_service() call reassembles
+// and dispatches one of them. The ring is single producer, single consumer
+// and lock free; the HAL must tolerate read and write being called from
+// different threads. Enable it once shtp_open() has returned and before the
+// producer starts.
+int shtp_setRxRing(void *pShtp, bool enable);
+
+// Read one transfer from the HAL into the ring. Returns its length, 0 if the
+// HAL had nothing, SH2_ERR_OP_IN_PROGRESS if the ring is full.
+int shtp_pump(void *pShtp);
+
 // #ifdef SHTP_H
 #endif
@@ -0,0 +1,203 @@
+// Accuracy and speed of the polynomial Euler kernels in sh2/euler.c against
+// libm. The firmware runs the same timing at boot with
+// CONFIG_BNO08X_EULER_BENCH.
+//
+//   ./build/euler_bench [conversions]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "euler.h"
+
+typedef void (*convert_t)(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out);
+
+static const char *conv_names[] = {"zyx", "ceva", "diebel321"};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Difference of two angles, wrapped to [-pi, pi]
+static double angle_err(double a, double b)
+{
+    double d = fmod(a - b, 2 * M_PI);
+    if (d > M_PI) d -= 2 * M_PI;
+    if (d < -M_PI) d += 2 * M_PI;
+    return fabs(d);
+}
+
+static unsigned rng = 12345;
+
+static float frand(void)
+{
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 8) * (1.0f / 16777216.0f) * 2.0f - 1.0f;
+}
+
+static void random_quat(float q[4])
+{
+    float n;
+    do {
+        for (int c = 0; c < 4; c++) {
+            q[c] = frand();
+        }
+        n = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+    } while (n < 0.01f || n > 1.0f);
+
+    n = sqrtf(n);
+    for (int c = 0; c < 4; c++) {
+        q[c] /= n;
+    }
+}
+
+// The formulas as they were written at each call site, in double
+static void source_formula(const float qf[4], euler_convention_t conv, double out[3])
+{
+    double r = qf[0], i = qf[1], j = qf[2], k = qf[3];
+
+    switch (conv) {
+    case EULER_ZYX:
+        // main/bno08x.c quaternionToEuler()
+        out[0] = atan2(2.0 * (i * j + k * r), (i * i - j * j - k * k + r * r));
+        out[1] = asin(fmax(-1.0, fmin(1.0, -2.0 * (i * k - j * r) / (i * i + j * j + k * k + r * r))));
+        out[2] = atan2(2.0 * (j * k + i * r), (-i * i - j * j + k * k + r * r));
+        break;
+    case EULER_CEVA:
+        // sh2/euler.c q_to_ypr()
+        out[0] = atan2(2.0 * i * j - 2.0 * r * k, 2.0 * r * r + 2.0 * j * j - 1.0);
+        out[1] = asin(fmax(-1.0, fmin(1.0, 2.0 * j * k + 2.0 * r * i)));
+        out[2] = atan2(-2.0 * i * k + 2.0 * r * j, 2.0 * r * r + 2.0 * k * k - 1.0);
+        break;
+    case EULER_DIEBEL_321:
+        // Software/plotter.py quat_to_elev_azim_roll()
+        out[0] = atan2(-2 * i * j + 2 * r * k, i * i + r * r - k * k - j * j);
+        out[1] = asin(fmax(-1.0, fmin(1.0, 2 * i * k + 2 * r * j)));
+        out[2] = atan2(-2 * j * k + 2 * r * i, k * k - j * j - i * i + r * r);
+        break;
+    }
+}
+
+static void check_atan2(void)
+{
+    const int n = 4000000;
+    double max = 0, at = 0;
+
+    for (int s = 0; s < n; s++) {
+        double th = -M_PI + 2 * M_PI * s / n;
+        float y = (float)sin(th), x = (float)cos(th);
+        double e = angle_err(euler_atan2f(y, x), atan2((double)y, (double)x));
+        if (e > max) {
+            max = e;
+            at = th;
+        }
+    }
+    printf("euler_atan2f  max error %.2e rad (at %.4f rad)\n", max, at);
+}
+
+static void check_asin(void)
+{
+    const int n = 4000000;
+    double max = 0, at = 0;
+
+    for (int s = 0; s <= n; s++) {
+        float x = -1.0f + 2.0f * s / n;
+        double e = fabs(euler_asinf(x) - asin((double)x));
+        if (e > max) {
+            max = e;
+            at = x;
+        }
+    }
+    // The last few thousand ulps before 1, where asin is steepest
+    for (float x = 1.0f; x > 0.999f; x = nextafterf(x, 0.0f)) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            double e = fabs(euler_asinf(sign * x) - asin((double)(sign * x)));
+            if (e > max) {
+                max = e;
+                at = sign * x;
+            }
+        }
+    }
+    printf("euler_asinf   max error %.2e rad (at %.7f)\n", max, at);
+}
+
+static void check_quats(void)
+{
+    const int n = 1000000;
+
+    for (int c = EULER_ZYX; c <= EULER_DIEBEL_321; c++) {
+        double max_kernel = 0, max_source = 0;
+
+        rng = 12345;
+        for (int s = 0; s < n; s++) {
+            float q[4];
+            euler_angles_t fast, ref;
+            double src[3];
+
+            random_quat(q);
+            q_to_euler(q[0], q[1], q[2], q[3], c, &fast);
+            q_to_euler_libm(q[0], q[1], q[2], q[3], c, &ref);
+            source_formula(q, c, src);
+
+            double e = fmax(angle_err(fast.yaw, ref.yaw), fmax(angle_err(fast.pitch, ref.pitch), angle_err(fast.roll, ref.roll)));
+            max_kernel = fmax(max_kernel, e);
+
+            // Yaw and roll are undefined at gimbal lock, compare away from it
+            if (fabs(src[1]) < 89.0 * M_PI / 180) {
+                e = fmax(angle_err(fast.yaw, src[0]), fmax(angle_err(fast.pitch, src[1]), angle_err(fast.roll, src[2])));
+                max_source = fmax(max_source, e);
+            }
+        }
+        printf("q_to_euler %-9s max error %.2e rad vs libm, %.2e rad vs its source formula\n",
+               conv_names[c], max_kernel, max_source);
+    }
+}
+
+static void ypr_ceva(float r, float i, float j, float k, euler_convention_t conv, euler_angles_t *out)
+{
+    q_to_ypr(r, i, j, k, &out->yaw, &out->pitch, &out->roll);
+}
+
+static double time_convert(convert_t convert, float (*q)[4], int n, int reps, euler_convention_t conv)
+{
+    volatile float sink = 0;
+    euler_angles_t ypr;
+
+    double start = now_s();
+    for (int rep = 0; rep < reps; rep++) {
+        for (int s = 0; s < n; s++) {
+            convert(q[s][0], q[s][1], q[s][2], q[s][3], conv, &ypr);
+            sink += ypr.yaw + ypr.pitch + ypr.roll;
+        }
+    }
+    (void)sink;
+    return (now_s() - start) * 1e9 / ((double)n * reps);
+}
+
+int main(int argc, char **argv)
+{
+    int n = 1 << 16;
+    int reps = (argc > 1) ? atoi(argv[1]) / n + 1 : 64;
+
+    check_atan2();
+    check_asin();
+    check_quats();
+
+    float (*q)[4] = malloc(n * sizeof(*q));
+    rng = 777;
+    for (int s = 0; s < n; s++) {
+        random_quat(q[s]);
+    }
+
+    printf("ns per conversion (%d):\n", n * reps);
+    printf("  q_to_euler       %6.1f\n", time_convert(q_to_euler, q, n, reps, EULER_ZYX));
+    printf("  q_to_euler_libm  %6.1f\n", time_convert(q_to_euler_libm, q, n, reps, EULER_ZYX));
+    printf("  q_to_ypr         %6.1f\n", time_convert(ypr_ceva, q, n, reps, EULER_CEVA));
+
+    free(q);
+    return 0;
+}
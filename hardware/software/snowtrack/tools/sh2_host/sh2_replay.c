@@ -0,0 +1,134 @@
+// Feeds a captured SHTP trace (see main/shtp_trace.h) through the sh2 stack.
+//
+//   sh2_replay [--dump] [--init] trace.trc
+//
+// --init repeats the product id request bno_init() makes, so the stack's
+// writes can be checked against the recorded ones. --dump prints every
+// sensor event.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_SensorValue.h"
+#include "trace_replay.h"
+
+static trace_replay_t replay;
+static bool dump = false;
+
+static unsigned resets = 0;
+static uint32_t events = 0;
+static uint32_t decodeErrors = 0;
+static uint32_t perSensor[256];
+static uint64_t firstUs = 0, lastUs = 0;
+
+static void eventHandler(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+    if (pEvent->eventId == SH2_RESET) {
+        resets++;
+        if (dump) {
+            printf("reset\n");
+        }
+    }
+}
+
+static void sensorHandler(void *cookie, sh2_SensorEvent_t *event)
+{
+    sh2_SensorValue_t value;
+
+    if (sh2_decodeSensorEvent(&value, event) != SH2_OK) {
+        decodeErrors++;
+        return;
+    }
+
+    if (events == 0) {
+        firstUs = value.timestamp;
+    }
+    lastUs = value.timestamp;
+    events++;
+    perSensor[value.sensorId]++;
+
+    if (dump) {
+        if (value.sensorId == SH2_ROTATION_VECTOR) {
+            printf("%" PRIu64 " rv %u %.5f %.5f %.5f %.5f\n", value.timestamp, value.sequence,
+                   value.un.rotationVector.real, value.un.rotationVector.i,
+                   value.un.rotationVector.j, value.un.rotationVector.k);
+        } else {
+            printf("%" PRIu64 " 0x%02x %u\n", value.timestamp, value.sensorId, value.sequence);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    bool init = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0) {
+            dump = true;
+        } else if (strcmp(argv[i], "--init") == 0) {
+            init = true;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [--dump] [--init] trace.trc\n", argv[0]);
+        return 2;
+    }
+
+    if (!trace_replay_load(&replay, path)) {
+        fprintf(stderr, "Couldn't load trace %s\n", path);
+        return 1;
+    }
+
+    int status = sh2_open(trace_replay_hal(&replay), eventHandler, NULL);
+    if (status != SH2_OK) {
+        fprintf(stderr, "sh2_open failed (%d)\n", status);
+        return 1;
+    }
+    sh2_setSensorCallback(sensorHandler, NULL);
+
+    if (init) {
+        sh2_ProductIds_t prodIds;
+        memset(&prodIds, 0, sizeof(prodIds));
+        if (sh2_getProdIds(&prodIds) == SH2_OK) {
+            printf("Part %" PRIu32 "\n", prodIds.entry[0].swPartNumber);
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (!replay.done) {
+        sh2_service();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double cpu_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("Trace: %u bytes, %" PRIu32 " transfers, %u resets\n", replay.len, replay.reads, resets);
+    printf("Events: %" PRIu32 " over %.3f s, %" PRIu32 " decode errors\n",
+           events, (lastUs - firstUs) / 1e6, decodeErrors);
+    for (unsigned n = 0; n < 256; n++) {
+        if (perSensor[n] != 0) {
+            printf("  sensor 0x%02x: %" PRIu32 "\n", n, perSensor[n]);
+        }
+    }
+    printf("Writes: %" PRIu32 " matched, %" PRIu32 " differed, %" PRIu32 " extra, %" PRIu32 " recorded but not issued\n",
+           replay.writesMatched, replay.writesMismatched, replay.writesExtra,
+           trace_replay_writes_missed(&replay));
+    if (events > 0) {
+        printf("Host CPU: %.1f ns/event\n", cpu_s * 1e9 / events);
+    }
+
+    sh2_close();
+    trace_replay_free(&replay);
+    return (decodeErrors == 0) ? 0 : 1;
+}
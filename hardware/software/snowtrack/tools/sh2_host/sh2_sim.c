@@ -0,0 +1,532 @@
+// Runs the real sh2/shtp stack against a simulated BNO08x on the host and
+// reports how fast it gets through the hub's traffic.
+//
+//   sh2_sim [--transport i2c|spi] [--bus-hz N] [--read-max N]
+//           [--pipeline] [--decode-us N] [--ring] [--by-ref] [--batch-events]
+//           [--rate HZ] [--batch US] [--seconds S] [--capture FILE]
+//           [--hub-ppm N] [--int-jitter-us N] [--ops-hz N [--flush]]
+//           [--girv HZ]
+//           [run.csv ...]
+//
+// The hub replays the quaternions from the given run CSVs (Software/runs by
+// default) as rotation vector reports. Time on the bus and at the hub is
+// virtual; the CPU time spent in sh2_service() is real. --capture records
+// the session as an SHTP trace for sh2_replay.
+//
+// --decode-us charges the target's decode time per transfer to the virtual
+// clock, and --pipeline overlaps the next I2C read with it the way
+// CONFIG_BNO08X_I2C_ASYNC does. Comparing the two at the same settings gives
+// the latency and throughput the async path buys.
+//
+// --ring reads through the SHTP receive ring: the loop pumps every transfer
+// the hub has into the ring, as the firmware's I/O task does, and each
+// sh2_service() call only reassembles and dispatches.
+//
+// --by-ref takes sensor events through sh2_setSensorRefCallback() and decodes
+// them in place. The bytes copied per report on the receive path are printed
+// either way. --batch-events takes each payload's events in one
+// sh2_setSensorBatchCallback() call and decodes them with
+// sh2_decodeSensorBatch(), as the firmware does.
+//
+// --ops-hz N issues a non-blocking sh2_getSensorConfig() N times a second,
+// or with --flush an sh2_flush() of the batched rotation vectors, the way a
+// live view asks the firmware for fresh data.
+//
+// --hub-ppm runs the hub's oscillator fast (or slow, negative) against the
+// host and --int-jitter-us delays the host's H_INTN timestamps by up to that
+// much. Event timestamps are scored against the true sample times, and the
+// sh2 clock model's estimate of the hub's sample period is printed.
+//
+// --girv HZ also enables the gyro integrated rotation vector on its own
+// channel, as CONFIG_BNO08X_GIRV does, and prints its delivered rate and
+// latency next to the rotation vector's.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <math.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_SensorValue.h"
+#include "shtp_spi.h"
+#include "shtp_trace.h"
+#include "sim_hub.h"
+#include "sim_hal.h"
+#include "sim_spi.h"
+
+#ifndef SNOWTRACK_RUNS_DIR
+#define SNOWTRACK_RUNS_DIR "."
+#endif
+
+static const char *default_runs[] = {
+    SNOWTRACK_RUNS_DIR "/run7.csv",
+    SNOWTRACK_RUNS_DIR "/run8.csv",
+    SNOWTRACK_RUNS_DIR "/run11.csv",
+};
+
+static sim_hub_t hub;
+static sim_hal_t sim_hal;
+static sim_spi_t sim_spi;
+static shtp_spi_port_t spi_port;
+static shtp_spi_t spi_hal;
+static shtp_trace_t trace;
+
+typedef struct {
+    unsigned resets;
+    uint32_t reports;
+    uint32_t seqGaps;
+    uint32_t decodeErrors;
+    uint8_t lastSeq;
+    uint64_t latencySum_us;
+    uint32_t latencyMax_us;
+    uint32_t ops;           // Non-blocking ops completed, and of which failed
+    uint32_t opsFailed;
+    uint32_t opIssued_us;
+    uint64_t opSum_us;
+    uint32_t opMax_us;
+    uint32_t batches;       // Batch callbacks, with --batch-events
+    uint64_t lastTs_us;     // Timestamp error against the hub's sample times
+    int64_t tsErrSum_us;
+    uint32_t tsErrMax_us;
+    double dtErrSq;
+    uint32_t dtErrMax_us;
+    uint32_t nonMonotonic;
+    uint32_t girvReports;   // Gyro integrated RVs, with --girv
+    uint64_t girvLatencySum_us;
+    uint32_t girvLatencyMax_us;
+} bench_t;
+
+static bench_t bench;
+static bool use_spi = false;
+
+// H_INTN as the IMU task would see it
+static bool intAsserted(void)
+{
+    if (use_spi) {
+        return spi_port.waitInt(spi_port.ctx, 0);
+    }
+    return sim_hal_pending(&sim_hal);
+}
+
+static void eventHandler(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+    if (pEvent->eventId == SH2_RESET) {
+        bench.resets++;
+    }
+}
+
+static void checkReport(const sh2_SensorValue_t *value);
+
+static void opDone(void *cookie, int status)
+{
+    uint32_t took = hub.now_us - bench.opIssued_us;
+
+    bench.ops++;
+    if (status != SH2_OK) {
+        bench.opsFailed++;
+    }
+    bench.opSum_us += took;
+    if (took > bench.opMax_us) {
+        bench.opMax_us = took;
+    }
+}
+
+static void sensorHandler(void *cookie, sh2_SensorEvent_t *event)
+{
+    sh2_SensorValue_t value;
+
+    if (sh2_decodeSensorEvent(&value, event) != SH2_OK) {
+        bench.decodeErrors++;
+        return;
+    }
+    checkReport(&value);
+}
+
+static void sensorRefHandler(void *cookie, const sh2_SensorEventRef_t *event)
+{
+    sh2_SensorValue_t value;
+
+    if (sh2_decodeSensorEventRef(&value, event) != SH2_OK) {
+        bench.decodeErrors++;
+        return;
+    }
+    checkReport(&value);
+}
+
+static void sensorBatchHandler(void *cookie, const sh2_SensorEventRef_t *events, uint16_t count)
+{
+    sh2_SensorValue_t values[SH2_MAX_BATCH_EVENTS];
+    int decoded = sh2_decodeSensorBatch(values, events, count);
+
+    bench.batches++;
+    bench.decodeErrors += count - decoded;
+    for (int i = 0; i < decoded; i++) {
+        checkReport(&values[i]);
+    }
+}
+
+static void checkGirv(const sh2_SensorValue_t *value)
+{
+    uint32_t latency = hub.now_us - (uint32_t)value->timestamp;
+
+    bench.girvReports++;
+    bench.girvLatencySum_us += latency;
+    if (latency > bench.girvLatencyMax_us) {
+        bench.girvLatencyMax_us = latency;
+    }
+}
+
+static void checkReport(const sh2_SensorValue_t *value)
+{
+    if (value->sensorId == SH2_GYRO_INTEGRATED_RV) {
+        checkGirv(value);
+        return;
+    }
+
+    if (bench.reports > 0 && value->sequence != (uint8_t)(bench.lastSeq + 1)) {
+        bench.seqGaps++;
+    }
+
+    // Timestamp against when the hub took the sample, and the interval since
+    // the previous one against the true interval
+    int32_t err = (int32_t)((uint32_t)value->timestamp - hub.sampleUs[value->sequence]);
+    bench.tsErrSum_us += err;
+    if ((uint32_t)abs(err) > bench.tsErrMax_us) {
+        bench.tsErrMax_us = abs(err);
+    }
+    if (bench.reports > 0) {
+        if (value->timestamp <= bench.lastTs_us) {
+            bench.nonMonotonic++;
+        }
+        int32_t dt = (int32_t)(value->timestamp - bench.lastTs_us);
+        int32_t trueDt = (int32_t)(hub.sampleUs[value->sequence] - hub.sampleUs[bench.lastSeq]);
+        int32_t dtErr = dt - trueDt;
+        bench.dtErrSq += (double)dtErr * dtErr;
+        if ((uint32_t)abs(dtErr) > bench.dtErrMax_us) {
+            bench.dtErrMax_us = abs(dtErr);
+        }
+    }
+    bench.lastTs_us = value->timestamp;
+    bench.lastSeq = value->sequence;
+    bench.reports++;
+
+    // Virtual time from the sample being taken to the host having it decoded
+    uint32_t latency = hub.now_us - (uint32_t)value->timestamp;
+    bench.latencySum_us += latency;
+    if (latency > bench.latencyMax_us) {
+        bench.latencyMax_us = latency;
+    }
+}
+
+static void traceSink(void *cookie, const uint8_t *data, unsigned len)
+{
+    fwrite(data, 1, len, (FILE *)cookie);
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [--transport i2c|spi] [--bus-hz N] [--read-max N] "
+                    "[--pipeline] [--decode-us N] [--ring] [--by-ref] [--batch-events] [--ops-hz N] "
+                    "[--rate HZ] [--batch US] [--seconds S] [--capture FILE] [--hub-ppm N] [--int-jitter-us N] [--girv HZ] [run.csv ...]\n", argv0);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    const char *transport = "i2c";
+    long bus_hz = -1;
+    unsigned read_max = 250;
+    bool pipeline = false;
+    uint32_t decode_us = 0;
+    bool ring = false;
+    bool by_ref = false;
+    bool batch_events = false;
+    uint32_t ops_hz = 0;
+    bool flush = false;
+    uint32_t rate_hz = 400;
+    uint32_t batch_us = 0;
+    uint32_t girv_hz = 0;
+    uint32_t seconds = 10;
+    const char *capture = NULL;
+    FILE *capture_file = NULL;
+    int nfiles = 0;
+
+    sim_hub_init(&hub);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--transport") == 0 && i + 1 < argc) {
+            transport = argv[++i];
+        } else if (strcmp(argv[i], "--bus-hz") == 0 && i + 1 < argc) {
+            bus_hz = strtol(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--read-max") == 0 && i + 1 < argc) {
+            read_max = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = true;
+        } else if (strcmp(argv[i], "--decode-us") == 0 && i + 1 < argc) {
+            decode_us = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--by-ref") == 0) {
+            by_ref = true;
+        } else if (strcmp(argv[i], "--batch-events") == 0) {
+            batch_events = true;
+        } else if (strcmp(argv[i], "--flush") == 0) {
+            flush = true;
+        } else if (strcmp(argv[i], "--ops-hz") == 0 && i + 1 < argc) {
+            ops_hz = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--ring") == 0) {
+            ring = true;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate_hz = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_us = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture = argv[++i];
+        } else if (strcmp(argv[i], "--hub-ppm") == 0 && i + 1 < argc) {
+            hub.clockPpm = strtol(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--int-jitter-us") == 0 && i + 1 < argc) {
+            hub.intJitter_us = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--girv") == 0 && i + 1 < argc) {
+            girv_hz = strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] == '-') {
+            return usage(argv[0]);
+        } else {
+            if (sim_hub_load_csv(&hub, argv[i]) < 0) {
+                fprintf(stderr, "Couldn't read %s\n", argv[i]);
+                return 1;
+            }
+            nfiles++;
+        }
+    }
+
+    if (nfiles == 0) {
+        for (unsigned n = 0; n < sizeof(default_runs) / sizeof(default_runs[0]); n++) {
+            if (sim_hub_load_csv(&hub, default_runs[n]) < 0) {
+                fprintf(stderr, "Couldn't read %s, using identity orientation\n", default_runs[n]);
+            }
+        }
+    }
+    if (rate_hz == 0 || read_max < 8) {
+        return usage(argv[0]);
+    }
+
+    sh2_Hal_t *pHal;
+    if (strcmp(transport, "spi") == 0) {
+        use_spi = true;
+        sim_spi_init(&sim_spi, &hub, (bus_hz < 0) ? 3000000 : (uint32_t)bus_hz, &spi_port);
+        if (sim_spi.clock_hz == 0) {
+            return usage(argv[0]);
+        }
+        pHal = shtp_spi_init(&spi_hal, &spi_port);
+    } else if (strcmp(transport, "i2c") == 0) {
+        pHal = sim_hal_init(&sim_hal, &hub, read_max, (bus_hz < 0) ? 400000 : (uint32_t)bus_hz);
+        sim_hal.pipeline = pipeline;
+        sim_hal.decode_us = decode_us;
+    } else {
+        return usage(argv[0]);
+    }
+
+    if (capture != NULL) {
+        if ((capture_file = fopen(capture, "wb")) == NULL) {
+            fprintf(stderr, "Couldn't create %s\n", capture);
+            return 1;
+        }
+        pHal = shtp_trace_wrap(&trace, pHal, traceSink, capture_file, 0);
+    }
+
+    int status = sh2_open(pHal, eventHandler, NULL);
+    if (status != SH2_OK || bench.resets == 0) {
+        fprintf(stderr, "sh2_open failed (%d), resets seen: %u\n", status, bench.resets);
+        return 1;
+    }
+
+    sh2_ProductIds_t prodIds;
+    memset(&prodIds, 0, sizeof(prodIds));
+    if ((status = sh2_getProdIds(&prodIds)) != SH2_OK) {
+        fprintf(stderr, "sh2_getProdIds failed (%d)\n", status);
+        return 1;
+    }
+    printf("Part %" PRIu32 " v%u.%u.%u, %u orientation samples\n",
+           prodIds.entry[0].swPartNumber, prodIds.entry[0].swVersionMajor,
+           prodIds.entry[0].swVersionMinor, prodIds.entry[0].swVersionPatch, hub.numSamples);
+
+    sh2_setSensorCallback(sensorHandler, NULL);
+    if (by_ref) {
+        sh2_setSensorRefCallback(sensorRefHandler, NULL);
+    }
+    if (batch_events) {
+        sh2_setSensorBatchCallback(sensorBatchHandler, NULL);
+    }
+
+    sh2_SensorConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.reportInterval_us = 1000000 / rate_hz;
+    config.batchInterval_us = batch_us;
+    if ((status = sh2_setSensorConfig(SH2_ROTATION_VECTOR, &config)) != SH2_OK) {
+        fprintf(stderr, "sh2_setSensorConfig failed (%d)\n", status);
+        return 1;
+    }
+
+    if (girv_hz != 0) {
+        config.reportInterval_us = 1000000 / girv_hz;
+        config.batchInterval_us = 0;
+        if ((status = sh2_setSensorConfig(SH2_GYRO_INTEGRATED_RV, &config)) != SH2_OK) {
+            fprintf(stderr, "sh2_setSensorConfig(GIRV) failed (%d)\n", status);
+            return 1;
+        }
+    }
+
+    if (ring && (status = sh2_setRxRing(true)) != SH2_OK) {
+        fprintf(stderr, "sh2_setRxRing failed (%d)\n", status);
+        return 1;
+    }
+
+    // Service the hub like the IMU task does: sleep until H_INTN, then read
+    uint32_t start_us = hub.now_us;
+    uint32_t end_us = start_us + seconds * 1000000;
+    uint64_t service_ns = 0;
+    uint32_t services = 0;
+    uint32_t queued = 0;
+    uint32_t nextOp_us = start_us;
+    sh2_SensorConfig_t opConfig;
+
+    while ((int32_t)(end_us - hub.now_us) > 0) {
+        if (ops_hz != 0 && (int32_t)(hub.now_us - nextOp_us) >= 0 &&
+            sh2_opStatus() != SH2_ERR_OP_IN_PROGRESS) {
+            // Query the hub without holding up the report stream
+            bench.opIssued_us = hub.now_us;
+            nextOp_us += 1000000 / ops_hz;
+            sh2_async(opDone, NULL);
+            status = flush ? sh2_flush(SH2_ROTATION_VECTOR)
+                           : sh2_getSensorConfig(SH2_ROTATION_VECTOR, &opConfig);
+            if (status != SH2_OK) {
+                bench.opsFailed++;
+            }
+        }
+
+        if (ring) {
+            // Producer first: everything the hub has, until the ring fills
+            int rc;
+            while ((rc = sh2_pump()) > 0) {
+                queued++;
+            }
+            if (queued == 0 && rc != SH2_ERR_OP_IN_PROGRESS) {
+                uint32_t idle = sim_hub_idle_us(&hub);
+                uint32_t left = end_us - hub.now_us;
+                sim_hub_advance(&hub, (idle < left) ? idle : left);
+                continue;
+            }
+
+            uint64_t t0 = cpu_ns();
+            sh2_service();
+            service_ns += cpu_ns() - t0;
+            services++;
+            if (queued > 0) {
+                queued--;
+            }
+            continue;
+        }
+
+        uint32_t idle = intAsserted() ? 0 : sim_hub_idle_us(&hub);
+        if (ops_hz != 0 && idle > nextOp_us - hub.now_us) {
+            idle = nextOp_us - hub.now_us;
+        }
+        if (idle > 0) {
+            uint32_t left = end_us - hub.now_us;
+            sim_hub_advance(&hub, (idle < left) ? idle : left);
+            continue;
+        }
+
+        uint64_t t0 = cpu_ns();
+        sh2_service();
+        service_ns += cpu_ns() - t0;
+        services++;
+    }
+
+    double virt_s = (hub.now_us - start_us) / 1e6;
+    printf("Transport %s%s, rate %" PRIu32 " Hz, batch %" PRIu32 " us, %.1f s virtual\n",
+           transport, ring ? " via receive ring" : "", rate_hz, batch_us, virt_s);
+    printf("Reports: %" PRIu32 " generated, %" PRIu32 " delivered (%.0f Hz), %" PRIu32 " seq gaps, %" PRIu32 " hub drops\n",
+           hub.stats.reports, bench.reports, bench.reports / virt_s, bench.seqGaps, hub.stats.queueOverflows);
+    printf("Transfers: %" PRIu32 " (%" PRIu32 " continuation fragments), %" PRIu32 " cargos\n",
+           hub.stats.hubTransfers, hub.stats.fragments, hub.stats.cargos);
+    if (girv_hz != 0) {
+        printf("GIRV: %" PRIu32 " generated, %" PRIu32 " delivered (%.0f Hz), latency mean %.0f us, max %" PRIu32 " us\n",
+               hub.stats.girvReports, bench.girvReports, bench.girvReports / virt_s,
+               bench.girvReports ? (double)bench.girvLatencySum_us / bench.girvReports : 0.0, bench.girvLatencyMax_us);
+    }
+    if (!use_spi) {
+        printf("I2C: %" PRIu32 " reads, %" PRIu32 " prefetched, %" PRIu32 " us decode per transfer%s\n",
+               sim_hal.reads, sim_hal.prefetchHits, decode_us, pipeline ? ", pipelined" : "");
+    }
+    if (ops_hz != 0) {
+        printf("Ops: %" PRIu32 " non-blocking %s completed, %" PRIu32 " failed, round trip mean %.0f us, max %" PRIu32 " us\n",
+               bench.ops, flush ? "sh2_flush" : "sh2_getSensorConfig", bench.opsFailed, bench.ops ? (double)bench.opSum_us / bench.ops : 0.0, bench.opMax_us);
+    }
+    if (bench.reports > 0) {
+        printf("Latency (virtual): mean %.0f us, max %" PRIu32 " us\n",
+               (double)bench.latencySum_us / bench.reports, bench.latencyMax_us);
+        printf("Timestamps: error mean %.0f us, max %" PRIu32 " us; interval error rms %.1f us, max %" PRIu32 " us; %" PRIu32 " non-monotonic\n",
+               (double)bench.tsErrSum_us / bench.reports, bench.tsErrMax_us,
+               sqrt(bench.dtErrSq / bench.reports), bench.dtErrMax_us, bench.nonMonotonic);
+
+        sh2_ClockModel_t clock;
+        if (sh2_getClockModel(SH2_ROTATION_VECTOR, &clock) == SH2_OK) {
+            printf("Clock model: period %.3f us (nominal %" PRIu32 "), drift %" PRId32 " ppm, %" PRIu32 " outliers, %" PRIu32 " resyncs\n",
+                   clock.period_ns / 1000.0, clock.nominal_us, clock.drift_ppm, clock.outliers, clock.resyncs);
+        }
+        uint32_t all = bench.reports + bench.girvReports;
+        printf("Host CPU: %.1f ns/report, %.0f reports/s, %" PRIu32 " sh2_service calls\n",
+               (double)service_ns / all, all * 1e9 / service_ns, services);
+
+        sh2_RxStats_t rx;
+        if (sh2_getRxStats(&rx) == SH2_OK && rx.reports > 0) {
+            printf("Copies: %.1f bytes/report (shtp %.1f, events %.1f), %" PRIu32 "/%" PRIu32 " payloads zero-copy%s\n",
+                   (double)(rx.shtpCopyBytes + rx.eventCopyBytes) / rx.reports,
+                   (double)rx.shtpCopyBytes / rx.reports, (double)rx.eventCopyBytes / rx.reports,
+                   rx.zeroCopyPayloads, rx.payloads, (by_ref || batch_events) ? ", events by reference" : "");
+        }
+        if (batch_events) {
+            printf("Batches: %" PRIu32 " callbacks, %.2f reports/callback\n",
+                   bench.batches, (double)all / bench.batches);
+        }
+
+        sh2_Metrics_t metrics;
+        if (sh2_getMetrics(&metrics) == SH2_OK) {
+            for (int chan = 0; chan < SHTP_MAX_CHANS; chan++) {
+                const shtp_ChanMetrics_t *m = &metrics.shtp.chan[chan];
+                if (m->rxPayloads == 0 && m->txPayloads == 0) {
+                    continue;
+                }
+                printf("Channel %d: rx %" PRIu32 " payloads/%" PRIu32 " bytes, tx %" PRIu32 "/%" PRIu32 ", %" PRIu32 " seq gaps, assembly us",
+                       chan, m->rxPayloads, m->rxBytes, m->txPayloads, m->txBytes, m->seqGaps);
+                for (int bin = 0; bin < SHTP_LATENCY_BINS; bin++) {
+                    printf(" %s%u:%" PRIu32, (bin == SHTP_LATENCY_BINS-1) ? ">=" : "<",
+                           (bin == SHTP_LATENCY_BINS-1) ? SHTP_LATENCY_BIN0_US << (bin-1) : SHTP_LATENCY_BIN0_US << bin,
+                           m->assemblyUs[bin]);
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    sh2_close();
+    sim_hub_free(&hub);
+    if (capture_file != NULL) {
+        fclose(capture_file);
+        printf("Captured %" PRIu32 " records, %" PRIu32 " bytes to %s\n", trace.records, trace.bytes, capture);
+    }
+
+    return (bench.reports > 0 && bench.decodeErrors == 0) ? 0 : 1;
+}
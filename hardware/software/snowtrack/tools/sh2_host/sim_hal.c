@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "sim_hal.h"
+#include "sh2_err.h"
+
+#define SIM_HAL_TICK_US (1)
+
+static uint32_t busTime(sim_hal_t *sim, unsigned bytes)
+{
+    sim->busBytes += bytes + 1;
+    if (sim->bus_hz == 0) {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)(bytes + 1) * 9 * 1000000) / sim->bus_hz);
+}
+
+static void chargeBus(sim_hal_t *sim, unsigned bytes)
+{
+    sim_hub_advance(sim->hub, busTime(sim, bytes));
+}
+
+// Bring the virtual clock up to where the host is done decoding and any
+// queued read has finished
+static void catchUp(sim_hal_t *sim)
+{
+    if ((int32_t)(sim->decodeDone_us - sim->hub->now_us) > 0) {
+        sim_hub_advance(sim->hub, sim->decodeDone_us - sim->hub->now_us);
+    }
+    if (sim->prefetchLen != 0 && (int32_t)(sim->prefetchDone_us - sim->hub->now_us) > 0) {
+        sim_hub_advance(sim->hub, sim->prefetchDone_us - sim->hub->now_us);
+    }
+}
+
+// One bus read of at most len bytes, like i2chal_read's first read
+static unsigned busRead(sim_hal_t *sim, uint8_t *pBuffer, unsigned len)
+{
+    unsigned readLen = (len < sim->maxRead) ? len : sim->maxRead;
+    unsigned lenField = sim_hub_read(sim->hub, pBuffer, readLen);
+
+    sim->reads++;
+    // Like i2chal_read, only clock what the header says is there
+    return (lenField < readLen) ? lenField : readLen;
+}
+
+static int simhal_open(sh2_Hal_t *self)
+{
+    sim_hal_t *sim = (sim_hal_t *)self;
+
+    sim->prefetchLen = 0;
+    sim->decodeDone_us = sim->hub->now_us;
+    sim_hub_reset(sim->hub);
+    return SH2_OK;
+}
+
+static void simhal_close(sh2_Hal_t *self)
+{
+    sim_hal_t *sim = (sim_hal_t *)self;
+
+    sim->prefetchLen = 0;
+}
+
+static int simhal_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us)
+{
+    sim_hal_t *sim = (sim_hal_t *)self;
+    unsigned got;
+
+    catchUp(sim);
+
+    if (sim->prefetchLen != 0) {
+        got = (sim->prefetchLen < len) ? sim->prefetchLen : len;
+        memcpy(pBuffer, sim->prefetch, got);
+        *t_us = sim->prefetchT_us;
+        sim->prefetchLen = 0;
+        sim->prefetchHits++;
+    } else {
+        if (!sim_hub_pending(sim->hub)) {
+            return 0;
+        }
+        *t_us = sim->hub->intSeen_us;
+        got = busRead(sim, pBuffer, len);
+        chargeBus(sim, got);
+    }
+
+    // sh2 decodes this transfer before it calls us again
+    sim->decodeDone_us = sim->hub->now_us + sim->decode_us;
+
+    if (sim->pipeline && sim_hub_pending(sim->hub)) {
+        sim->prefetchT_us = sim->hub->intSeen_us;
+        sim->prefetchLen = busRead(sim, sim->prefetch, sizeof(sim->prefetch));
+        sim->prefetchDone_us = sim->hub->now_us + busTime(sim, sim->prefetchLen);
+    }
+
+    return got;
+}
+
+static int simhal_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len)
+{
+    sim_hal_t *sim = (sim_hal_t *)self;
+
+    // Queued behind any prefetch
+    catchUp(sim);
+    sim_hub_write(sim->hub, pBuffer, len);
+    sim->writes++;
+    chargeBus(sim, len);
+
+    return len;
+}
+
+static uint32_t simhal_getTimeUs(sh2_Hal_t *self)
+{
+    sim_hal_t *sim = (sim_hal_t *)self;
+
+    sim_hub_advance(sim->hub, SIM_HAL_TICK_US);
+    return sim->hub->now_us;
+}
+
+sh2_Hal_t *sim_hal_init(sim_hal_t *sim, sim_hub_t *hub, unsigned maxRead, uint32_t bus_hz)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->hub = hub;
+    sim->maxRead = maxRead;
+    sim->bus_hz = bus_hz;
+
+    sim->hal.open = simhal_open;
+    sim->hal.close = simhal_close;
+    sim->hal.read = simhal_read;
+    sim->hal.write = simhal_write;
+    sim->hal.getTimeUs = simhal_getTimeUs;
+
+    return &sim->hal;
+}
+
+bool sim_hal_pending(const sim_hal_t *sim)
+{
+    return sim->prefetchLen != 0 || sim_hub_pending(sim->hub);
+}
@@ -0,0 +1,47 @@
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+#include "sim_hub.h"
+
+// sh2_Hal_t talking straight to a simulated hub the way the I2C HAL does:
+// one bus read per call, at most maxRead bytes, so cargos longer than that
+// arrive as continuation fragments for shtp to reassemble. Reads stop at the
+// end of the transfer, as i2chal_read does. Bus time is charged to the hub's
+// virtual clock at bus_hz (9 clocks per byte plus the address byte), or not
+// at all if bus_hz is 0.
+//
+// decode_us models the host's time to decode each transfer it returns. With
+// pipeline set the HAL behaves like the async I2C mode: once a transfer is
+// returned, the first read of the next one is issued straight away and its
+// bus time overlaps that decode.
+
+typedef struct {
+    sh2_Hal_t hal;  // Must be first, sh2 passes this back as self
+    sim_hub_t *hub;
+    unsigned maxRead;
+    uint32_t bus_hz;
+    uint32_t decode_us;
+    bool pipeline;
+
+    uint32_t decodeDone_us;  // When the host is done with the last transfer
+    uint8_t prefetch[SH2_HAL_MAX_TRANSFER_IN];
+    unsigned prefetchLen;    // 0 if no read is queued
+    uint32_t prefetchT_us;
+    uint32_t prefetchDone_us;
+
+    uint32_t reads;
+    uint32_t prefetchHits;
+    uint32_t writes;
+    uint32_t busBytes;
+} sim_hal_t;
+
+sh2_Hal_t *sim_hal_init(sim_hal_t *sim, sim_hub_t *hub, unsigned maxRead, uint32_t bus_hz);
+
+// True if the HAL has a transfer to hand over, queued or at the hub
+bool sim_hal_pending(const sim_hal_t *sim);
+
+#endif
@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sim_hub.h"
+
+#define SHTP_HDR_LEN 4
+
+#define CHAN_COMMAND           (0)
+#define CHAN_EXECUTABLE_DEVICE (1)
+#define CHAN_SENSORHUB_CONTROL (2)
+#define CHAN_SENSORHUB_INPUT   (3)
+#define CHAN_SENSORHUB_GIRV    (5)
+
+#define EXEC_CMD_RESET (1)
+#define EXEC_CMD_ON    (2)
+#define EXEC_CMD_SLEEP (3)
+#define EXEC_RESP_RESET_COMPLETE (1)
+
+#define COMMAND_RESP         (0xF1)
+#define COMMAND_REQ          (0xF2)
+#define PROD_ID_RESP         (0xF8)
+#define PROD_ID_REQ          (0xF9)
+#define GET_FEATURE_RESP     (0xFC)
+#define SET_FEATURE_CMD      (0xFD)
+#define GET_FEATURE_REQ      (0xFE)
+#define BASE_TIMESTAMP_REF   (0xFB)
+#define FLUSH_COMPLETED      (0xEF)
+#define FORCE_FLUSH_REQ      (0xF0)
+
+#define ROTATION_VECTOR      (0x05)
+#define GAME_ROTATION_VECTOR (0x08)
+#define GYRO_INTEGRATED_RV   (0x2A)
+
+#define CMD_INITIALIZE       (4)
+#define INIT_SYSTEM          (1)
+#define INIT_UNSOLICITED     (0x80)
+
+#define COMMAND_RESP_LEN     (16)
+#define PROD_ID_RESP_LEN     (16)
+#define GET_FEATURE_RESP_LEN (17)
+#define PROD_ID_ENTRIES      (4)
+#define BASE_TIMESTAMP_LEN   (5)
+#define RV_LEN               (14)
+#define GAME_RV_LEN          (12)
+#define GIRV_LEN             (14)
+#define MAX_REPORT_LEN       (RV_LEN)
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Host time span as counted by the hub's oscillator
+static uint32_t hubTicks(const sim_hub_t *hub, uint32_t us)
+{
+    return us + (int32_t)((int64_t)us * hub->clockPpm / 1000000);
+}
+
+// A hub-clock interval in host time
+static uint32_t hostInterval(const sim_hub_t *hub, uint32_t hub_us)
+{
+    return hub_us - (int32_t)((int64_t)hub_us * hub->clockPpm / 1000000);
+}
+
+static void intFalls(sim_hub_t *hub)
+{
+    hub->intTime_us = hub->now_us;
+    hub->intSeen_us = hub->now_us;
+    if (hub->intJitter_us != 0) {
+        hub->jitterSeed = hub->jitterSeed * 1103515245 + 12345;
+        hub->intSeen_us += (hub->jitterSeed >> 8) % hub->intJitter_us;
+    }
+}
+
+void sim_hub_init(sim_hub_t *hub)
+{
+    memset(hub, 0, sizeof(*hub));
+}
+
+void sim_hub_free(sim_hub_t *hub)
+{
+    free(hub->samples);
+    hub->samples = NULL;
+    hub->numSamples = 0;
+}
+
+int sim_hub_load_csv(sim_hub_t *hub, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char line[256];
+    int loaded = 0;
+    unsigned cap = hub->numSamples;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        double t, w, x, y, z;
+        if (sscanf(line, "%lf,%lf,%lf,%lf,%lf", &t, &w, &x, &y, &z) != 5) {
+            continue;
+        }
+
+        if (hub->numSamples >= cap) {
+            cap = cap ? cap * 2 : 4096;
+            float (*grown)[4] = realloc(hub->samples, cap * sizeof(*grown));
+            if (grown == NULL) {
+                break;
+            }
+            hub->samples = grown;
+        }
+
+        float *q = hub->samples[hub->numSamples++];
+        q[0] = w;
+        q[1] = x;
+        q[2] = y;
+        q[3] = z;
+        loaded++;
+    }
+
+    fclose(f);
+    return loaded;
+}
+
+// Claim the next slot in the transmit queue, NULL if full
+static sim_hub_cargo_t *allocCargo(sim_hub_t *hub, uint8_t chan)
+{
+    if (hub->count >= SIM_HUB_QUEUE_LEN) {
+        hub->stats.queueOverflows++;
+        return NULL;
+    }
+
+    sim_hub_cargo_t *cargo = &hub->queue[(hub->head + hub->count) % SIM_HUB_QUEUE_LEN];
+    cargo->chan = chan;
+    cargo->len = 0;
+    cargo->stamps = 0;
+
+    return cargo;
+}
+
+static void commitCargo(sim_hub_t *hub)
+{
+    if (hub->count == 0) {
+        // H_INTN falls now
+        intFalls(hub);
+    }
+    hub->count++;
+}
+
+bool sim_hub_send(sim_hub_t *hub, uint8_t chan, const uint8_t *data, uint16_t len)
+{
+    if (len > SIM_HUB_MAX_CARGO) {
+        hub->stats.queueOverflows++;
+        return false;
+    }
+
+    sim_hub_cargo_t *cargo = allocCargo(hub, chan);
+    if (cargo == NULL) {
+        return false;
+    }
+
+    memcpy(cargo->data, data, len);
+    cargo->len = len;
+    commitCargo(hub);
+
+    return true;
+}
+
+static void sendAdvertisement(sim_hub_t *hub)
+{
+    // Just enough of the SHTP advertisement to look like a BNO08x: the
+    // channel map and the "sensorhub" application, tag/length/value
+    static const uint8_t advert[] = {
+        0x00,                               // Advertisement response
+        0x01, 0x04, 0x00, 0x00, 0x00, 0x00, // GUID: SHTP
+        0x03, 0x02, 0x80, 0x01,             // Max cargo + header read: 384
+        0x02, 0x02, 0x80, 0x00,             // Max cargo + header write: 128
+        0x08, 0x05, 'S', 'H', 'T', 'P', 0,  // App name
+        0x06, 0x01, 0x00,                   // Normal channel 0
+        0x09, 0x08, 'c', 'o', 'n', 't', 'r', 'o', 'l', 0,
+        0x01, 0x04, 0x01, 0x00, 0x00, 0x00, // GUID: executable
+        0x08, 0x0B, 'e', 'x', 'e', 'c', 'u', 't', 'a', 'b', 'l', 'e', 0,
+        0x06, 0x01, 0x01,
+        0x09, 0x07, 'd', 'e', 'v', 'i', 'c', 'e', 0,
+        0x01, 0x04, 0x02, 0x00, 0x00, 0x00, // GUID: sensorhub
+        0x08, 0x0A, 's', 'e', 'n', 's', 'o', 'r', 'h', 'u', 'b', 0,
+        0x06, 0x01, 0x02,
+        0x09, 0x08, 'c', 'o', 'n', 't', 'r', 'o', 'l', 0,
+        0x06, 0x01, 0x03,
+        0x09, 0x0A, 'i', 'n', 'p', 'u', 't', 'N', 'o', 'r', 'm', 0,
+        0x07, 0x01, 0x04,
+        0x09, 0x0A, 'i', 'n', 'p', 'u', 't', 'W', 'a', 'k', 'e', 0,
+        0x06, 0x01, 0x05,
+        0x09, 0x0A, 'i', 'n', 'p', 'u', 't', 'G', 'y', 'r', 'o', 0,
+    };
+
+    sim_hub_send(hub, CHAN_COMMAND, advert, sizeof(advert));
+}
+
+static void sendCommandResp(sim_hub_t *hub, uint8_t command, uint8_t commandSeq, const uint8_t *r, unsigned rLen)
+{
+    uint8_t resp[COMMAND_RESP_LEN] = {0};
+
+    resp[0] = COMMAND_RESP;
+    resp[1] = hub->cmdRespSeq++;
+    resp[2] = command;
+    resp[3] = commandSeq;
+    resp[4] = 0;  // Response sequence within this command
+    if (r != NULL) {
+        memcpy(&resp[5], r, rLen);
+    }
+
+    sim_hub_send(hub, CHAN_SENSORHUB_CONTROL, resp, sizeof(resp));
+}
+
+void sim_hub_reset(sim_hub_t *hub)
+{
+    hub->head = 0;
+    hub->count = 0;
+    hub->cursor = 0;
+    hub->asleep = false;
+    hub->batching = false;
+    memset(hub->outSeq, 0, sizeof(hub->outSeq));
+    memset(hub->feature, 0, sizeof(hub->feature));
+
+    sendAdvertisement(hub);
+
+    uint8_t resetComplete = EXEC_RESP_RESET_COMPLETE;
+    sim_hub_send(hub, CHAN_EXECUTABLE_DEVICE, &resetComplete, 1);
+
+    uint8_t init[2] = {0, INIT_SYSTEM};  // Status OK, subsystem
+    sendCommandResp(hub, CMD_INITIALIZE | INIT_UNSOLICITED, 0, init, sizeof(init));
+}
+
+bool sim_hub_pending(const sim_hub_t *hub)
+{
+    return hub->count > 0;
+}
+
+unsigned sim_hub_read(sim_hub_t *hub, uint8_t *buf, unsigned len)
+{
+    memset(buf, 0, len);
+
+    if (hub->count == 0 || len < SHTP_HDR_LEN) {
+        return 0;
+    }
+
+    sim_hub_cargo_t *cargo = &hub->queue[hub->head];
+    if (hub->cursor == 0) {
+        for (unsigned n = 0; n < cargo->stamps; n++) {
+            put32(&cargo->data[cargo->stampOffset[n] + 1], hubTicks(hub, hub->intTime_us - cargo->stampUs[n]) / 100);
+        }
+    }
+
+    uint16_t remaining = cargo->len - hub->cursor;
+    uint16_t lenField = remaining + SHTP_HDR_LEN;
+
+    buf[0] = lenField & 0xFF;
+    buf[1] = (lenField >> 8) & 0x7F;
+    if (hub->cursor > 0) {
+        buf[1] |= 0x80;
+    }
+    buf[2] = cargo->chan;
+    buf[3] = hub->outSeq[cargo->chan]++;
+
+    uint16_t n = len - SHTP_HDR_LEN;
+    if (n > remaining) {
+        n = remaining;
+    }
+    memcpy(buf + SHTP_HDR_LEN, cargo->data + hub->cursor, n);
+    hub->cursor += n;
+    hub->stats.hubTransfers++;
+
+    if (hub->cursor >= cargo->len) {
+        hub->head = (hub->head + 1) % SIM_HUB_QUEUE_LEN;
+        hub->count--;
+        hub->cursor = 0;
+        hub->stats.cargos++;
+        if (hub->count > 0) {
+            // H_INTN goes straight back down for the next cargo
+            intFalls(hub);
+        }
+    } else {
+        hub->stats.fragments++;
+    }
+
+    return lenField;
+}
+
+static void getFeatureResp(sim_hub_t *hub, uint8_t sensorId)
+{
+    uint8_t resp[GET_FEATURE_RESP_LEN] = {0};
+    const sim_hub_feature_t *f = &hub->feature[sensorId];
+
+    resp[0] = GET_FEATURE_RESP;
+    resp[1] = sensorId;
+    resp[2] = f->flags;
+    put16(&resp[3], f->changeSensitivity);
+    put32(&resp[5], f->interval_us);
+    put32(&resp[9], f->batchInterval_us);
+    put32(&resp[13], f->sensorSpecific);
+
+    sim_hub_send(hub, CHAN_SENSORHUB_CONTROL, resp, sizeof(resp));
+}
+
+static void prodIdResp(sim_hub_t *hub)
+{
+    // One cargo with all entries, like the real hub
+    uint8_t resp[PROD_ID_RESP_LEN * PROD_ID_ENTRIES] = {0};
+
+    for (int n = 0; n < PROD_ID_ENTRIES; n++) {
+        uint8_t *p = &resp[n * PROD_ID_RESP_LEN];
+        p[0] = PROD_ID_RESP;
+        p[1] = (n == 0) ? 1 : 0;  // Reset cause: power on
+        p[2] = 3;                 // Version 3.2.x
+        p[3] = 2;
+        put32(&p[4], SIM_HUB_PART_NUMBER + n);
+        put32(&p[8], 400 + n);
+        put16(&p[12], 13);
+    }
+
+    sim_hub_send(hub, CHAN_SENSORHUB_CONTROL, resp, sizeof(resp));
+}
+
+static void flushBatch(sim_hub_t *hub);
+
+static void controlRequest(sim_hub_t *hub, const uint8_t *p, unsigned len)
+{
+    switch (p[0]) {
+        case PROD_ID_REQ:
+            prodIdResp(hub);
+            break;
+        case SET_FEATURE_CMD:
+            if (len >= GET_FEATURE_RESP_LEN && p[1] < SIM_HUB_SENSORS) {
+                sim_hub_feature_t *f = &hub->feature[p[1]];
+                f->flags = p[2];
+                f->changeSensitivity = get16(&p[3]);
+                f->interval_us = get32(&p[5]);
+                f->batchInterval_us = get32(&p[9]);
+                f->sensorSpecific = get32(&p[13]);
+                f->nextDue_us = hub->now_us + hostInterval(hub, f->interval_us);
+                // The hub confirms every configuration change
+                getFeatureResp(hub, p[1]);
+            }
+            break;
+        case GET_FEATURE_REQ:
+            if (len >= 2 && p[1] < SIM_HUB_SENSORS) {
+                getFeatureResp(hub, p[1]);
+            }
+            break;
+        case FORCE_FLUSH_REQ:
+            if (len >= 2) {
+                // Whatever is batched goes out now, then the confirmation
+                flushBatch(hub);
+                uint8_t done[2] = {FLUSH_COMPLETED, p[1]};
+                sim_hub_send(hub, CHAN_SENSORHUB_INPUT, done, sizeof(done));
+                hub->stats.flushes++;
+            }
+            break;
+        case COMMAND_REQ:
+            if (len >= 3) {
+                uint8_t status = 0;
+                sendCommandResp(hub, p[2], p[1], &status, 1);
+            }
+            break;
+        default:
+            hub->stats.unknownRequests++;
+            break;
+    }
+}
+
+void sim_hub_write(sim_hub_t *hub, const uint8_t *buf, unsigned len)
+{
+    if (len < SHTP_HDR_LEN) {
+        return;
+    }
+
+    uint16_t lenField = get16(buf) & ~0x8000;
+    if (lenField < len) {
+        len = lenField;
+    }
+    uint8_t chan = buf[2];
+    const uint8_t *payload = buf + SHTP_HDR_LEN;
+    unsigned payloadLen = len - SHTP_HDR_LEN;
+
+    hub->stats.hostTransfers++;
+    if (payloadLen == 0) {
+        return;
+    }
+
+    switch (chan) {
+        case CHAN_EXECUTABLE_DEVICE:
+            if (payload[0] == EXEC_CMD_RESET) {
+                sim_hub_reset(hub);
+            } else if (payload[0] == EXEC_CMD_SLEEP) {
+                hub->asleep = true;
+            } else if (payload[0] == EXEC_CMD_ON) {
+                hub->asleep = false;
+            }
+            break;
+        case CHAN_SENSORHUB_CONTROL:
+            controlRequest(hub, payload, payloadLen);
+            break;
+        default:
+            hub->stats.unknownRequests++;
+            break;
+    }
+}
+
+static int16_t toQ(float v, int q)
+{
+    float scaled = roundf(v * (float)(1 << q));
+
+    if (scaled > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (scaled < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)scaled;
+}
+
+static unsigned buildReport(sim_hub_t *hub, uint8_t sensorId, uint8_t *rpt)
+{
+    static const float identity[4] = {1, 0, 0, 0};
+    const float *q = identity;
+
+    if (hub->numSamples > 0) {
+        q = hub->samples[hub->nextSample];
+        hub->nextSample = (hub->nextSample + 1) % hub->numSamples;
+    }
+
+    rpt[0] = sensorId;
+    rpt[1] = hub->feature[sensorId].seq++;
+    hub->sampleUs[rpt[1]] = hub->now_us;
+    rpt[2] = 3;  // Accuracy high, no extra delay
+    rpt[3] = 0;
+    put16(&rpt[4], toQ(q[1], 14));
+    put16(&rpt[6], toQ(q[2], 14));
+    put16(&rpt[8], toQ(q[3], 14));
+    put16(&rpt[10], toQ(q[0], 14));
+
+    if (sensorId == ROTATION_VECTOR) {
+        put16(&rpt[12], toQ(0.05f, 12));  // ~3 degrees heading accuracy
+        return RV_LEN;
+    }
+    return GAME_RV_LEN;
+}
+
+// Append a timestamp reference and a report to a cargo, false if full
+static bool appendReport(sim_hub_cargo_t *cargo, const uint8_t *rpt, unsigned len, uint32_t sample_us)
+{
+    if (cargo->len + BASE_TIMESTAMP_LEN + len > SIM_HUB_MAX_CARGO ||
+        cargo->stamps >= SIM_HUB_MAX_STAMPS) {
+        return false;
+    }
+
+    cargo->stampOffset[cargo->stamps] = cargo->len;
+    cargo->stampUs[cargo->stamps] = sample_us;
+    cargo->stamps++;
+
+    cargo->data[cargo->len] = BASE_TIMESTAMP_REF;
+    memset(&cargo->data[cargo->len + 1], 0, BASE_TIMESTAMP_LEN - 1);
+    memcpy(&cargo->data[cargo->len + BASE_TIMESTAMP_LEN], rpt, len);
+    cargo->len += BASE_TIMESTAMP_LEN + len;
+
+    return true;
+}
+
+static void flushBatch(sim_hub_t *hub)
+{
+    if (!hub->batching) {
+        return;
+    }
+    hub->batching = false;
+
+    sim_hub_cargo_t *cargo = allocCargo(hub, CHAN_SENSORHUB_INPUT);
+    if (cargo == NULL) {
+        return;
+    }
+
+    memcpy(cargo, &hub->batch, sizeof(*cargo));
+    commitCargo(hub);
+    hub->stats.batches++;
+}
+
+// Gyro integrated RVs go alone on their own channel, with no report id,
+// sequence number or timestamp, and are never batched
+static void produceGirv(sim_hub_t *hub)
+{
+    static const float identity[4] = {1, 0, 0, 0};
+    const float *q = (hub->numSamples > 0) ? hub->samples[hub->nextSample] : identity;
+    uint8_t rpt[GIRV_LEN] = {0};
+
+    put16(&rpt[0], toQ(q[1], 14));
+    put16(&rpt[2], toQ(q[2], 14));
+    put16(&rpt[4], toQ(q[3], 14));
+    put16(&rpt[6], toQ(q[0], 14));
+    // Angular velocity left at 0
+
+    hub->stats.girvReports++;
+    sim_hub_send(hub, CHAN_SENSORHUB_GIRV, rpt, sizeof(rpt));
+}
+
+static void produceReport(sim_hub_t *hub, uint8_t sensorId, uint32_t sample_us)
+{
+    sim_hub_feature_t *f = &hub->feature[sensorId];
+    uint8_t rpt[MAX_REPORT_LEN];
+
+    if (sensorId == GYRO_INTEGRATED_RV) {
+        produceGirv(hub);
+        return;
+    }
+
+    unsigned len = buildReport(hub, sensorId, rpt);
+
+    hub->stats.reports++;
+
+    if (f->batchInterval_us == 0) {
+        sim_hub_cargo_t *cargo = allocCargo(hub, CHAN_SENSORHUB_INPUT);
+        if (cargo != NULL) {
+            appendReport(cargo, rpt, len, sample_us);
+            commitCargo(hub);
+        }
+        return;
+    }
+
+    if (hub->batching && !appendReport(&hub->batch, rpt, len, sample_us)) {
+        // Batch buffer full, send what we have early
+        flushBatch(hub);
+    }
+    if (!hub->batching) {
+        hub->batch.chan = CHAN_SENSORHUB_INPUT;
+        hub->batch.len = 0;
+        hub->batch.stamps = 0;
+        hub->batching = true;
+        hub->batchDue_us = sample_us + f->batchInterval_us;
+        appendReport(&hub->batch, rpt, len, sample_us);
+    }
+}
+
+static bool sensorActive(const sim_hub_t *hub, unsigned sensorId)
+{
+    return !hub->asleep && hub->feature[sensorId].interval_us != 0 &&
+           (sensorId == ROTATION_VECTOR || sensorId == GAME_ROTATION_VECTOR ||
+            sensorId == GYRO_INTEGRATED_RV);
+}
+
+// Earliest thing the hub has scheduled, relative to now
+static uint32_t nextDue(const sim_hub_t *hub, int *sensorId)
+{
+    uint32_t due = UINT32_MAX;
+
+    *sensorId = -1;
+    for (unsigned n = 0; n < SIM_HUB_SENSORS; n++) {
+        if (sensorActive(hub, n)) {
+            uint32_t d = hub->feature[n].nextDue_us - hub->now_us;
+            if ((int32_t)d < 0) {
+                d = 0;
+            }
+            if (d < due) {
+                due = d;
+                *sensorId = n;
+            }
+        }
+    }
+
+    if (hub->batching) {
+        uint32_t d = hub->batchDue_us - hub->now_us;
+        if ((int32_t)d < 0) {
+            d = 0;
+        }
+        if (d <= due) {
+            due = d;
+            *sensorId = -1;
+        }
+    }
+
+    return due;
+}
+
+void sim_hub_advance(sim_hub_t *hub, uint32_t us)
+{
+    uint32_t end = hub->now_us + us;
+
+    for (;;) {
+        int sensorId;
+        uint32_t due = nextDue(hub, &sensorId);
+        if (due == UINT32_MAX || due > end - hub->now_us) {
+            break;
+        }
+
+        hub->now_us += due;
+        if (sensorId < 0) {
+            flushBatch(hub);
+        } else {
+            sim_hub_feature_t *f = &hub->feature[sensorId];
+            produceReport(hub, sensorId, hub->now_us);
+            f->nextDue_us += hostInterval(hub, f->interval_us);
+        }
+    }
+
+    hub->now_us = end;
+}
+
+uint32_t sim_hub_idle_us(const sim_hub_t *hub)
+{
+    int sensorId;
+
+    if (sim_hub_pending(hub)) {
+        return 0;
+    }
+    return nextDue(hub, &sensorId);
+}
@@ -0,0 +1,129 @@
+#ifndef SIM_HUB_H
+#define SIM_HUB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Device side of SHTP for a simulated BNO08x. The hub keeps a queue of
+// outgoing cargos and hands them out a transfer at a time, the way the real
+// hub does: every read starts with a header holding the cargo still to come
+// (continuation bit set after the first), followed by as much of it as the
+// host clocks.
+//
+// Time is virtual. Transports advance it, nothing here reads a real clock.
+// While a sensor is enabled the hub produces its reports on schedule as time
+// advances, using orientation samples loaded from recorded runs.
+
+#define SIM_HUB_QUEUE_LEN    (32)
+#define SIM_HUB_MAX_CARGO    (1020)
+#define SIM_HUB_CHANS        (8)
+#define SIM_HUB_SENSORS      (0x30)
+#define SIM_HUB_MAX_STAMPS   (64)
+
+#define SIM_HUB_PART_NUMBER  (10003608)
+
+typedef struct {
+    uint8_t chan;
+    uint16_t len;
+    // Base timestamp references (0xFB) are relative to when the host sees
+    // H_INTN, so they're filled in as the cargo starts going out
+    uint8_t stamps;
+    uint16_t stampOffset[SIM_HUB_MAX_STAMPS];
+    uint32_t stampUs[SIM_HUB_MAX_STAMPS];
+    uint8_t data[SIM_HUB_MAX_CARGO];
+} sim_hub_cargo_t;
+
+typedef struct {
+    uint8_t flags;
+    uint16_t changeSensitivity;
+    uint32_t interval_us;
+    uint32_t batchInterval_us;
+    uint32_t sensorSpecific;
+    uint32_t nextDue_us;
+    uint8_t seq;
+} sim_hub_feature_t;
+
+typedef struct {
+    uint32_t hostTransfers;  // Transfers received from the host
+    uint32_t hubTransfers;   // Transfers handed to the host
+    uint32_t cargos;         // Complete cargos delivered
+    uint32_t fragments;      // Transfers that didn't finish their cargo
+    uint32_t queueOverflows; // Cargos dropped because the queue was full
+    uint32_t unknownRequests;
+    uint32_t reports;        // Sensor reports generated
+    uint32_t batches;        // Batched input cargos sent
+    uint32_t flushes;        // Force flush requests served
+    uint32_t girvReports;    // Gyro integrated RVs generated
+} sim_hub_stats_t;
+
+typedef struct sim_hub_s {
+    uint32_t now_us;
+    uint32_t intTime_us;  // When H_INTN fell for the cargo at the head
+    uint32_t intSeen_us;  // When the host noticed, intJitter_us later at most
+
+    // Clock imperfections: the hub's oscillator runs clockPpm fast, and the
+    // host timestamps H_INTN up to intJitter_us late
+    int32_t clockPpm;
+    uint32_t intJitter_us;
+    uint32_t jitterSeed;
+
+    // True sample time of each sequence number, for scoring the host's
+    // timestamps (assumes one sensor is enabled)
+    uint32_t sampleUs[256];
+
+    // Orientation source, w x y z
+    float (*samples)[4];
+    unsigned numSamples;
+    unsigned nextSample;
+
+    // Input cargo being filled while a sensor has a batch interval
+    sim_hub_cargo_t batch;
+    bool batching;
+    uint32_t batchDue_us;
+
+    sim_hub_cargo_t queue[SIM_HUB_QUEUE_LEN];
+    unsigned head;
+    unsigned count;
+    uint16_t cursor;  // Bytes of the head cargo already sent
+
+    uint8_t outSeq[SIM_HUB_CHANS];
+    uint8_t cmdRespSeq;
+    bool asleep;
+
+    sim_hub_feature_t feature[SIM_HUB_SENSORS];
+
+    sim_hub_stats_t stats;
+} sim_hub_t;
+
+void sim_hub_init(sim_hub_t *hub);
+void sim_hub_free(sim_hub_t *hub);
+
+// Append the quaternions from a run CSV (timestamp_ms,w,x,y,z,...). Returns
+// the number of samples loaded, -1 if the file can't be read.
+int sim_hub_load_csv(sim_hub_t *hub, const char *path);
+
+// Power-on / RSTN release: drop everything and queue the advertisement,
+// reset complete and unsolicited initialize response
+void sim_hub_reset(sim_hub_t *hub);
+
+// Queue a cargo on a channel, false if the queue is full
+bool sim_hub_send(sim_hub_t *hub, uint8_t chan, const uint8_t *data, uint16_t len);
+
+// True while the hub holds H_INTN low
+bool sim_hub_pending(const sim_hub_t *hub);
+
+// Host reads len bytes. Fills buf with the next transfer, zero-padded past
+// its end, and returns the SHTP length of the transfer (0 if idle).
+unsigned sim_hub_read(sim_hub_t *hub, uint8_t *buf, unsigned len);
+
+// Host wrote a transfer
+void sim_hub_write(sim_hub_t *hub, const uint8_t *buf, unsigned len);
+
+// Move virtual time forward, producing any reports that fall due
+void sim_hub_advance(sim_hub_t *hub, uint32_t us);
+
+// Time until the hub next has something to send, UINT32_MAX if nothing is
+// scheduled. Lets a driver loop skip idle time instead of polling through it.
+uint32_t sim_hub_idle_us(const sim_hub_t *hub);
+
+#endif
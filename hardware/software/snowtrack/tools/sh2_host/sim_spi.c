@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include "sim_spi.h"
+
+// Virtual time that passes each time the host looks at the clock, so busy
+// loops in sh2 make progress
+#define SIM_SPI_TICK_US   (1)
+#define SIM_SPI_POLL_US   (100)
+
+static bool intAsserted(sim_spi_t *sim)
+{
+    if (sim->inReset || sim->csActive) {
+        return false;
+    }
+
+    // The hub answers WAKE by asserting H_INTN even with nothing to send
+    return sim->wake || sim_hub_pending(sim->hub);
+}
+
+static bool simspi_waitInt(void *ctx, uint32_t timeout_us)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+    uint32_t waited = 0;
+
+    while (!intAsserted(sim)) {
+        if (waited >= timeout_us) {
+            return false;
+        }
+        sim_hub_advance(sim->hub, SIM_SPI_POLL_US);
+        waited += SIM_SPI_POLL_US;
+    }
+
+    return true;
+}
+
+static uint32_t simspi_intTimeUs(void *ctx)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+
+    if (!sim_hub_pending(sim->hub)) {
+        // Asserted only to answer WAKE
+        return sim->hub->now_us;
+    }
+    return sim->hub->intSeen_us;
+}
+
+static void simspi_setWake(void *ctx, bool asserted)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+
+    sim->wake = asserted;
+}
+
+static void simspi_setReset(void *ctx, bool asserted)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+
+    if (asserted) {
+        sim->inReset = true;
+    } else if (sim->inReset) {
+        sim->inReset = false;
+        sim_hub_reset(sim->hub);
+    }
+}
+
+static int simspi_transfer(void *ctx, const uint8_t *tx, uint8_t *rx, unsigned len, bool keepCs)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+
+    if (len > 0 && !sim->csActive) {
+        // CS falling edge: the hub latches its next transfer, whole
+        sim->csActive = true;
+        sim->pos = 0;
+        memset(sim->in, 0, sizeof(sim->in));
+        sim_hub_read(sim->hub, sim->out, sizeof(sim->out));
+    }
+
+    for (unsigned n = 0; n < len; n++, sim->pos++) {
+        uint8_t out = (sim->pos < sizeof(sim->out)) ? sim->out[sim->pos] : 0;
+        if (rx != NULL) {
+            rx[n] = out;
+        }
+        if (sim->pos < sizeof(sim->in)) {
+            sim->in[sim->pos] = (tx != NULL) ? tx[n] : 0;
+        }
+    }
+    sim_hub_advance(sim->hub, (uint32_t)(((uint64_t)len * 8 * 1000000) / sim->clock_hz));
+
+    if (!keepCs && sim->csActive) {
+        sim->csActive = false;
+        sim_hub_write(sim->hub, sim->in, sim->pos);
+    }
+
+    return 0;
+}
+
+static uint32_t simspi_getTimeUs(void *ctx)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+
+    sim_hub_advance(sim->hub, SIM_SPI_TICK_US);
+    return sim->hub->now_us;
+}
+
+static void simspi_delayUs(void *ctx, uint32_t us)
+{
+    sim_spi_t *sim = (sim_spi_t *)ctx;
+
+    sim_hub_advance(sim->hub, us);
+}
+
+void sim_spi_init(sim_spi_t *sim, sim_hub_t *hub, uint32_t clock_hz, shtp_spi_port_t *port)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->hub = hub;
+    sim->clock_hz = clock_hz;
+
+    port->waitInt = simspi_waitInt;
+    port->intTimeUs = simspi_intTimeUs;
+    port->setWake = simspi_setWake;
+    port->setReset = simspi_setReset;
+    port->transfer = simspi_transfer;
+    port->getTimeUs = simspi_getTimeUs;
+    port->delayUs = simspi_delayUs;
+    port->ctx = sim;
+}
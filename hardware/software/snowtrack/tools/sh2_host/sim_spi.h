@@ -0,0 +1,31 @@
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "shtp_spi.h"
+#include "sim_hub.h"
+
+// SPI wiring between shtp_spi.c and a simulated hub: H_INTN, WAKE, RSTN, CS
+// and a full-duplex shift register. Bus time is charged to the hub's virtual
+// clock at clock_hz.
+
+#define SIM_SPI_BUF_LEN (SIM_HUB_MAX_CARGO + 4)
+
+typedef struct {
+    sim_hub_t *hub;
+    uint32_t clock_hz;
+
+    bool wake;
+    bool inReset;
+
+    bool csActive;
+    unsigned pos;
+    uint8_t out[SIM_SPI_BUF_LEN];  // Hub side of the current transfer
+    uint8_t in[SIM_SPI_BUF_LEN];   // Host side
+} sim_spi_t;
+
+void sim_spi_init(sim_spi_t *sim, sim_hub_t *hub, uint32_t clock_hz, shtp_spi_port_t *port);
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace_replay.h"
+#include "sh2_err.h"
+
+#define REPLAY_TICK_US (1)
+
+static bool nextOfType(const uint8_t **cursor, const uint8_t *end, shtp_trace_rec_t *rec, uint8_t type)
+{
+    while (shtp_trace_next(cursor, end, rec)) {
+        if (rec->type == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void replay_rewind(trace_replay_t *replay)
+{
+    shtp_trace_begin(replay->data, replay->len, &replay->readCursor);
+    replay->writeCursor = replay->readCursor;
+    memset(&replay->readRec, 0, sizeof(replay->readRec));
+    memset(&replay->writeRec, 0, sizeof(replay->writeRec));
+    replay->done = false;
+}
+
+static int replay_open(sh2_Hal_t *self)
+{
+    trace_replay_t *replay = (trace_replay_t *)self;
+
+    replay->opens++;
+    return SH2_OK;
+}
+
+static void replay_close(sh2_Hal_t *self)
+{
+}
+
+static int replay_read(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len, uint32_t *t_us)
+{
+    trace_replay_t *replay = (trace_replay_t *)self;
+    const uint8_t *end = replay->data + replay->len;
+
+    if (replay->done) {
+        return 0;
+    }
+
+    if (!nextOfType(&replay->readCursor, end, &replay->readRec, SHTP_TRACE_READ)) {
+        replay->done = true;
+        return 0;
+    }
+
+    unsigned n = (replay->readRec.len < len) ? replay->readRec.len : len;
+    memcpy(pBuffer, replay->readRec.data, n);
+    *t_us = replay->readRec.t_us;
+    replay->now_us = replay->readRec.t_us;
+    replay->reads++;
+
+    return n;
+}
+
+static int replay_write(sh2_Hal_t *self, uint8_t *pBuffer, unsigned len)
+{
+    trace_replay_t *replay = (trace_replay_t *)self;
+    const uint8_t *end = replay->data + replay->len;
+
+    if (!nextOfType(&replay->writeCursor, end, &replay->writeRec, SHTP_TRACE_WRITE)) {
+        replay->writesExtra++;
+        return len;
+    }
+
+    if (replay->writeRec.len == len && memcmp(replay->writeRec.data, pBuffer, len) == 0) {
+        replay->writesMatched++;
+    } else {
+        replay->writesMismatched++;
+    }
+
+    return len;
+}
+
+static uint32_t replay_getTimeUs(sh2_Hal_t *self)
+{
+    trace_replay_t *replay = (trace_replay_t *)self;
+
+    replay->now_us += REPLAY_TICK_US;
+    return replay->now_us;
+}
+
+bool trace_replay_load(trace_replay_t *replay, const char *path)
+{
+    memset(replay, 0, sizeof(*replay));
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    replay->data = malloc(size > 0 ? size : 1);
+    if (replay->data == NULL || fread(replay->data, 1, size, f) != (size_t)size) {
+        fclose(f);
+        trace_replay_free(replay);
+        return false;
+    }
+    fclose(f);
+    replay->len = size;
+
+    const uint8_t *cursor;
+    if (!shtp_trace_begin(replay->data, replay->len, &cursor)) {
+        trace_replay_free(replay);
+        return false;
+    }
+
+    replay_rewind(replay);
+
+    replay->hal.open = replay_open;
+    replay->hal.close = replay_close;
+    replay->hal.read = replay_read;
+    replay->hal.write = replay_write;
+    replay->hal.getTimeUs = replay_getTimeUs;
+
+    return true;
+}
+
+void trace_replay_free(trace_replay_t *replay)
+{
+    free(replay->data);
+    replay->data = NULL;
+    replay->len = 0;
+}
+
+sh2_Hal_t *trace_replay_hal(trace_replay_t *replay)
+{
+    return &replay->hal;
+}
+
+uint32_t trace_replay_writes_missed(trace_replay_t *replay)
+{
+    const uint8_t *end = replay->data + replay->len;
+    const uint8_t *cursor = replay->writeCursor;
+    shtp_trace_rec_t rec = replay->writeRec;
+    uint32_t missed = 0;
+
+    while (nextOfType(&cursor, end, &rec, SHTP_TRACE_WRITE)) {
+        missed++;
+    }
+    return missed;
+}
@@ -0,0 +1,45 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+#include "shtp_trace.h"
+
+// sh2_Hal_t that plays back an SHTP trace (shtp_trace.c). Reads return the
+// recorded hub transfers in order with their recorded timestamps; writes from
+// the stack are checked against the recorded ones. Time only moves when a
+// record is played, so a replay is the same every run.
+
+typedef struct {
+    sh2_Hal_t hal;  // Must be first, sh2 passes this back as self
+
+    uint8_t *data;
+    unsigned len;
+
+    const uint8_t *readCursor;
+    shtp_trace_rec_t readRec;
+    const uint8_t *writeCursor;
+    shtp_trace_rec_t writeRec;
+
+    uint32_t now_us;
+    bool done;
+
+    uint32_t reads;
+    uint32_t opens;
+    uint32_t writesMatched;
+    uint32_t writesMismatched;  // Differed from the next recorded write
+    uint32_t writesExtra;       // Issued after the recorded writes ran out
+} trace_replay_t;
+
+// Load a trace file. Returns false if it can't be read or isn't a trace
+bool trace_replay_load(trace_replay_t *replay, const char *path);
+void trace_replay_free(trace_replay_t *replay);
+
+sh2_Hal_t *trace_replay_hal(trace_replay_t *replay);
+
+// Recorded writes the stack never issued
+uint32_t trace_replay_writes_missed(trace_replay_t *replay);
+
+#endif
@@ -18,6 +18,19 @@ sh2_SensorId_t reportType = SH2_ROTATION_VECTOR;
 sh2_RotationVectorWAcc_t* meas;
 long reportIntervalUs = 5000;
 
+// Same frame as the snowtrack firmware's RESP_QUATS: type, count, then w x y z
+// as little endian Q14 int16
+#define RESP_QUATS 2
+uint8_t quatFrame[2 + 8] = {RESP_QUATS, 1};
+
+// The hub sent Q14, so this only undoes the library's conversion
+uint8_t *putQ14(uint8_t *p, float v) {
+  int16_t q = (int16_t)lroundf(v * 16384.0f);
+  p[0] = (uint16_t)q & 0xFF;
+  p[1] = ((uint16_t)q >> 8) & 0xFF;
+  return p + 2;
+}
+
 // Set bno report type and interval
 void setReports(sh2_SensorId_t reportType, long report_interval) {
   Serial.println("Setting desired reports");
@@ -59,7 +72,12 @@ void loop() {
     if (sensorValue.sensorId == SH2_ROTATION_VECTOR) {
       meas = &sensorValue.un.rotationVector;
       Serial.printf("%fw %fx %fy %fz\n", meas->real, meas->i, meas->j, meas->k);
-      SerialBT.printf("%f %f %f %f\n", meas->real, meas->i, meas->j, meas->k);
+      uint8_t *p = &quatFrame[2];
+      p = putQ14(p, meas->real);
+      p = putQ14(p, meas->i);
+      p = putQ14(p, meas->j);
+      p = putQ14(p, meas->k);
+      SerialBT.write(quatFrame, sizeof(quatFrame));
     }
   }
 }